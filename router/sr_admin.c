@@ -0,0 +1,638 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_admin.c
+ *
+ * Description:
+ *
+ * Local control socket.  See sr_admin.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include "sr_admin.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_stats.h"
+#include "sr_prof.h"
+
+#define SR_ADMIN_LINE      256
+#define SR_ADMIN_SEND_SECS 5     /* give up on a client that stops reading */
+
+static const char* sr_admin_tcp_states[] = {
+    "listen", "syn-sent", "syn-received", "established", "fin-wait-1",
+    "fin-wait-2", "close-wait", "close", "last-ack", "time-wait", "closed"
+};
+
+/*---------------------------------------------------------------------
+ * JSON output helpers
+ *---------------------------------------------------------------------*/
+
+/* counter names as keys: runs of anything but [a-z0-9] become one '_' */
+static void sr_admin_key(FILE* out, const char* name)
+{
+    int gap = 0;
+
+    fputc('"', out);
+    for(; *name; name++)
+    {
+        if(isalnum((unsigned char)*name))
+        {
+            if(gap)
+            { fputc('_', out); }
+            fputc(tolower((unsigned char)*name), out);
+            gap = 0;
+        }
+        else
+        { gap = 1; }
+    }
+    fputs("\":", out);
+}
+
+static void sr_admin_ip(FILE* out, uint32_t ip_nbo)
+{
+    struct in_addr in;
+    in.s_addr = ip_nbo;
+    fprintf(out, "\"%s\"", inet_ntoa(in));
+}
+
+static void sr_admin_mac(FILE* out, const unsigned char* mac)
+{
+    fprintf(out, "\"%02x:%02x:%02x:%02x:%02x:%02x\"",
+            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+static void sr_admin_error(FILE* out, const char* msg)
+{
+    fprintf(out, "{\"error\":\"%s\"}\n", msg);
+}
+
+/*---------------------------------------------------------------------
+ * Commands
+ *---------------------------------------------------------------------*/
+
+static void sr_admin_stats(struct sr_admin* admin, FILE* out)
+{
+    struct sr_stats st;
+    struct sr_if* iface;
+    int i, first = 1;
+
+    sr_stats_read(&st);
+
+    fputs("{\"interfaces\":[", out);
+    for(iface = admin->sr->if_list; iface; iface = iface->next)
+    {
+        if(iface->index >= SR_STATS_MAX_IFACES)
+        { continue; }
+        fprintf(out, "%s{\"name\":\"%s\",\"rx_packets\":%llu,\"rx_bytes\":%llu,"
+                "\"tx_packets\":%llu,\"tx_bytes\":%llu}",
+                first ? "" : ",", iface->name,
+                (unsigned long long)st.iface[iface->index].rx_packets,
+                (unsigned long long)st.iface[iface->index].rx_bytes,
+                (unsigned long long)st.iface[iface->index].tx_packets,
+                (unsigned long long)st.iface[iface->index].tx_bytes);
+        first = 0;
+    }
+    fputs("],\"counters\":{", out);
+    for(i = 0; i < sr_stat_ncounters; i++)
+    {
+        if(i)
+        { fputc(',', out); }
+        sr_admin_key(out, sr_stat_counter_name(i));
+        fprintf(out, "%llu", (unsigned long long)st.counter[i]);
+    }
+    fputs("},\"gauges\":{", out);
+    for(i = 0; i < sr_stat_ngauges; i++)
+    {
+        if(i)
+        { fputc(',', out); }
+        sr_admin_key(out, sr_stat_gauge_name(i));
+        fprintf(out, "%lld", (long long)st.gauge[i]);
+    }
+    fputs("},\"drops\":{", out);
+    for(i = 0; i < sr_drop_nreasons; i++)
+    {
+        if(i)
+        { fputc(',', out); }
+        sr_admin_key(out, sr_drop_reason_name(i));
+        fprintf(out, "%llu", (unsigned long long)st.drops[i]);
+    }
+    fputs("}}\n", out);
+} /* -- sr_admin_stats -- */
+
+static void sr_admin_hist(FILE* out)
+{
+    struct sr_prof_hist* merged;
+    struct sr_prof_hist* h;
+    int c, s, first_class = 1, first_stage;
+    unsigned int b, first_bucket;
+
+    merged = (struct sr_prof_hist*)malloc(sr_prof_nclasses * sr_prof_nstages *
+                                          sizeof(struct sr_prof_hist));
+    assert(merged);
+    sr_prof_read(merged);
+
+    fprintf(out, "{\"enabled\":%s,\"classes\":{", sr_prof_enabled ? "true" : "false");
+    for(c = 0; c < sr_prof_nclasses; c++)
+    {
+        first_stage = 1;
+        for(s = 0; s < sr_prof_nstages; s++)
+        {
+            h = &merged[c * sr_prof_nstages + s];
+            if(h->count == 0)
+            { continue; }
+            if(first_stage)
+            {
+                fprintf(out, "%s\"%s\":{", first_class ? "" : ",",
+                        sr_prof_class_name(c));
+                first_class = 0;
+            }
+            fprintf(out, "%s\"%s\":{\"count\":%llu,\"p50\":%.0f,\"p90\":%.0f,"
+                    "\"p99\":%.0f,\"p999\":%.0f,\"max\":%.0f,\"buckets\":[",
+                    first_stage ? "" : ",", sr_prof_stage_name(s),
+                    (unsigned long long)h->count,
+                    sr_prof_percentile_ns(h, 0.50), sr_prof_percentile_ns(h, 0.90),
+                    sr_prof_percentile_ns(h, 0.99), sr_prof_percentile_ns(h, 0.999),
+                    sr_prof_cycles_to_ns(h->max));
+            first_stage = 0;
+
+            /* [lower bound in ns, count] for each bucket that was hit */
+            first_bucket = 1;
+            for(b = 0; b < SR_PROF_BUCKETS; b++)
+            {
+                if(h->bucket[b] == 0)
+                { continue; }
+                fprintf(out, "%s[%.0f,%u]", first_bucket ? "" : ",",
+                        sr_prof_bucket_ns(b), h->bucket[b]);
+                first_bucket = 0;
+            }
+            fputs("]}", out);
+        }
+        if(!first_stage)
+        { fputc('}', out); }
+    }
+    fputs("}}\n", out);
+    free(merged);
+} /* -- sr_admin_hist -- */
+
+struct sr_admin_route
+{
+    uint32_t dest;
+    uint32_t gw;
+    uint32_t mask;
+    char interface[sr_IFACE_NAMELEN];
+};
+
+static void sr_admin_routes(struct sr_admin* admin, FILE* out)
+{
+    struct sr_admin_route* routes = 0;
+    struct sr_rtable* t;
+    struct sr_rt* rt;
+    unsigned int n = 0, i;
+
+    /* copy while online, format after: a reload frees the table only once
+       we are offline again, so a slow client must not hold us online */
+    sr_rcu_online(&(admin->rcu));
+    t = admin->sr->rtable;
+    if(t && t->nroutes)
+    {
+        routes = (struct sr_admin_route*)malloc(t->nroutes * sizeof(*routes));
+        assert(routes);
+        for(rt = t->routes; rt && n < t->nroutes; rt = rt->next, n++)
+        {
+            routes[n].dest = rt->dest.s_addr;
+            routes[n].gw = rt->gw.s_addr;
+            routes[n].mask = rt->mask.s_addr;
+            memcpy(routes[n].interface, rt->interface, sr_IFACE_NAMELEN);
+        }
+    }
+    sr_rcu_offline(&(admin->rcu));
+
+    fputs("[", out);
+    for(i = 0; i < n; i++)
+    {
+        fputs(i == 0 ? "{\"dest\":" : ",{\"dest\":", out);
+        sr_admin_ip(out, routes[i].dest);
+        fputs(",\"gw\":", out);
+        sr_admin_ip(out, routes[i].gw);
+        fputs(",\"mask\":", out);
+        sr_admin_ip(out, routes[i].mask);
+        fprintf(out, ",\"interface\":\"%s\"}", routes[i].interface);
+    }
+    fputs("]\n", out);
+    free(routes);
+} /* -- sr_admin_routes -- */
+
+static void sr_admin_reload(struct sr_admin* admin, FILE* out)
+{
+    int n = sr_rt_reload(admin->sr);
+
+    if(n < 0)
+    { sr_admin_error(out, "reload failed, old routing table kept"); }
+    else
+    { fprintf(out, "{\"routes\":%d}\n", n); }
+} /* -- sr_admin_reload -- */
+
+struct sr_admin_arpreq
+{
+    uint32_t ip;
+    uint32_t times_sent;
+    unsigned int queued;
+};
+
+static void sr_admin_arp(struct sr_admin* admin, FILE* out)
+{
+    struct sr_arpcache* cache = &(admin->sr->cache);
+    struct sr_arpentry entries[SR_ARPCACHE_SZ];
+    struct sr_admin_arpreq* reqs = 0;
+    struct sr_arpreq* req;
+    struct sr_packet* pkt;
+    unsigned int nreqs = 0, cap = 0, i;
+    sr_msec_t now = sr_clock_refresh();
+    int first = 1;
+
+    /* copy under the lock, format after */
+    pthread_mutex_lock(&(cache->lock));
+    memcpy(entries, cache->entries, sizeof(entries));
+    for(req = cache->requests; req; req = req->next)
+    {
+        if(nreqs == cap)
+        {
+            cap = cap ? cap * 2 : 16;
+            reqs = realloc(reqs, cap * sizeof(*reqs));
+            assert(reqs);
+        }
+        reqs[nreqs].ip = req->ip;
+        reqs[nreqs].times_sent = req->times_sent;
+        reqs[nreqs].queued = 0;
+        for(pkt = req->packets; pkt; pkt = pkt->next)
+        { reqs[nreqs].queued++; }
+        nreqs++;
+    }
+    pthread_mutex_unlock(&(cache->lock));
+
+    fputs("{\"entries\":[", out);
+    for(i = 0; i < SR_ARPCACHE_SZ; i++)
+    {
+        if(!entries[i].valid)
+        { continue; }
+        fputs(first ? "{\"ip\":" : ",{\"ip\":", out);
+        sr_admin_ip(out, entries[i].ip);
+        fputs(",\"mac\":", out);
+        sr_admin_mac(out, entries[i].mac);
+        fprintf(out, ",\"age_ms\":%llu}",
+                (unsigned long long)(now - entries[i].added));
+        first = 0;
+    }
+    fputs("],\"requests\":[", out);
+    for(i = 0; i < nreqs; i++)
+    {
+        fputs(i == 0 ? "{\"ip\":" : ",{\"ip\":", out);
+        sr_admin_ip(out, reqs[i].ip);
+        fprintf(out, ",\"times_sent\":%u,\"queued\":%u}",
+                reqs[i].times_sent, reqs[i].queued);
+    }
+    fputs("]}\n", out);
+    free(reqs);
+} /* -- sr_admin_arp -- */
+
+static void sr_admin_nat(struct sr_admin* admin, FILE* out)
+{
+    struct sr_nat* nat = &(admin->sr->nat);
+    struct sr_nat_mapping* copies;
+    struct sr_nat_mapping* m;
+    struct sr_nat_connection* conn;
+    sr_msec_t now = sr_clock_refresh();
+    unsigned int lo, hi;
+    int type, first = 1;
+
+    if(!admin->sr->nat_enabled)
+    {
+        sr_admin_error(out, "nat disabled");
+        return;
+    }
+
+    fputs("{\"mappings\":[", out);
+    for(type = nat_mapping_icmp; type <= nat_mapping_tcp; type++)
+    {
+        for(lo = 0; lo <= MAX_NAT_PORT; lo += SR_ADMIN_NAT_RANGE)
+        {
+            hi = lo + SR_ADMIN_NAT_RANGE - 1;
+            if(hi > MAX_NAT_PORT)
+            { hi = MAX_NAT_PORT; }
+            if(sr_nat_copy_range(nat, type, lo, hi, &copies) == 0)
+            { continue; }
+
+            for(m = copies; m; m = m->next)
+            {
+                fprintf(out, "%s{\"type\":\"%s\",\"ip_int\":", first ? "" : ",",
+                        m->type == nat_mapping_icmp ? "icmp" : "tcp");
+                sr_admin_ip(out, m->ip_int);
+                fprintf(out, ",\"aux_int\":%u,\"ip_ext\":", m->aux_int);
+                sr_admin_ip(out, m->ip_ext);
+                fprintf(out, ",\"aux_ext\":%u,\"idle_ms\":%llu,\"conns\":[",
+                        m->aux_ext, (unsigned long long)
+                        (now > m->last_updated ? now - m->last_updated : 0));
+                for(conn = m->conns; conn; conn = conn->next)
+                {
+                    fputs(conn == m->conns ? "{\"ip\":" : ",{\"ip\":", out);
+                    sr_admin_ip(out, conn->ip);
+                    fprintf(out, ",\"state\":\"%s\",\"idle_ms\":%llu}",
+                            sr_admin_tcp_states[conn->tcp_state],
+                            (unsigned long long)(now > conn->last_updated ?
+                                                 now - conn->last_updated : 0));
+                }
+                fputs("]}", out);
+                first = 0;
+            }
+            sr_nat_free_copies(copies);
+        }
+    }
+    fputs("]}\n", out);
+} /* -- sr_admin_nat -- */
+
+static void sr_admin_timeouts(struct sr_admin* admin, FILE* out)
+{
+    struct sr_nat* nat = &(admin->sr->nat);
+
+    pthread_mutex_lock(&(nat->lock));
+    fprintf(out, "{\"icmp_query\":%d,\"tcp_established\":%d,\"tcp_transitory\":%d}\n",
+            nat->icmp_query_timeout, nat->tcp_established_idle_timeout,
+            nat->tcp_transitory_idle_timeout);
+    pthread_mutex_unlock(&(nat->lock));
+}
+
+static void sr_admin_set(struct sr_admin* admin, FILE* out,
+                         const char* name, const char* value)
+{
+    struct sr_nat* nat = &(admin->sr->nat);
+    char* end;
+    long secs;
+
+    if(!name || !value)
+    {
+        sr_admin_error(out, "usage: set <timeout> <seconds>");
+        return;
+    }
+    secs = strtol(value, &end, 10);
+    if(*end != '\0' || secs <= 0 || secs > 0x7fffffff / 1000)
+    {
+        sr_admin_error(out, "bad number of seconds");
+        return;
+    }
+
+    pthread_mutex_lock(&(nat->lock));
+    if(strcmp(name, "icmp-query") == 0)
+    {
+        nat->icmp_query_timeout = (int)secs;
+    }
+    else if(strcmp(name, "tcp-established") == 0 &&
+            secs >= MIN_TCP_ESTABLISHED_IDLE_TIMEOUT)
+    {
+        nat->tcp_established_idle_timeout = (int)secs;
+    }
+    else if(strcmp(name, "tcp-transitory") == 0 &&
+            secs >= MIN_TCP_TRANSITORY_IDLE_TIMEOUT)
+    {
+        nat->tcp_transitory_idle_timeout = (int)secs;
+    }
+    else
+    {
+        pthread_mutex_unlock(&(nat->lock));
+        sr_admin_error(out, "unknown timeout or below its minimum");
+        return;
+    }
+    pthread_mutex_unlock(&(nat->lock));
+
+    sr_admin_timeouts(admin, out);
+} /* -- sr_admin_set -- */
+
+static void sr_admin_command(struct sr_admin* admin, FILE* out, char* line)
+{
+    char* cmd = strtok(line, " \t\r\n");
+    char* arg1 = strtok(0, " \t\r\n");
+    char* arg2 = strtok(0, " \t\r\n");
+
+    if(!cmd)
+    { return; }
+
+    if(strcmp(cmd, "stats") == 0)
+    { sr_admin_stats(admin, out); }
+    else if(strcmp(cmd, "hist") == 0)
+    { sr_admin_hist(out); }
+    else if(strcmp(cmd, "routes") == 0)
+    { sr_admin_routes(admin, out); }
+    else if(strcmp(cmd, "reload") == 0)
+    { sr_admin_reload(admin, out); }
+    else if(strcmp(cmd, "arp") == 0)
+    { sr_admin_arp(admin, out); }
+    else if(strcmp(cmd, "nat") == 0)
+    { sr_admin_nat(admin, out); }
+    else if(strcmp(cmd, "timeouts") == 0)
+    { sr_admin_timeouts(admin, out); }
+    else if(strcmp(cmd, "set") == 0)
+    { sr_admin_set(admin, out, arg1, arg2); }
+    else if(strcmp(cmd, "help") == 0)
+    {
+        fputs("{\"commands\":[\"stats\",\"hist\",\"routes\",\"reload\",\"arp\",\"nat\","
+              "\"timeouts\",\"set icmp-query|tcp-established|tcp-transitory <seconds>\"]}\n",
+              out);
+    }
+    else
+    { sr_admin_error(out, "unknown command, try help"); }
+
+    fflush(out);
+} /* -- sr_admin_command -- */
+
+/*---------------------------------------------------------------------
+ * Thread
+ *---------------------------------------------------------------------*/
+
+/* Serve one client until it hangs up or we are stopped.  Returns 0 when
+   the thread should stop. */
+static int sr_admin_serve(struct sr_admin* admin, int fd)
+{
+    struct pollfd pfd[2];
+    struct timeval tv;
+    char line[SR_ADMIN_LINE];
+    size_t used = 0;
+    ssize_t n;
+    char* nl;
+    FILE* out;
+
+    tv.tv_sec = SR_ADMIN_SEND_SECS;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    out = fdopen(dup(fd), "w");
+    if(!out)
+    {
+        perror("fdopen(..):sr_admin.c::sr_admin_serve(..)");
+        close(fd);
+        return 1;
+    }
+
+    for(;;)
+    {
+        pfd[0].fd = fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = admin->stop_fd[0];
+        pfd[1].events = POLLIN;
+        if(poll(pfd, 2, -1) < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            break;
+        }
+        if(pfd[1].revents)
+        {
+            fclose(out);
+            close(fd);
+            return 0;
+        }
+
+        n = read(fd, line + used, sizeof(line) - 1 - used);
+        if(n <= 0)
+        { break; }
+        used += n;
+        line[used] = '\0';
+
+        while((nl = strchr(line, '\n')) != 0)
+        {
+            *nl = '\0';
+            sr_admin_command(admin, out, line);
+            used -= nl + 1 - line;
+            memmove(line, nl + 1, used + 1);
+        }
+        if(used == sizeof(line) - 1)
+        {
+            sr_admin_error(out, "line too long");
+            break;
+        }
+        if(ferror(out))
+        { break; }
+    }
+
+    fclose(out);
+    close(fd);
+    return 1;
+} /* -- sr_admin_serve -- */
+
+static void* sr_admin_main(void* arg)
+{
+    struct sr_admin* admin = (struct sr_admin*)arg;
+    struct pollfd pfd[2];
+    int fd;
+
+    sr_rcu_register(&(admin->rcu));
+    for(;;)
+    {
+        pfd[0].fd = admin->listen_fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = admin->stop_fd[0];
+        pfd[1].events = POLLIN;
+        if(poll(pfd, 2, -1) < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            perror("poll(..):sr_admin.c::sr_admin_main(..)");
+            break;
+        }
+        if(pfd[1].revents)
+        { break; }
+
+        fd = accept(admin->listen_fd, 0, 0);
+        if(fd < 0)
+        { continue; }
+        if(!sr_admin_serve(admin, fd))
+        { break; }
+    }
+    sr_rcu_unregister(&(admin->rcu));
+    return 0;
+} /* -- sr_admin_main -- */
+
+struct sr_admin* sr_admin_open(struct sr_instance* sr, const char* path)
+{
+    struct sr_admin* admin;
+    struct sockaddr_un addr;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(path);
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Admin socket path too long: %s\n", path);
+        return 0;
+    }
+
+    admin = (struct sr_admin*)calloc(1, sizeof(struct sr_admin));
+    assert(admin);
+    admin->sr = sr;
+    strcpy(admin->path, path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    admin->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(admin->listen_fd < 0)
+    {
+        perror("socket(..):sr_admin.c::sr_admin_open(..)");
+        free(admin);
+        return 0;
+    }
+    unlink(path);
+    if(bind(admin->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+       listen(admin->listen_fd, 4) != 0)
+    {
+        perror("bind(..):sr_admin.c::sr_admin_open(..)");
+        close(admin->listen_fd);
+        free(admin);
+        return 0;
+    }
+    if(pipe(admin->stop_fd) != 0)
+    {
+        perror("pipe(..):sr_admin.c::sr_admin_open(..)");
+        close(admin->listen_fd);
+        unlink(path);
+        free(admin);
+        return 0;
+    }
+    if(pthread_create(&(admin->thread), 0, sr_admin_main, admin) != 0)
+    {
+        fprintf(stderr, "Error starting admin socket thread\n");
+        close(admin->stop_fd[0]);
+        close(admin->stop_fd[1]);
+        close(admin->listen_fd);
+        unlink(path);
+        free(admin);
+        return 0;
+    }
+    return admin;
+} /* -- sr_admin_open -- */
+
+void sr_admin_close(struct sr_admin* admin)
+{
+    if(!admin)
+    { return; }
+
+    if(write(admin->stop_fd[1], "x", 1) != 1)
+    { perror("write(..):sr_admin.c::sr_admin_close(..)"); }
+    pthread_join(admin->thread, 0);
+
+    close(admin->stop_fd[0]);
+    close(admin->stop_fd[1]);
+    close(admin->listen_fd);
+    unlink(admin->path);
+    free(admin);
+} /* -- sr_admin_close -- */
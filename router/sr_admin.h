@@ -0,0 +1,60 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_admin.h
+ *
+ * Description:
+ *
+ * Local control socket.  A Unix-domain stream socket served by its own
+ * thread, so nothing it does runs on the forwarding loop.  Clients send one
+ * command per line and get one JSON document back per command, terminated
+ * by a newline:
+ *
+ *   stats                       interface, NAT/ARP and drop counters
+ *   hist                        stage latency histograms (sr_prof.h)
+ *   routes                      routing table
+ *   reload                      re-read the routing table file (sr_rt.h)
+ *   arp                         ARP cache entries and pending requests
+ *   nat                         NAT mappings with their TCP connections
+ *   timeouts                    NAT idle timeouts in seconds
+ *   set <timeout> <seconds>     change one of them: icmp-query,
+ *                               tcp-established or tcp-transitory
+ *   help
+ *
+ * e.g.  echo nat | socat - UNIX-CONNECT:/tmp/sr.sock
+ *
+ * The NAT table is copied out a range of external ports at a time, so the
+ * NAT lock is never held for more than one walk of the table; a dump of a
+ * table that changes meanwhile is consistent per range, not as a whole.
+ * A changed timeout applies to each mapping when its idle timer next fires.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ADMIN_H
+#define SR_ADMIN_H
+
+#include <pthread.h>
+#include <sys/un.h>
+
+#include "sr_rcu.h"
+
+struct sr_instance;
+
+#define SR_ADMIN_NAT_RANGE 1024   /* external ports copied per lock hold */
+
+struct sr_admin
+{
+    struct sr_instance* sr;
+    int listen_fd;
+    int stop_fd[2];               /* pipe; written to stop the thread */
+    char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    pthread_t thread;
+    struct sr_rcu_reader rcu;     /* online while reading the routes */
+};
+
+/* Listen on 'path' (replacing a stale socket) and start the thread.
+   Returns NULL on error. */
+struct sr_admin* sr_admin_open(struct sr_instance* sr, const char* path);
+
+/* Stop the thread, close the socket and remove it. */
+void sr_admin_close(struct sr_admin* admin);
+
+#endif /* -- SR_ADMIN_H -- */
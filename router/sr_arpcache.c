@@ -10,14 +10,15 @@
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_stats.h"
 
 /* Custom method: handle ARP request, send ARP requests if necessary, reference: "sr_arpcache.h" */
 void handle_arpreq(struct sr_instance* sr, struct sr_arpreq* request) {
     /* record current time */
-    time_t current_time;
-    time(&current_time);
+    sr_msec_t current_time = sr_clock_now();
 
-    if(difftime(current_time, request->sent) >= 1.0) {
+    /* a retry is already scheduled; its timer calls back in here */
+    if(!sr_timer_pending(&request->timer)) {
         if(request->times_sent >= 5) {
             /* send 'ICMP host unreachable' to source MAC of all packets waiting on this request */
             struct sr_packet* packet = request->packets;
@@ -30,78 +31,60 @@ void handle_arpreq(struct sr_instance* sr, struct sr_arpreq* request) {
                     /* send icmp dest_unreachable to packet's source */
                     send_icmp_msg(sr, packet->buf, packet->len, icmp_type_dest_unreachable, icmp_dest_unreachable_host);
                 }
+                SR_STATS_INC(sr_stat_arp_queue_drop);
+                SR_STATS_DROP(sr_drop_arp_unresolved);
                 /* default linked list structure of packet sr_packet in "sr_arpcache.h" */
                 packet = packet->next;
             }
             sr_arpreq_destroy(&sr->cache, request);
         } else {
             /* send ARP request */
-            /* get the interface by name */
-            struct sr_if* interface = sr_get_interface(sr, request->packets->iface);
+            /* get the interface by index */
+            struct sr_if* interface = sr_if_at(sr, request->packets->ifindex);
             if(!interface) {
                 printf("Error: handle_arpreq: failed to get outgoing interface.\n");
+                SR_STATS_DROP(sr_drop_arp_no_interface);
                 return;
             }
 
-            /* construct ARP request */
-            int len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
-            uint8_t* arpreq = malloc(len);
+            /* construct ARP request from the interface's template */
+            uint8_t* arpreq = sr_ctl_get(&sr->ctl);
+            unsigned int len = sr_ctl_arp_request(sr, interface, arpreq, request->ip);
 
-            /* construct ARP request ethernet header */
-            sr_ethernet_hdr_t* arpreq_eth_hdr = (sr_ethernet_hdr_t*)arpreq;
-            /* set destination MAC: FF-FF-FF-FF-FF-FF */
-            memset(arpreq_eth_hdr->ether_dhost, 0xFF, ETHER_ADDR_LEN);
-            /* set source MAC: outgoing interface's MAC */
-            memcpy(arpreq_eth_hdr->ether_shost, interface->addr, ETHER_ADDR_LEN);
-            arpreq_eth_hdr->ether_type = htons(ethertype_arp);
-
-            /* construct ARP request ARP header */
-            sr_arp_hdr_t* arpreq_arp_hdr = (sr_arp_hdr_t*)(arpreq + sizeof(sr_ethernet_hdr_t));
-            /* values handled by htons() are all defined in "sr_protocol.h" */
-            arpreq_arp_hdr->ar_hrd = (unsigned short)htons(arp_hrd_ethernet);
-            arpreq_arp_hdr->ar_pro = (unsigned short)htons(ethertype_ip);
-            arpreq_arp_hdr->ar_hln = (unsigned char)ETHER_ADDR_LEN;
-            arpreq_arp_hdr->ar_pln = (unsigned char)sizeof(uint32_t);
-            arpreq_arp_hdr->ar_op = (unsigned short)htons(arp_op_request);
-            /* set sender MAC: outgoing interface's MAC */
-            memcpy(arpreq_arp_hdr->ar_sha, interface->addr, ETHER_ADDR_LEN);
-            /* set sender IP: outgoing interface's IP */
-            arpreq_arp_hdr->ar_sip = interface->ip;
-            /* set target MAC: 00-00-00-00-00-00 */
-            memset(arpreq_arp_hdr->ar_tha, 0x00, ETHER_ADDR_LEN);
-            /* set target IP: request's target IP */
-            arpreq_arp_hdr->ar_tip = request->ip;
-
-            /* 'sr' send 'arpreq' ('len'-byte long) to the interface named 'interface->name' */
-            sr_send_packet(sr, arpreq, len, interface->name);
-            /* free the memory of arpreq after sending */
-            free(arpreq);
+            /* 'sr' send 'arpreq' ('len'-byte long) out of 'interface' */
+            sr_send_packet_if(sr, arpreq, len, interface);
+            sr_ctl_put(&sr->ctl, arpreq);
 
             /* update */
             request->sent = current_time;
             request->times_sent++;
+            sr_timer_add(sr->cache.timers, &request->timer, SR_ARPREQ_INTERVAL_MS);
         }
     }
 }
 
-/* 
-  This function gets called every second. For each request sent out, we keep
-  checking whether we should resend an request or destroy the arp request.
-  See the comments in the header file for an idea of what it should look like.
-*/
-void sr_arpcache_sweepreqs(struct sr_instance *sr) { 
-    /* Fill this in */
+/* Retry timer of a pending request: resend or give up, see handle_arpreq */
+static void sr_arpreq_timeout(struct sr_timer *timer, void *cache_ptr) {
+    struct sr_arpcache *cache = cache_ptr;
+    struct sr_arpreq *request = sr_timer_entry(timer, struct sr_arpreq, timer);
+
+    pthread_mutex_lock(&(cache->lock));
+    handle_arpreq(cache->sr, request);
+    pthread_mutex_unlock(&(cache->lock));
+}
 
-    /* this router -> ARP cache -> list of ARP requests */
-    struct sr_arpreq* request = sr->cache.requests;
+/* Expiry timer of a cache entry */
+static void sr_arpentry_timeout(struct sr_timer *timer, void *cache_ptr) {
+    struct sr_arpcache *cache = cache_ptr;
+    struct sr_arpentry *entry = sr_timer_entry(timer, struct sr_arpentry, timer);
 
-    /* handle ARP requests one by one, default linked list structure of sr_arpreq in "sr_arpcache.h" */
-    struct sr_arpreq* next;
-    while(request) {
-        next = request->next;
-        handle_arpreq(sr, request);
-        request = next;
+    pthread_mutex_lock(&(cache->lock));
+    if(entry->valid) {
+        SR_STATS_GAUGE(sr_gauge_arp_entries, -1);
     }
+    entry->valid = 0;
+    cache->gen++;
+    pthread_mutex_unlock(&(cache->lock));
 }
 
 /* You should not need to touch the rest of this code. */
@@ -142,7 +125,7 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                                        uint32_t ip,
                                        uint8_t *packet,           /* borrowed */
                                        unsigned int packet_len,
-                                       char *iface)
+                                       unsigned int ifindex)
 {
     pthread_mutex_lock(&(cache->lock));
     
@@ -157,21 +140,23 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
     if (!req) {
         req = (struct sr_arpreq *) calloc(1, sizeof(struct sr_arpreq));
         req->ip = ip;
+        sr_timer_init(&(req->timer), sr_arpreq_timeout, cache);
         req->next = cache->requests;
         cache->requests = req;
+        SR_STATS_GAUGE(sr_gauge_arp_requests, 1);
     }
 
     /* Add the packet to the list of packets for this request */
-    if (packet && packet_len && iface) {
+    if (packet && packet_len) {
         struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
         
         new_pkt->buf = (uint8_t *)malloc(packet_len);
         memcpy(new_pkt->buf, packet, packet_len);
         new_pkt->len = packet_len;
-		new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
-        strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
+        new_pkt->ifindex = ifindex;
         new_pkt->next = req->packets;
         req->packets = new_pkt;
+        SR_STATS_GAUGE(sr_gauge_arp_queued, 1);
     }
     
     pthread_mutex_unlock(&(cache->lock));
@@ -200,6 +185,7 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                 next = req->next;
                 cache->requests = next;
             }
+            SR_STATS_GAUGE(sr_gauge_arp_requests, -1);
             
             break;
         }
@@ -215,8 +201,12 @@ struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
     if (i != SR_ARPCACHE_SZ) {
         memcpy(cache->entries[i].mac, mac, 6);
         cache->entries[i].ip = ip;
-        cache->entries[i].added = time(NULL);
+        cache->entries[i].added = sr_clock_now();
         cache->entries[i].valid = 1;
+        SR_STATS_GAUGE(sr_gauge_arp_entries, 1);
+        sr_timer_init(&(cache->entries[i].timer), sr_arpentry_timeout, cache);
+        sr_timer_add(cache->timers, &(cache->entries[i].timer), (unsigned int)(SR_ARPCACHE_TO * 1000));
+        cache->gen++;
     }
     
     pthread_mutex_unlock(&(cache->lock));
@@ -241,21 +231,23 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
                     next = req->next;
                     cache->requests = next;
                 }
+                SR_STATS_GAUGE(sr_gauge_arp_requests, -1);
                 
                 break;
             }
             prev = req;
         }
         
+        sr_timer_cancel(cache->timers, &(entry->timer));
+
         struct sr_packet *pkt, *nxt;
         
         for (pkt = entry->packets; pkt; pkt = nxt) {
             nxt = pkt->next;
             if (pkt->buf)
                 free(pkt->buf);
-            if (pkt->iface)
-                free(pkt->iface);
             free(pkt);
+            SR_STATS_GAUGE(sr_gauge_arp_queued, -1);
         }
         
         free(entry);
@@ -266,14 +258,14 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
 
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache) {
-    fprintf(stderr, "\nMAC            IP         ADDED                      VALID\n");
+    fprintf(stderr, "\nMAC            IP         AGE (ms)                   VALID\n");
     fprintf(stderr, "-----------------------------------------------------------\n");
     
     int i;
     for (i = 0; i < SR_ARPCACHE_SZ; i++) {
         struct sr_arpentry *cur = &(cache->entries[i]);
         unsigned char *mac = cur->mac;
-        fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %.24s   %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), ctime(&(cur->added)), cur->valid);
+        fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %-24llu   %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), (unsigned long long)(sr_clock_now() - cur->added), cur->valid);
     }
     
     fprintf(stderr, "\n");
@@ -287,6 +279,7 @@ int sr_arpcache_init(struct sr_arpcache *cache) {
     /* Invalidate all entries */
     memset(cache->entries, 0, sizeof(cache->entries));
     cache->requests = NULL;
+    cache->gen = 0;
     
     /* Acquire mutex lock */
     pthread_mutexattr_init(&(cache->attr));
@@ -300,32 +293,3 @@ int sr_arpcache_init(struct sr_arpcache *cache) {
 int sr_arpcache_destroy(struct sr_arpcache *cache) {
     return pthread_mutex_destroy(&(cache->lock)) && pthread_mutexattr_destroy(&(cache->attr));
 }
-
-/* Thread which sweeps through the cache and invalidates entries that were added
-   more than SR_ARPCACHE_TO seconds ago. */
-void *sr_arpcache_timeout(void *sr_ptr) {
-    struct sr_instance *sr = sr_ptr;
-    struct sr_arpcache *cache = &(sr->cache);
-    
-    while (1) {
-        sleep(1.0);
-        
-        pthread_mutex_lock(&(cache->lock));
-    
-        time_t curtime = time(NULL);
-        
-        int i;    
-        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-            if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
-                cache->entries[i].valid = 0;
-            }
-        }
-        
-        sr_arpcache_sweepreqs(sr);
-
-        pthread_mutex_unlock(&(cache->lock));
-    }
-    
-    return NULL;
-}
-
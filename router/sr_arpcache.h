@@ -24,15 +24,17 @@
    handle sending ARP requests if necessary:
 
    function handle_arpreq(req):
-       if difftime(now, req->sent) > 1.0
-           if req->times_sent >= 5:
-               send icmp host unreachable to source addr of all pkts waiting
-                 on this request
-               arpreq_destroy(req)
-           else:
-               send arp request
-               req->sent = now
-               req->times_sent++
+       if a retry timer is already pending for req:
+           return
+       if req->times_sent >= 5:
+           send icmp host unreachable to source addr of all pkts waiting
+             on this request
+           arpreq_destroy(req)
+       else:
+           send arp request
+           req->sent = now
+           req->times_sent++
+           arm req->timer to call handle_arpreq(req) in SR_ARPREQ_INTERVAL_MS
 
    --
 
@@ -50,17 +52,11 @@
 
    To meet the guidelines in the assignment (ARP requests are sent every second
    until we send 5 ARP requests, then we send ICMP host unreachable back to
-   all packets waiting on this ARP request), you must fill out the following
-   function that is called every second and is defined in sr_arpcache.c:
-
-   void sr_arpcache_sweepreqs(struct sr_instance *sr) {
-       for each request on sr->cache.requests:
-           handle_arpreq(request)
-   }
-
-   Since handle_arpreq as defined in the comments above could destroy your
-   current request, make sure to save the next pointer before calling
-   handle_arpreq when traversing through the ARP requests linked list.
+   all packets waiting on this ARP request), every request carries its own
+   timer on the router's timing wheel (sr_timer.h).  Cache entries likewise
+   carry a timer that invalidates them SR_ARPCACHE_TO seconds after they were
+   added, so nothing has to sweep the cache periodically.  Destroying a
+   request cancels its timer.
  */
 
 #ifndef SR_ARPCACHE_H
@@ -70,38 +66,49 @@
 #include <time.h>
 #include <pthread.h>
 #include "sr_if.h"
+#include "sr_timer.h"
+#include "sr_clock.h"
 
 #define SR_ARPCACHE_SZ    100  
 #define SR_ARPCACHE_TO    15.0
+#define SR_ARPREQ_INTERVAL_MS  1000  /* gap between ARP request retries */
+
+struct sr_instance;
 
 struct sr_packet {
     uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
     unsigned int len;           /* Length of raw Ethernet frame */
-    char *iface;                /* The outgoing interface */
+    unsigned int ifindex;       /* The outgoing interface, see sr_if_at() */
     struct sr_packet *next;
 };
 
 struct sr_arpentry {
     unsigned char mac[6]; 
     uint32_t ip;                /* IP addr in network byte order */
-    time_t added;         
+    sr_msec_t added;            /* monotonic ms, see sr_clock.h */
     int valid;
+    struct sr_timer timer;      /* invalidates the entry after SR_ARPCACHE_TO */
 };
 
 struct sr_arpreq {
     uint32_t ip;
-    time_t sent;                /* Last time this ARP request was sent. You 
-                                   should update this. If the ARP request was 
+    sr_msec_t sent;             /* Last time this ARP request was sent, in
+                                   monotonic milliseconds (sr_clock_now). You
+                                   should update this. If the ARP request was
                                    never sent, will be 0. */
     uint32_t times_sent;        /* Number of times this request was sent. You 
                                    should update this. */
     struct sr_packet *packets;  /* List of pkts waiting on this req to finish */
+    struct sr_timer timer;      /* Pending retry, armed by handle_arpreq */
     struct sr_arpreq *next;
 };
 
 struct sr_arpcache {
     struct sr_arpentry entries[SR_ARPCACHE_SZ];
     struct sr_arpreq *requests;
+    struct sr_timer_wheel *timers;  /* the router's wheel, set by sr_init */
+    struct sr_instance *sr;         /* owner, passed to handle_arpreq */
+    uint32_t gen;                   /* bumped on insert and expiry */
     pthread_mutex_t lock;
     pthread_mutexattr_t attr;
 };
@@ -121,7 +128,7 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                          uint32_t ip,
                          uint8_t *packet,               /* borrowed */
                          unsigned int packet_len,
-                         char *iface);
+                         unsigned int ifindex);
 
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
@@ -140,12 +147,10 @@ void sr_arpcache_dump(struct sr_arpcache *cache);
 
 /* You shouldn't have to call these methods--they're already called in the
    starter code for you. The init call is a constructor, the destroy call is
-   a destructor, and a cleanup thread times out cache entries every 15
-   seconds. */
+   a destructor. */
 
 int   sr_arpcache_init(struct sr_arpcache *cache);
 int   sr_arpcache_destroy(struct sr_arpcache *cache);
-void *sr_arpcache_timeout(void *cache_ptr);
 
 /* Custom method */
 void handle_arpreq(struct sr_instance*, struct sr_arpreq*);
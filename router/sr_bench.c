@@ -0,0 +1,612 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_bench.c
+ *
+ * Description:
+ *
+ * In-process throughput benchmark ("make bench").  Builds an sr_instance
+ * with synthetic interfaces, routes and ARP entries, stubs out
+ * sr_send_packet, and drives generated traffic through sr_handlepacket:
+ *
+ *   forward      ICMP echo from eth1 routed out eth2
+ *   echo         ICMP echo to the router's own eth1 address
+ *   nat-tcp-out  established TCP from the NAT inside, over a fixed flow set
+ *   nat-tcp-in   replies to those flows arriving on the NAT outside
+ *   nat-icmp     ICMP echo through the NAT
+ *   arp-miss     forwarding to next hops that never answer ARP
+ *   ecmp         TCP flows to a prefix with a path out of each interface
+ *   nat-churn    a new TCP flow on every packet
+ *   nat-close    whole TCP connections, opened and closed from both sides
+ *   nat-synflood unsolicited SYNs from many sources to unmapped ports
+ *   ttl-storm    packets expiring at the router, against the ICMP error limits
+ *
+ * Frames are generated before the clock starts.  For each workload it
+ * reports Mpps, mean ns/packet and p50/p99 per-packet latency, and how
+ * transmitted packets split over the interfaces when more than one sent.  NAT
+ * workloads also report the mappings left once the transitory timeout has
+ * passed after the run.  The router's own printf output is sent to /dev/null
+ * while it runs.  With -X (and a PROFILE=-DSR_PROFILE build) the per-stage
+ * latency histograms are printed after the runs.
+ *
+ * usage: sr_bench [-w workload] [-n packets] [-f flows] [-X]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_utils.h"
+#include "sr_protocol.h"
+#include "sr_prof.h"
+
+#define BENCH_DEFAULT_PACKETS 200000
+#define BENCH_DEFAULT_FLOWS   1024
+#define BENCH_MAX_CHURN       30000  /* NAT ports are allocated upward from 1024 */
+#define BENCH_FRAME_SIZE      128
+#define BENCH_ARP_GATEWAYS    64
+#define BENCH_BATCH           64     /* packets per simulated epoll batch */
+
+#define BENCH_INT_IP    "10.0.1.1"
+#define BENCH_EXT_IP    "172.64.3.1"
+#define BENCH_CLIENT_IP "10.0.1.100"
+#define BENCH_SERVER_IP "172.64.3.21"
+#define BENCH_ECMP_IP   "198.51.100.7"
+
+static const unsigned char bench_mac_int[6]    = {2, 0, 0, 0, 0, 0x01};
+static const unsigned char bench_mac_ext[6]    = {2, 0, 0, 0, 0, 0x02};
+static const unsigned char bench_mac_client[6] = {2, 0, 0, 0, 0, 0x64};
+static const unsigned char bench_mac_server[6] = {2, 0, 0, 0, 0, 0x15};
+
+/* -- sr_send_packet stub: the bench links without sr_vns_comm.o -- */
+
+static unsigned long bench_tx_packets;
+static unsigned long bench_tx_bytes;
+static unsigned long bench_tx_if[SR_IF_MAX];
+
+int sr_send_packet(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                   const char* iface)
+{
+    bench_tx_packets++;
+    bench_tx_bytes += len;
+    return 0;
+}
+
+int sr_send_packet_if(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                      struct sr_if* iface)
+{
+    bench_tx_packets++;
+    bench_tx_bytes += len;
+    if(iface && iface->index < SR_IF_MAX)
+    { bench_tx_if[iface->index]++; }
+    return 0;
+}
+
+/*---------------------------------------------------------------------------
+ * frame generation
+ *---------------------------------------------------------------------------*/
+
+struct bench_frame
+{
+    unsigned int len;
+    const char* iface;
+    uint8_t buf[BENCH_FRAME_SIZE];
+};
+
+static uint32_t bench_ip(const char* s)
+{
+    struct in_addr in;
+    inet_aton(s, &in);
+    return in.s_addr;
+}
+
+/* Ethernet + IPv4 header; returns a pointer to the L4 header */
+static uint8_t* bench_ip_frame(struct bench_frame* f, const char* iface,
+                               const unsigned char* src_mac,
+                               const unsigned char* dst_mac,
+                               uint32_t src, uint32_t dst, uint8_t proto,
+                               unsigned int l4_len)
+{
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)f->buf;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(f->buf + sizeof(sr_ethernet_hdr_t));
+
+    memset(f->buf, 0, sizeof(f->buf));
+    f->iface = iface;
+    f->len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + l4_len;
+    assert(f->len <= BENCH_FRAME_SIZE);
+
+    memcpy(eth->ether_dhost, dst_mac, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, src_mac, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(sizeof(sr_ip_hdr_t) + l4_len);
+    ip->ip_id = htons(1);
+    ip->ip_ttl = 64;
+    ip->ip_p = proto;
+    ip->ip_src = src;
+    ip->ip_dst = dst;
+    ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+
+    return (uint8_t*)(ip + 1);
+}
+
+static void bench_icmp_echo(struct bench_frame* f, const char* iface,
+                            const unsigned char* src_mac,
+                            const unsigned char* dst_mac,
+                            uint32_t src, uint32_t dst,
+                            uint8_t type, uint16_t id, uint16_t seq)
+{
+    unsigned int l4_len = sizeof(sr_icmp_hdr_t) + 32;
+    sr_icmp_hdr_t* icmp = (sr_icmp_hdr_t*)bench_ip_frame(f, iface, src_mac,
+                                dst_mac, src, dst, ip_protocol_icmp, l4_len);
+
+    icmp->icmp_type = type;
+    icmp->icmp_code = 0;
+    icmp->icmp_id = id;
+    icmp->icmp_seq = htons(seq);
+    memset(icmp + 1, 'x', 32);
+    icmp->icmp_sum = 0;
+    icmp->icmp_sum = cksum(icmp, l4_len);
+}
+
+#define BENCH_SYN 1
+#define BENCH_ACK 2
+#define BENCH_FIN 4
+
+static void bench_tcp(struct bench_frame* f, const char* iface,
+                      const unsigned char* src_mac,
+                      const unsigned char* dst_mac,
+                      uint32_t src, uint16_t sport, uint32_t dst, uint16_t dport,
+                      uint32_t seq, uint32_t ackno, int flags)
+{
+    unsigned int l4_len = sizeof(sr_tcp_hdr_t) + 16;
+    sr_tcp_hdr_t* tcp = (sr_tcp_hdr_t*)bench_ip_frame(f, iface, src_mac,
+                                dst_mac, src, dst, ip_protocol_tcp, l4_len);
+
+    tcp->src_port = htons(sport);
+    tcp->dst_port = htons(dport);
+    tcp->seq = htonl(seq);
+    tcp->acknowledgment = htonl(ackno);
+    tcp->offset = 5 << 4;
+    tcp->syn = (flags & BENCH_SYN) != 0;
+    tcp->ack = (flags & BENCH_ACK) != 0;
+    tcp->fin = (flags & BENCH_FIN) != 0;
+    tcp->window_size = htons(65535);
+    memset(tcp + 1, 'y', 16);
+    tcp->checksum = 0;
+    tcp->checksum = tcp_hdr_cksum(f->buf, f->len);
+}
+
+/*---------------------------------------------------------------------------
+ * workloads
+ *---------------------------------------------------------------------------*/
+
+struct bench_workload
+{
+    const char* name;
+    int nat;
+    /* untimed setup run after the router is up, e.g. opening NAT flows */
+    void (*warmup)(struct sr_instance* sr, unsigned int flows);
+    void (*gen)(struct bench_frame* f, unsigned long i, unsigned int flows);
+};
+
+static void gen_forward(struct bench_frame* f, unsigned long i, unsigned int flows)
+{
+    bench_icmp_echo(f, "eth1", bench_mac_client, bench_mac_int,
+                    bench_ip(BENCH_CLIENT_IP), bench_ip(BENCH_SERVER_IP),
+                    icmp_type_echo_request, htons(i % flows), i);
+}
+
+static void gen_echo(struct bench_frame* f, unsigned long i, unsigned int flows)
+{
+    bench_icmp_echo(f, "eth1", bench_mac_client, bench_mac_int,
+                    bench_ip(BENCH_CLIENT_IP), bench_ip(BENCH_INT_IP),
+                    icmp_type_echo_request, htons(i % flows), i);
+}
+
+static void gen_nat_tcp_out(struct bench_frame* f, unsigned long i, unsigned int flows)
+{
+    bench_tcp(f, "eth1", bench_mac_client, bench_mac_int,
+              bench_ip(BENCH_CLIENT_IP), 20000 + i % flows,
+              bench_ip(BENCH_SERVER_IP), 80, 1000, 2000, BENCH_ACK);
+}
+
+static void gen_nat_tcp_in(struct bench_frame* f, unsigned long i, unsigned int flows)
+{
+    /* external ports are handed out from MIN_NAT_PORT in flow order */
+    bench_tcp(f, "eth2", bench_mac_server, bench_mac_ext,
+              bench_ip(BENCH_SERVER_IP), 80,
+              bench_ip(BENCH_EXT_IP), MIN_NAT_PORT + i % flows, 2000, 1000, BENCH_ACK);
+}
+
+static void gen_nat_icmp(struct bench_frame* f, unsigned long i, unsigned int flows)
+{
+    bench_icmp_echo(f, "eth1", bench_mac_client, bench_mac_int,
+                    bench_ip(BENCH_CLIENT_IP), bench_ip(BENCH_SERVER_IP),
+                    icmp_type_echo_request, htons(i % flows), i);
+}
+
+static void gen_arp_miss(struct bench_frame* f, unsigned long i, unsigned int flows)
+{
+    char dst[32];
+    snprintf(dst, sizeof(dst), "100.64.%lu.%lu",
+             i % BENCH_ARP_GATEWAYS, 1 + (i / BENCH_ARP_GATEWAYS) % 250);
+    bench_icmp_echo(f, "eth1", bench_mac_client, bench_mac_int,
+                    bench_ip(BENCH_CLIENT_IP), bench_ip(dst),
+                    icmp_type_echo_request, htons(1), i);
+}
+
+static void gen_ecmp(struct bench_frame* f, unsigned long i, unsigned int flows)
+{
+    bench_tcp(f, "eth1", bench_mac_client, bench_mac_int,
+              bench_ip(BENCH_CLIENT_IP), 20000 + i % flows,
+              bench_ip(BENCH_ECMP_IP), 80, 1000, 2000, BENCH_ACK);
+}
+
+static void gen_nat_churn(struct bench_frame* f, unsigned long i, unsigned int flows)
+{
+    char src[32];
+    snprintf(src, sizeof(src), "10.0.%lu.%lu", 1 + i / 250 % 250, 1 + i % 250);
+    bench_tcp(f, "eth1", bench_mac_client, bench_mac_int,
+              bench_ip(src), 20000 + i % 40000,
+              bench_ip(BENCH_SERVER_IP), 80, 999, 0, BENCH_SYN);
+}
+
+static void gen_nat_synflood(struct bench_frame* f, unsigned long i, unsigned int flows)
+{
+    char src[32];
+    snprintf(src, sizeof(src), "203.0.%lu.%lu", i / 250 % 256, 1 + i % 250);
+    bench_tcp(f, "eth2", bench_mac_server, bench_mac_ext,
+              bench_ip(src), 40000 + i % 20000,
+              bench_ip(BENCH_EXT_IP), 30000 + i % 30000, 999, 0, BENCH_SYN);
+}
+
+/* Echo requests that expire at the router, from 'flows' sources on the
+   inside: each asks for a time exceeded */
+static void gen_ttl_storm(struct bench_frame* f, unsigned long i, unsigned int flows)
+{
+    char src[32];
+    sr_ip_hdr_t* ip;
+
+    snprintf(src, sizeof(src), "10.0.%lu.%lu", 1 + i % flows / 250, 1 + i % flows % 250);
+    bench_icmp_echo(f, "eth1", bench_mac_client, bench_mac_int,
+                    bench_ip(src), bench_ip(BENCH_SERVER_IP),
+                    icmp_type_echo_request, htons(1), i);
+    ip = (sr_ip_hdr_t*)(f->buf + sizeof(sr_ethernet_hdr_t));
+    ip->ip_ttl = 1;
+    ip->ip_sum = 0;
+    ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+}
+
+/* Whole connections, one after another: handshake, a FIN from each side
+   and the ACKs, seven segments in all.  The 16 bytes of data every
+   segment carries move the FINs' sequence numbers. */
+#define BENCH_CLOSE_SEGS 7
+
+static void gen_nat_close(struct bench_frame* f, unsigned long i, unsigned int flows)
+{
+    static const struct { int out; uint32_t seq, ack; int flags; } seg[BENCH_CLOSE_SEGS] = {
+        { 1,  999,    0, BENCH_SYN },
+        { 0, 1999, 1000, BENCH_SYN | BENCH_ACK },
+        { 1, 1000, 2000, BENCH_ACK },
+        { 1, 1000, 2000, BENCH_FIN | BENCH_ACK },
+        { 0, 2000, 1017, BENCH_ACK },
+        { 0, 2000, 1017, BENCH_FIN | BENCH_ACK },
+        { 1, 1017, 2017, BENCH_ACK }
+    };
+    unsigned long conn = i / BENCH_CLOSE_SEGS;
+    unsigned int k = i % BENCH_CLOSE_SEGS;
+
+    if(seg[k].out)
+    {
+        bench_tcp(f, "eth1", bench_mac_client, bench_mac_int,
+                  bench_ip(BENCH_CLIENT_IP), 20000 + conn,
+                  bench_ip(BENCH_SERVER_IP), 80, seg[k].seq, seg[k].ack, seg[k].flags);
+    }
+    else
+    {
+        bench_tcp(f, "eth2", bench_mac_server, bench_mac_ext,
+                  bench_ip(BENCH_SERVER_IP), 80,
+                  bench_ip(BENCH_EXT_IP), MIN_NAT_PORT + conn, seg[k].seq, seg[k].ack, seg[k].flags);
+    }
+}
+
+/* Open every flow with a three-way handshake through the NAT, so the
+   timed packets belong to established connections */
+static void warm_nat_tcp(struct sr_instance* sr, unsigned int flows)
+{
+    struct bench_frame f;
+    unsigned long i;
+
+    for(i = 0; i < flows; i++)
+    {
+        bench_tcp(&f, "eth1", bench_mac_client, bench_mac_int,
+                  bench_ip(BENCH_CLIENT_IP), 20000 + i,
+                  bench_ip(BENCH_SERVER_IP), 80, 999, 0, BENCH_SYN);
+        sr_handlepacket(sr, f.buf, f.len, (char*)f.iface);
+        bench_tcp(&f, "eth2", bench_mac_server, bench_mac_ext,
+                  bench_ip(BENCH_SERVER_IP), 80,
+                  bench_ip(BENCH_EXT_IP), MIN_NAT_PORT + i, 1999, 1000, BENCH_SYN | BENCH_ACK);
+        sr_handlepacket(sr, f.buf, f.len, (char*)f.iface);
+        bench_tcp(&f, "eth1", bench_mac_client, bench_mac_int,
+                  bench_ip(BENCH_CLIENT_IP), 20000 + i,
+                  bench_ip(BENCH_SERVER_IP), 80, 1000, 2000, BENCH_ACK);
+        sr_handlepacket(sr, f.buf, f.len, (char*)f.iface);
+    }
+}
+
+static struct bench_workload bench_workloads[] = {
+    { "forward",     0, 0,            gen_forward },
+    { "echo",        0, 0,            gen_echo },
+    { "nat-tcp-out", 1, warm_nat_tcp, gen_nat_tcp_out },
+    { "nat-tcp-in",  1, warm_nat_tcp, gen_nat_tcp_in },
+    { "nat-icmp",    1, 0,            gen_nat_icmp },
+    { "arp-miss",    0, 0,            gen_arp_miss },
+    { "ecmp",        0, 0,            gen_ecmp },
+    { "nat-churn",   1, 0,            gen_nat_churn },
+    { "nat-close",   1, 0,            gen_nat_close },
+    { "nat-synflood", 1, 0,           gen_nat_synflood },
+    { "ttl-storm",   0, 0,            gen_ttl_storm },
+    { 0, 0, 0, 0 }
+};
+
+/*---------------------------------------------------------------------------
+ * router setup
+ *---------------------------------------------------------------------------*/
+
+static void bench_route(struct sr_instance* sr, const char* dest,
+                        const char* gw, const char* mask, const char* iface)
+{
+    struct in_addr d, g, m;
+    char name[sr_IFACE_NAMELEN];
+
+    inet_aton(dest, &d);
+    inet_aton(gw, &g);
+    inet_aton(mask, &m);
+    strncpy(name, iface, sr_IFACE_NAMELEN);
+    sr_add_rt_entry(sr, d, g, m, name);
+}
+
+static void bench_setup(struct sr_instance* sr, int nat)
+{
+    char dest[32], gw[32];
+    int k;
+
+    memset(sr, 0, sizeof(*sr));
+    sr->sockfd = -1;
+    if(sr_ev_init(&(sr->evloop)) != 0)
+    { exit(1); }
+    sr_flight_init(&(sr->flight), SR_FLIGHT_DEFAULT_FRAMES);
+
+    sr_add_interface(sr, "eth1");
+    sr_set_ether_ip(sr, bench_ip(BENCH_INT_IP));
+    sr_set_ether_addr(sr, bench_mac_int);
+    sr_add_interface(sr, "eth2");
+    sr_set_ether_ip(sr, bench_ip(BENCH_EXT_IP));
+    sr_set_ether_addr(sr, bench_mac_ext);
+
+    bench_route(sr, BENCH_CLIENT_IP, BENCH_CLIENT_IP, "255.255.255.255", "eth1");
+    bench_route(sr, BENCH_SERVER_IP, BENCH_SERVER_IP, "255.255.255.255", "eth2");
+    /* next hops that never resolve, for arp-miss */
+    for(k = 0; k < BENCH_ARP_GATEWAYS; k++)
+    {
+        snprintf(dest, sizeof(dest), "100.64.%d.0", k);
+        snprintf(gw, sizeof(gw), "172.64.3.%d", 100 + k);
+        bench_route(sr, dest, gw, "255.255.255.0", "eth2");
+    }
+    bench_route(sr, "10.0.0.0", BENCH_CLIENT_IP, "255.255.0.0", "eth1");
+    /* two equal-cost paths, for ecmp */
+    bench_route(sr, "198.51.100.0", BENCH_SERVER_IP, "255.255.255.0", "eth2");
+    bench_route(sr, "198.51.100.0", BENCH_CLIENT_IP, "255.255.255.0", "eth1");
+    bench_route(sr, "0.0.0.0", BENCH_SERVER_IP, "0.0.0.0", "eth2");
+
+    sr->nat_enabled = nat;
+    sr->nat.icmp_query_timeout = 60;
+    sr->nat.tcp_established_idle_timeout = 7440;
+    sr->nat.tcp_transitory_idle_timeout = 300;
+    sr->nat.sr = sr;
+    sr->icmp_limit.type_rate = SR_ICMP_LIMIT_TYPE_RATE;
+    sr->icmp_limit.type_burst = SR_ICMP_LIMIT_TYPE_BURST;
+    sr->icmp_limit.dest_rate = SR_ICMP_LIMIT_DEST_RATE;
+    sr->icmp_limit.dest_burst = SR_ICMP_LIMIT_DEST_BURST;
+    sr_init(sr);
+
+    sr_arpcache_insert(&(sr->cache), (unsigned char*)bench_mac_client,
+                       bench_ip(BENCH_CLIENT_IP));
+    sr_arpcache_insert(&(sr->cache), (unsigned char*)bench_mac_server,
+                       bench_ip(BENCH_SERVER_IP));
+}
+
+/*---------------------------------------------------------------------------
+ * measurement
+ *---------------------------------------------------------------------------*/
+
+static uint64_t bench_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench_cmp(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static unsigned int bench_nat_mappings(struct sr_nat* nat)
+{
+    struct sr_nat_mapping* m;
+    unsigned int n = 0;
+
+    for(m = nat->mappings; m; m = m->next)
+    { n++; }
+    return n;
+}
+
+static void bench_run(FILE* out, struct bench_workload* w,
+                      unsigned long packets, unsigned int flows)
+{
+    struct sr_instance sr;
+    struct bench_frame* frames;
+    uint32_t* lat;
+    uint64_t start, t0, t1, total;
+    unsigned long i;
+
+    if(strcmp(w->name, "nat-churn") == 0 && packets > BENCH_MAX_CHURN)
+    { packets = BENCH_MAX_CHURN; }
+    if(strcmp(w->name, "nat-close") == 0)
+    {
+        /* whole connections only */
+        if(packets > BENCH_MAX_CHURN * BENCH_CLOSE_SEGS)
+        { packets = BENCH_MAX_CHURN * BENCH_CLOSE_SEGS; }
+        if(packets >= BENCH_CLOSE_SEGS)
+        { packets -= packets % BENCH_CLOSE_SEGS; }
+    }
+
+    frames = (struct bench_frame*)malloc(packets * sizeof(struct bench_frame));
+    lat = (uint32_t*)malloc(packets * sizeof(uint32_t));
+    assert(frames && lat);
+    for(i = 0; i < packets; i++)
+    { w->gen(&frames[i], i, flows); }
+
+    bench_setup(&sr, w->nat);
+    if(w->warmup)
+    { w->warmup(&sr, flows); }
+    bench_tx_packets = 0;
+    bench_tx_bytes = 0;
+    memset(bench_tx_if, 0, sizeof(bench_tx_if));
+
+    start = bench_ns();
+    for(i = 0; i < packets; i++)
+    {
+        /* what the event loop does once per epoll batch */
+        if(i % BENCH_BATCH == 0)
+        {
+            sr_clock_refresh();
+            sr_timer_wheel_advance(&(sr.evloop.timers), sr_clock_now());
+        }
+        t0 = bench_ns();
+        sr_handlepacket(&sr, frames[i].buf, frames[i].len, (char*)frames[i].iface);
+        t1 = bench_ns();
+        lat[i] = (uint32_t)(t1 - t0);
+    }
+    total = bench_ns() - start;
+
+    qsort(lat, packets, sizeof(uint32_t), bench_cmp);
+    fprintf(out, "%-12s %9lu pkts %8.3f Mpps %9.1f ns/pkt  p50 %7u ns  p99 %7u ns  tx %lu",
+            w->name, packets, packets / (total / 1e3),
+            (double)total / packets, lat[packets / 2], lat[packets * 99 / 100],
+            bench_tx_packets);
+    for(i = 0; i < SR_IF_MAX && bench_tx_if[i] < bench_tx_packets; i++)
+    {
+        if(bench_tx_if[i])
+        { fprintf(out, " %s %lu", sr_if_at(&sr, i)->name, bench_tx_if[i]); }
+    }
+    if(sr.nat_enabled)
+    {
+        /* what is left of the NAT table once closed connections have sat
+           out the transitory timeout */
+        sr_clock_set(sr_clock_now() + (sr.nat.tcp_transitory_idle_timeout + 1) * 1000);
+        sr_timer_wheel_advance(&(sr.evloop.timers), sr_clock_now());
+        fprintf(out, " mappings %u", bench_nat_mappings(&(sr.nat)));
+    }
+    fprintf(out, "\n");
+    fflush(out);
+
+    if(sr.nat_enabled)
+    { sr_nat_destroy(&(sr.nat)); }
+    free(frames);
+    free(lat);
+}
+
+static void bench_usage(const char* argv0)
+{
+    struct bench_workload* w;
+
+    fprintf(stderr, "usage: %s [-w workload] [-n packets] [-f flows] [-X]\n", argv0);
+    fprintf(stderr, "workloads:");
+    for(w = bench_workloads; w->name; w++)
+    { fprintf(stderr, " %s", w->name); }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv)
+{
+    const char* only = 0;
+    unsigned long packets = BENCH_DEFAULT_PACKETS;
+    unsigned int flows = BENCH_DEFAULT_FLOWS;
+    struct bench_workload* w;
+    FILE* out;
+    int c, devnull, ran = 0, profile = 0;
+
+    while((c = getopt(argc, argv, "hw:n:f:X")) != EOF)
+    {
+        switch(c)
+        {
+            case 'w':
+                only = optarg;
+                break;
+            case 'n':
+                packets = strtoul(optarg, 0, 10);
+                break;
+            case 'f':
+                flows = atoi(optarg);
+                break;
+            case 'X':
+                profile = 1;
+                break;
+            default:
+                bench_usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if(packets == 0 || flows == 0 || flows > BENCH_MAX_CHURN)
+    {
+        bench_usage(argv[0]);
+        return 1;
+    }
+
+    if(profile)
+    { sr_prof_enable(); }
+
+    /* results go to the real stdout; the router's chatter does not */
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    devnull = open("/dev/null", O_WRONLY);
+    if(!out || devnull < 0)
+    {
+        perror("sr_bench");
+        return 1;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    dup2(devnull, STDOUT_FILENO);
+    dup2(devnull, STDERR_FILENO);
+
+    for(w = bench_workloads; w->name; w++)
+    {
+        if(only && strcmp(only, w->name) != 0)
+        { continue; }
+        bench_run(out, w, packets, flows);
+        ran++;
+    }
+
+    if(!ran)
+    {
+        fprintf(out, "unknown workload '%s'\n", only);
+        return 1;
+    }
+    if(profile)
+    { sr_prof_dump(out); }
+    return 0;
+}
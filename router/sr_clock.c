@@ -0,0 +1,29 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_clock.c
+ *
+ * Description:
+ *
+ * Cached monotonic clock.  See sr_clock.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <time.h>
+
+#include "sr_clock.h"
+
+__thread sr_msec_t sr_clock_cached = 0;
+
+sr_msec_t sr_clock_refresh(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    sr_clock_cached = (sr_msec_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    return sr_clock_cached;
+} /* -- sr_clock_refresh -- */
+
+void sr_clock_set(sr_msec_t now)
+{
+    /* 0 means "not read yet" to sr_clock_now() */
+    sr_clock_cached = now ? now : 1;
+} /* -- sr_clock_set -- */
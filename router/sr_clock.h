@@ -0,0 +1,36 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_clock.h
+ *
+ * Description:
+ *
+ * Cached monotonic clock for timestamps on the packet path.
+ *
+ * Each thread keeps its own copy of "now" in milliseconds on the monotonic
+ * clock, so timeouts are immune to wall-clock steps (NTP, settimeofday).
+ * The event loop refreshes it once per batch of events; everything handled
+ * in that batch reads the cached value with sr_clock_now(), which costs a
+ * thread-local load instead of a system call.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CLOCK_H
+#define SR_CLOCK_H
+
+#include <stdint.h>
+
+typedef uint64_t sr_msec_t;
+
+extern __thread sr_msec_t sr_clock_cached;
+
+/* Re-read the monotonic clock into this thread's cache and return it. */
+sr_msec_t sr_clock_refresh(void);
+
+/* Pin this thread's clock to 'now' (offline replay drives time from the
+   capture); it stays there until the next refresh or set. */
+void sr_clock_set(sr_msec_t now);
+
+/* Cached time of this thread, refreshed on first use. */
+#define sr_clock_now() \
+    (sr_clock_cached ? sr_clock_cached : sr_clock_refresh())
+
+#endif /* -- SR_CLOCK_H -- */
@@ -0,0 +1,224 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ctlpkt.c
+ *
+ * Description:
+ *
+ * Per-interface templates and buffers for router-originated packets.  See
+ * sr_ctlpkt.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <arpa/inet.h>
+
+#include "sr_ctlpkt.h"
+#include "sr_router.h"
+
+#define SR_CTL_POOL_ALL ((1U << SR_CTL_POOL_SZ) - 1)
+
+#define sr_ctl_ip(buf)  ((sr_ip_hdr_t*)((buf) + sizeof(sr_ethernet_hdr_t)))
+#define sr_ctl_arp(buf) ((sr_arp_hdr_t*)((buf) + sizeof(sr_ethernet_hdr_t)))
+
+/* one's complement sum as cksum() takes it, not yet folded; 'len' is even */
+static uint32_t sr_ctl_sum(const void* data, unsigned int len)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    uint32_t sum = 0;
+
+    for(; len >= 2; p += 2, len -= 2)
+    { sum += p[0] << 8 | p[1]; }
+    return sum;
+}
+
+static uint32_t sr_ctl_sum_addr(uint32_t addr_nbo)
+{
+    uint32_t a = ntohl(addr_nbo);
+    return (a >> 16) + (a & 0xffff);
+}
+
+/* fold and complement, with cksum()'s 0xffff for 0 */
+static uint16_t sr_ctl_finish(uint32_t sum)
+{
+    while(sum > 0xffff)
+    { sum = (sum >> 16) + (sum & 0xffff); }
+    sum = htons((uint16_t)~sum);
+    return sum ? sum : 0xffff;
+}
+
+/* a 16-bit word as it lies in the packet */
+static uint16_t sr_ctl_word(const void* p)
+{
+    uint16_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+/* checksum 'sum' after a word of what it covers went from 'from' to 'to',
+   all as they lie in the packet (RFC 1624, eqn. 3) */
+static uint16_t sr_ctl_adjust(uint16_t sum, uint16_t from, uint16_t to)
+{
+    uint32_t s = (uint16_t)~sum + (uint32_t)(uint16_t)~from + to;
+    s = (s & 0xffff) + (s >> 16);
+    s = (s & 0xffff) + (s >> 16);
+    sum = (uint16_t)~s;
+    return sum ? sum : 0xffff; /* as cksum() writes it */
+}
+
+void sr_ctl_init(struct sr_ctl* ctl)
+{
+    /* -- REQUIRES -- */
+    assert(ctl);
+
+    memset(ctl->tmpl, 0, sizeof(ctl->tmpl));
+    ctl->busy = 0;
+} /* -- sr_ctl_init -- */
+
+static void sr_ctl_build_arp(uint8_t* buf, struct sr_if* iface, uint16_t op)
+{
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)buf;
+    sr_arp_hdr_t* arp = sr_ctl_arp(buf);
+
+    memcpy(eth->ether_shost, iface->addr, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_arp);
+    arp->ar_hrd = htons(arp_hrd_ethernet);
+    arp->ar_pro = htons(ethertype_ip);
+    arp->ar_hln = ETHER_ADDR_LEN;
+    arp->ar_pln = sizeof(uint32_t);
+    arp->ar_op = htons(op);
+    memcpy(arp->ar_sha, iface->addr, ETHER_ADDR_LEN);
+    arp->ar_sip = iface->ip;
+}
+
+void sr_ctl_build(struct sr_instance* sr, struct sr_if* iface)
+{
+    struct sr_ctl_tmpl* t;
+    sr_ethernet_hdr_t* eth;
+    sr_ip_hdr_t* ip;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(iface);
+    assert(iface->index < SR_IF_MAX);
+
+    t = &sr->ctl.tmpl[iface->index];
+    memset(t, 0, sizeof(*t));
+
+    /* ICMP error: everything but the addresses, type, code and quote */
+    eth = (sr_ethernet_hdr_t*)t->icmp_err;
+    memcpy(eth->ether_shost, iface->addr, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_ip);
+    ip = sr_ctl_ip(t->icmp_err);
+    ip->ip_v = 4;
+    ip->ip_hl = sizeof(sr_ip_hdr_t) / 4;
+    ip->ip_len = htons(sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
+    ip->ip_off = htons(IP_DF);
+    ip->ip_ttl = 255;
+    ip->ip_p = ip_protocol_icmp;
+    t->icmp_err_sum = sr_ctl_sum(ip, sizeof(sr_ip_hdr_t));
+
+    sr_ctl_build_arp(t->arp_req, iface, arp_op_request);
+    memset(((sr_ethernet_hdr_t*)t->arp_req)->ether_dhost, 0xff, ETHER_ADDR_LEN);
+    sr_ctl_build_arp(t->arp_rep, iface, arp_op_reply);
+} /* -- sr_ctl_build -- */
+
+uint8_t* sr_ctl_get(struct sr_ctl* ctl)
+{
+    uint8_t* buf;
+    unsigned int i;
+
+    if(ctl->busy != SR_CTL_POOL_ALL)
+    {
+        i = __builtin_ctz(~ctl->busy);
+        ctl->busy |= 1U << i;
+        return ctl->pool[i];
+    }
+    buf = (uint8_t*)malloc(SR_CTL_BUF_LEN);
+    assert(buf);
+    return buf;
+} /* -- sr_ctl_get -- */
+
+void sr_ctl_put(struct sr_ctl* ctl, uint8_t* buf)
+{
+    if(buf >= ctl->pool[0] && buf < ctl->pool[SR_CTL_POOL_SZ])
+    { ctl->busy &= ~(1U << (unsigned int)((buf - ctl->pool[0]) / SR_CTL_BUF_LEN)); }
+    else
+    { free(buf); }
+} /* -- sr_ctl_put -- */
+
+unsigned int sr_ctl_icmp_error(struct sr_instance* sr, struct sr_if* iface,
+                               uint8_t* buf, const sr_ip_hdr_t* orig,
+                               unsigned int quote, uint32_t src,
+                               uint8_t type, uint8_t code)
+{
+    const struct sr_ctl_tmpl* t = &sr->ctl.tmpl[iface->index];
+    sr_ip_hdr_t* ip = sr_ctl_ip(buf);
+    sr_icmp_t3_hdr_t* icmp = (sr_icmp_t3_hdr_t*)(ip + 1);
+    unsigned int extra;
+
+    assert(quote >= ICMP_DATA_SIZE && quote <= ICMP_QUOTE_MAX && !(quote & 1));
+    extra = quote - ICMP_DATA_SIZE;
+
+    memcpy(buf, t->icmp_err, SR_CTL_ICMP_ERR_LEN);
+    /* the template's length is for the shortest quote; its word in the
+       partial sum grows by as much, without carrying */
+    ip->ip_len = htons(ntohs(ip->ip_len) + extra);
+    ip->ip_src = src;
+    ip->ip_dst = orig->ip_src;
+    ip->ip_sum = sr_ctl_finish(t->icmp_err_sum + extra + sr_ctl_sum_addr(src) +
+                               sr_ctl_sum_addr(orig->ip_src));
+
+    icmp->icmp_type = type;
+    icmp->icmp_code = code;
+    memcpy(icmp->data, orig, quote);
+    icmp->icmp_sum = sr_ctl_finish((type << 8 | code) + sr_ctl_sum(icmp->data, quote));
+    return SR_CTL_ICMP_ERR_LEN + extra;
+} /* -- sr_ctl_icmp_error -- */
+
+void sr_ctl_echo_reply(struct sr_if* iface, uint8_t* packet)
+{
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)packet;
+    sr_ip_hdr_t* ip = sr_ctl_ip(packet);
+    sr_icmp_hdr_t* icmp = (sr_icmp_hdr_t*)((uint8_t*)ip + ip->ip_hl * 4);
+    uint32_t addr;
+    uint16_t from;
+
+    memcpy(eth->ether_dhost, eth->ether_shost, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, iface->addr, ETHER_ADDR_LEN);
+
+    /* swapping the addresses leaves the IP checksum as it is; the TTL
+       shares a word with the protocol */
+    addr = ip->ip_src;
+    ip->ip_src = ip->ip_dst;
+    ip->ip_dst = addr;
+    from = sr_ctl_word(&ip->ip_ttl);
+    ip->ip_ttl = SR_CTL_ECHO_TTL;
+    ip->ip_sum = sr_ctl_adjust(ip->ip_sum, from, sr_ctl_word(&ip->ip_ttl));
+
+    /* type and code are the first word of the ICMP header */
+    from = sr_ctl_word(icmp);
+    icmp->icmp_type = icmp_type_echo_reply;
+    icmp->icmp_code = 0;
+    icmp->icmp_sum = sr_ctl_adjust(icmp->icmp_sum, from, sr_ctl_word(icmp));
+} /* -- sr_ctl_echo_reply -- */
+
+unsigned int sr_ctl_arp_request(struct sr_instance* sr, struct sr_if* iface,
+                                uint8_t* buf, uint32_t tip)
+{
+    memcpy(buf, sr->ctl.tmpl[iface->index].arp_req, SR_CTL_ARP_LEN);
+    sr_ctl_arp(buf)->ar_tip = tip;
+    return SR_CTL_ARP_LEN;
+} /* -- sr_ctl_arp_request -- */
+
+unsigned int sr_ctl_arp_reply(struct sr_instance* sr, struct sr_if* iface,
+                              uint8_t* buf, const sr_arp_hdr_t* req)
+{
+    sr_arp_hdr_t* arp = sr_ctl_arp(buf);
+
+    memcpy(buf, sr->ctl.tmpl[iface->index].arp_rep, SR_CTL_ARP_LEN);
+    memcpy(((sr_ethernet_hdr_t*)buf)->ether_dhost, req->ar_sha, ETHER_ADDR_LEN);
+    memcpy(arp->ar_tha, req->ar_sha, ETHER_ADDR_LEN);
+    arp->ar_tip = req->ar_sip;
+    return SR_CTL_ARP_LEN;
+} /* -- sr_ctl_arp_reply -- */
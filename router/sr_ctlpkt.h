@@ -0,0 +1,100 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_ctlpkt.h
+ *
+ * Description:
+ *
+ * Control packets the router originates: ICMP errors, echo replies, ARP
+ * requests and ARP replies.  Each interface keeps a prebuilt copy of
+ * every header that does not depend on the packet being answered -- its
+ * MAC and IP in place, the constant IP fields set, and the checksum of
+ * those fields summed ahead of time -- so generating one is a copy of the
+ * template and a few stores.
+ *
+ * Echo replies need no template: the request is turned around where it
+ * lies, with its addresses swapped and both checksums adjusted for the
+ * words that change (RFC 1624) instead of summed again over the payload.
+ *
+ * Templates are rebuilt when an interface's MAC or IP address is set
+ * (sr_if.c).  Partial sums are one's complement sums of the template's
+ * 16-bit words with the per-packet fields and the checksum zero, in the
+ * byte order cksum() uses; the per-packet words are added and the result
+ * folded and complemented when the packet is finished.
+ *
+ * Buffers come from a small pool instead of malloc.  Sending copies the
+ * frame (sr_send_packet_if, and the ARP queue keeps its own copy), so a
+ * buffer is handed back as soon as the send returns; the pool only has to
+ * cover the nesting of one send inside another (an ICMP error that queues
+ * behind an ARP request).  An empty pool falls back to malloc.
+ *
+ * All of this belongs to the forwarding thread and takes no lock.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CTLPKT_H
+#define SR_CTLPKT_H
+
+#include <stdint.h>
+
+#include "sr_protocol.h"
+#include "sr_if.h"
+
+struct sr_instance;
+
+#define SR_CTL_ICMP_ERR_LEN (sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t))
+#define SR_CTL_ARP_LEN      (sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t))
+
+#define SR_CTL_ECHO_TTL 64
+
+#define SR_CTL_POOL_SZ  8
+#define SR_CTL_BUF_LEN  128       /* room for the largest of the above, with
+                                     the longest quote */
+
+struct sr_ctl_tmpl
+{
+    uint8_t icmp_err[SR_CTL_ICMP_ERR_LEN];
+    uint32_t icmp_err_sum;        /* IP header, less ip_src and ip_dst */
+    uint8_t arp_req[SR_CTL_ARP_LEN];  /* broadcast, less ar_tip */
+    uint8_t arp_rep[SR_CTL_ARP_LEN];  /* less ether_dhost, ar_tha and ar_tip */
+};
+
+struct sr_ctl
+{
+    struct sr_ctl_tmpl tmpl[SR_IF_MAX];   /* by interface index */
+    uint8_t pool[SR_CTL_POOL_SZ][SR_CTL_BUF_LEN];
+    uint32_t busy;                /* bit per pool buffer in use */
+};
+
+/* An empty pool and no templates; all zero does as well. */
+void sr_ctl_init(struct sr_ctl* ctl);
+
+/* (Re)build 'iface's templates from its current addresses. */
+void sr_ctl_build(struct sr_instance* sr, struct sr_if* iface);
+
+/* A buffer of SR_CTL_BUF_LEN bytes, and back. */
+uint8_t* sr_ctl_get(struct sr_ctl* ctl);
+void sr_ctl_put(struct sr_ctl* ctl, uint8_t* buf);
+
+/* Type 3 or 11 error about 'orig' from 'src' to orig's source, out of
+   'iface', quoting the first 'quote' bytes of orig: its IP header and 8
+   bytes of payload, ICMP_DATA_SIZE up to ICMP_QUOTE_MAX and even.  The
+   Ethernet destination is left for send_packet.  Returns the frame
+   length. */
+unsigned int sr_ctl_icmp_error(struct sr_instance* sr, struct sr_if* iface,
+                               uint8_t* buf, const sr_ip_hdr_t* orig,
+                               unsigned int quote, uint32_t src,
+                               uint8_t type, uint8_t code);
+
+/* Turn the echo request in 'packet', received on 'iface', into its reply
+   in place: back to the MAC it came from, from the request's destination
+   to its source, with a fresh TTL. */
+void sr_ctl_echo_reply(struct sr_if* iface, uint8_t* packet);
+
+/* Broadcast request for 'tip' out of 'iface'.  Returns the frame length. */
+unsigned int sr_ctl_arp_request(struct sr_instance* sr, struct sr_if* iface,
+                                uint8_t* buf, uint32_t tip);
+
+/* Reply from 'iface' to the request 'req'.  Returns the frame length. */
+unsigned int sr_ctl_arp_reply(struct sr_instance* sr, struct sr_if* iface,
+                              uint8_t* buf, const sr_arp_hdr_t* req);
+
+#endif /* -- SR_CTLPKT_H -- */
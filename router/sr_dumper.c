@@ -2,7 +2,11 @@
 #include <sys/types.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "sr_dumper.h"
+#include "sr_clock.h"
 
 static void
 sf_write_header(FILE *fp, int linktype, int thiszone, int snaplen)
@@ -69,3 +73,284 @@ sr_dump_close(FILE *fp)
   fclose(fp);
 }
 
+/*
+ * Asynchronous capture: SPSC byte ring + writer thread.
+ *
+ * The ring holds back-to-back records, each a pcap_sf_pkthdr followed by
+ * 'caplen' bytes, exactly as they go to disk.  Records may wrap around the
+ * end of the ring.  'head' is only written by the producer and 'tail' only
+ * by the writer; each publishes with a release store and reads the other's
+ * index with an acquire load.
+ */
+
+#define RING_MASK (SR_DUMP_RING_SIZE - 1)
+
+static void
+ring_put(uint8_t *ring, uint64_t pos, const void *src, unsigned int len)
+{
+        unsigned int off = pos & RING_MASK;
+        unsigned int first = SR_DUMP_RING_SIZE - off;
+
+        if (first >= len)
+                memcpy(ring + off, src, len);
+        else {
+                memcpy(ring + off, src, first);
+                memcpy(ring, (const uint8_t *)src + first, len - first);
+        }
+}
+
+static void
+ring_get(const uint8_t *ring, uint64_t pos, void *dst, unsigned int len)
+{
+        unsigned int off = pos & RING_MASK;
+        unsigned int first = SR_DUMP_RING_SIZE - off;
+
+        if (first >= len)
+                memcpy(dst, ring + off, len);
+        else {
+                memcpy(dst, ring + off, first);
+                memcpy((uint8_t *)dst + first, ring, len - first);
+        }
+}
+
+static int
+is_stdout(const char *fname)
+{
+        return (fname[0] == '-' && fname[1] == '\0');
+}
+
+/*
+ * Close the current file and open the next one in the rotation.
+ */
+static int
+writer_rotate(struct sr_dump_writer *w)
+{
+        char *name;
+        size_t n;
+
+        if (w->fp)
+                sr_dump_close(w->fp);
+        w->fp = NULL;
+
+        w->file_index++;
+        n = strlen(w->fname) + 16;
+        name = (char *)malloc(n);
+        if (name == NULL)
+                return (-1);
+        snprintf(name, n, "%s.%d", w->fname, w->file_index);
+        w->fp = sr_dump_open(name, 0, w->snaplen);
+        free(name);
+        if (w->fp == NULL)
+                return (-1);
+
+        w->file_bytes = sizeof(struct pcap_file_header);
+        w->file_opened_ms = sr_clock_refresh();
+        return (0);
+}
+
+static int
+writer_should_rotate(struct sr_dump_writer *w, unsigned long pending)
+{
+        if (is_stdout(w->fname))
+                return (0);
+        if (w->rotate_bytes &&
+            w->file_bytes + pending > w->rotate_bytes &&
+            w->file_bytes > sizeof(struct pcap_file_header))
+                return (1);
+        if (w->rotate_secs &&
+            sr_clock_refresh() - w->file_opened_ms >=
+            (uint64_t)w->rotate_secs * 1000)
+                return (1);
+        return (0);
+}
+
+static void
+writer_flush(struct sr_dump_writer *w, unsigned long len)
+{
+        if (len == 0 || w->fp == NULL)
+                return;
+        if (fwrite(w->block, len, 1, w->fp) != 1)
+                fprintf(stderr, "sr_dump: write failed\n");
+        fflush(w->fp);
+        w->file_bytes += len;
+}
+
+static void
+writer_report_drops(struct sr_dump_writer *w)
+{
+        uint64_t drops = __atomic_load_n(&w->drops, __ATOMIC_RELAXED);
+
+        if (drops != w->drops_reported) {
+                fprintf(stderr, "sr_dump: %s: dropped %lu frames "
+                    "(%lu total), writer fell behind\n", w->fname,
+                    (unsigned long)(drops - w->drops_reported),
+                    (unsigned long)drops);
+                w->drops_reported = drops;
+        }
+}
+
+/*
+ * Move every complete record currently in the ring to disk, one block at a
+ * time.  Returns the number of bytes consumed.
+ */
+static uint64_t
+writer_drain(struct sr_dump_writer *w)
+{
+        struct pcap_sf_pkthdr sf_hdr;
+        uint64_t head, tail, start;
+        unsigned long used = 0;
+        unsigned int rec;
+
+        head = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+        tail = start = w->tail;
+
+        while (tail != head) {
+                ring_get(w->ring, tail, &sf_hdr, sizeof(sf_hdr));
+                rec = sizeof(sf_hdr) + sf_hdr.caplen;
+
+                if (used + rec > SR_DUMP_BLOCK_SIZE) {
+                        writer_flush(w, used);
+                        used = 0;
+                        /* let the producer reuse what has hit the disk */
+                        __atomic_store_n(&w->tail, tail, __ATOMIC_RELEASE);
+                }
+                if (writer_should_rotate(w, used + rec)) {
+                        writer_flush(w, used);
+                        used = 0;
+                        if (writer_rotate(w) < 0)
+                                fprintf(stderr, "sr_dump: can't rotate "
+                                    "%s\n", w->fname);
+                }
+
+                ring_get(w->ring, tail, w->block + used, rec);
+                used += rec;
+                tail += rec;
+        }
+        writer_flush(w, used);
+        __atomic_store_n(&w->tail, tail, __ATOMIC_RELEASE);
+
+        return (tail - start);
+}
+
+static void *
+writer_main(void *arg)
+{
+        struct sr_dump_writer *w = (struct sr_dump_writer *)arg;
+        struct timespec idle;
+
+        idle.tv_sec = 0;
+        idle.tv_nsec = SR_DUMP_POLL_MS * 1000000L;
+
+        for (;;) {
+                int stopping = __atomic_load_n(&w->stop, __ATOMIC_ACQUIRE);
+
+                if (writer_drain(w) == 0) {
+                        writer_report_drops(w);
+                        if (stopping)
+                                break;
+                        /* time-based rotation must happen on idle links too */
+                        if (w->fp && writer_should_rotate(w, 0) &&
+                            writer_rotate(w) < 0)
+                                fprintf(stderr, "sr_dump: can't rotate "
+                                    "%s\n", w->fname);
+                        nanosleep(&idle, NULL);
+                }
+        }
+        return (NULL);
+}
+
+struct sr_dump_writer *
+sr_dump_async_open(const char *fname, int snaplen,
+    unsigned long rotate_bytes, unsigned int rotate_secs)
+{
+        struct sr_dump_writer *w;
+
+        w = (struct sr_dump_writer *)calloc(1, sizeof(*w));
+        if (w == NULL)
+                return (NULL);
+        w->ring = (uint8_t *)malloc(SR_DUMP_RING_SIZE);
+        w->block = (uint8_t *)malloc(SR_DUMP_BLOCK_SIZE);
+        w->fname = strdup(fname);
+        if (w->ring == NULL || w->block == NULL || w->fname == NULL)
+                goto fail;
+
+        /* a record must always fit in one block */
+        if (snaplen <= 0 ||
+            snaplen > SR_DUMP_BLOCK_SIZE - (int)sizeof(struct pcap_sf_pkthdr))
+                snaplen = SR_DUMP_BLOCK_SIZE - sizeof(struct pcap_sf_pkthdr);
+        w->snaplen = snaplen;
+        w->rotate_bytes = rotate_bytes;
+        w->rotate_secs = rotate_secs;
+
+        w->fp = sr_dump_open(fname, 0, snaplen);
+        if (w->fp == NULL)
+                goto fail;
+        w->file_bytes = sizeof(struct pcap_file_header);
+        w->file_opened_ms = sr_clock_refresh();
+
+        if (pthread_create(&w->thread, NULL, writer_main, w) != 0) {
+                fprintf(stderr, "sr_dump_async_open: can't start writer\n");
+                sr_dump_close(w->fp);
+                goto fail;
+        }
+        return (w);
+
+fail:
+        free(w->ring);
+        free(w->block);
+        free(w->fname);
+        free(w);
+        return (NULL);
+}
+
+void
+sr_dump_async(struct sr_dump_writer *w, const uint8_t *buf, unsigned int len)
+{
+        struct pcap_sf_pkthdr sf_hdr;
+        struct timeval tv;
+        uint64_t head, tail;
+        unsigned int caplen, rec;
+
+        caplen = min(len, (unsigned int)w->snaplen);
+        rec = sizeof(sf_hdr) + caplen;
+
+        head = w->head;
+        tail = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+        if (SR_DUMP_RING_SIZE - (head - tail) < rec) {
+                __atomic_store_n(&w->drops, w->drops + 1, __ATOMIC_RELAXED);
+                return;
+        }
+
+        gettimeofday(&tv, 0);
+        sf_hdr.ts.tv_sec  = tv.tv_sec;
+        sf_hdr.ts.tv_usec = tv.tv_usec;
+        sf_hdr.caplen     = caplen;
+        sf_hdr.len        = len;
+
+        ring_put(w->ring, head, &sf_hdr, sizeof(sf_hdr));
+        ring_put(w->ring, head + sizeof(sf_hdr), buf, caplen);
+        w->packets++;
+        __atomic_store_n(&w->head, head + rec, __ATOMIC_RELEASE);
+}
+
+void
+sr_dump_async_close(struct sr_dump_writer *w)
+{
+        if (w == NULL)
+                return;
+
+        __atomic_store_n(&w->stop, 1, __ATOMIC_RELEASE);
+        pthread_join(w->thread, NULL);
+
+        if (w->drops)
+                fprintf(stderr, "sr_dump: %s: %lu of %lu frames dropped\n",
+                    w->fname, (unsigned long)w->drops,
+                    (unsigned long)(w->packets + w->drops));
+
+        if (w->fp && w->fp != stdout)
+                sr_dump_close(w->fp);
+        free(w->ring);
+        free(w->block);
+        free(w->fname);
+        free(w);
+}
@@ -3,6 +3,11 @@
  * format as well as a set of operations for logging.
  */
 
+#ifndef SR_DUMPER_H
+#define SR_DUMPER_H
+
+#include <stdio.h>
+#include <pthread.h>
 
 #ifdef _LINUX_
 #include <stdint.h>
@@ -77,3 +82,68 @@ void sr_dump(FILE *fp, const struct pcap_pkthdr *h, const unsigned char *sp);
  * Close the file
  */
 void sr_dump_close(FILE *fp);
+
+/*
+ * Asynchronous capture.
+ *
+ * The forwarding thread copies each frame (pcap record header + up to
+ * 'snaplen' bytes) into a single-producer/single-consumer lock-free ring and
+ * returns; a writer thread drains the ring in large blocks.  When the ring
+ * is full the frame is dropped and counted, and the writer reports drops on
+ * stderr.  The writer can rotate to a new file ("<fname>.1", "<fname>.2",
+ * ...) once the current one exceeds 'rotate_bytes' or is 'rotate_secs' old
+ * (0 disables either).
+ */
+
+#define SR_DUMP_RING_SIZE  (4 * 1024 * 1024)  /* bytes, power of two */
+#define SR_DUMP_BLOCK_SIZE (256 * 1024)       /* writer fwrite() size */
+#define SR_DUMP_POLL_MS    10                 /* writer idle poll period */
+#define SR_DUMP_CACHELINE  64
+
+struct sr_dump_writer {
+  /* producer side */
+  uint64_t head;                 /* bytes ever written to the ring */
+  uint64_t drops;                /* frames dropped because the ring was full */
+  uint64_t packets;              /* frames queued */
+  char     pad0[SR_DUMP_CACHELINE - 3 * sizeof(uint64_t)];
+
+  /* consumer side */
+  uint64_t tail;                 /* bytes ever drained from the ring */
+  uint64_t drops_reported;
+  char     pad1[SR_DUMP_CACHELINE - 2 * sizeof(uint64_t)];
+
+  uint8_t *ring;
+  uint8_t *block;                /* writer's staging buffer */
+  int      snaplen;
+  int      stop;
+
+  FILE    *fp;
+  char    *fname;
+  unsigned long rotate_bytes;
+  unsigned int  rotate_secs;
+  unsigned long file_bytes;
+  uint64_t file_opened_ms;
+  int      file_index;
+
+  pthread_t thread;
+};
+
+/**
+ * Open 'fname' and start the writer thread. Returns NULL on failure.
+ */
+struct sr_dump_writer* sr_dump_async_open(const char *fname, int snaplen,
+                                          unsigned long rotate_bytes,
+                                          unsigned int rotate_secs);
+
+/**
+ * Queue one frame for writing. Never blocks; must be called from a single
+ * thread at a time.
+ */
+void sr_dump_async(struct sr_dump_writer *w, const uint8_t *buf, unsigned int len);
+
+/**
+ * Drain everything queued, stop the writer thread and close the file.
+ */
+void sr_dump_async_close(struct sr_dump_writer *w);
+
+#endif /* -- SR_DUMPER_H -- */
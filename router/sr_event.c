@@ -0,0 +1,272 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_event.c
+ *
+ * Description:
+ *
+ * epoll/timerfd based event loop.  See sr_event.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "sr_event.h"
+
+#define SR_EV_MAX_EVENTS 64
+
+/* watches removed from inside a callback are only unlinked; they are freed
+   once the current batch of epoll events has been dispatched */
+#define SR_EV_DEAD_FD -1
+
+static void sr_ev_tick(struct sr_event_loop* loop, void* arg)
+{
+    sr_timer_wheel_advance(&(loop->timers), sr_clock_now());
+}
+
+int sr_ev_init(struct sr_event_loop* loop)
+{
+    /* -- REQUIRES -- */
+    assert(loop);
+
+    loop->running = 0;
+    loop->watches = 0;
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(loop->epfd < 0)
+    {
+        perror("epoll_create1(..):sr_event.c::sr_ev_init(..)");
+        return -1;
+    }
+
+    sr_timer_wheel_init(&(loop->timers), sr_clock_refresh());
+    loop->tick = sr_ev_add_timer(loop, SR_TIMER_TICK_MS, sr_ev_tick, 0);
+    if(!loop->tick)
+    {
+        close(loop->epfd);
+        loop->epfd = -1;
+        return -1;
+    }
+    return 0;
+} /* -- sr_ev_init -- */
+
+static struct sr_ev_watch* sr_ev_new_watch(struct sr_event_loop* loop, int fd)
+{
+    struct sr_ev_watch* w = (struct sr_ev_watch*)calloc(1, sizeof(struct sr_ev_watch));
+    assert(w);
+    w->fd = fd;
+    w->next = loop->watches;
+    loop->watches = w;
+    return w;
+}
+
+static void sr_ev_reap(struct sr_event_loop* loop)
+{
+    struct sr_ev_watch** pw = &loop->watches;
+    while(*pw)
+    {
+        struct sr_ev_watch* w = *pw;
+        if(w->fd == SR_EV_DEAD_FD)
+        {
+            *pw = w->next;
+            free(w);
+        }
+        else
+        { pw = &w->next; }
+    }
+}
+
+static void sr_ev_kill(struct sr_event_loop* loop, struct sr_ev_watch* w)
+{
+    if(w->fd == SR_EV_DEAD_FD)
+    { return; }
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, w->fd, 0);
+    if(w->is_timer)
+    { close(w->fd); }
+    w->fd = SR_EV_DEAD_FD;
+}
+
+void sr_ev_destroy(struct sr_event_loop* loop)
+{
+    struct sr_ev_watch* w;
+
+    /* -- REQUIRES -- */
+    assert(loop);
+
+    for(w = loop->watches; w; w = w->next)
+    { sr_ev_kill(loop, w); }
+    sr_ev_reap(loop);
+    loop->tick = 0;
+    if(loop->epfd >= 0)
+    { close(loop->epfd); }
+    loop->epfd = -1;
+} /* -- sr_ev_destroy -- */
+
+int sr_ev_add_fd(struct sr_event_loop* loop, int fd, uint32_t events,
+                 sr_ev_fd_cb cb, void* arg)
+{
+    struct epoll_event ev;
+    struct sr_ev_watch* w;
+
+    /* -- REQUIRES -- */
+    assert(loop);
+    assert(cb);
+
+    w = sr_ev_new_watch(loop, fd);
+    w->fd_cb = cb;
+    w->arg = arg;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = w;
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        perror("epoll_ctl(..):sr_event.c::sr_ev_add_fd(..)");
+        w->fd = SR_EV_DEAD_FD;
+        sr_ev_reap(loop);
+        return -1;
+    }
+    return 0;
+} /* -- sr_ev_add_fd -- */
+
+void sr_ev_del_fd(struct sr_event_loop* loop, int fd)
+{
+    struct sr_ev_watch* w;
+
+    for(w = loop->watches; w; w = w->next)
+    {
+        if(!w->is_timer && w->fd == fd)
+        {
+            sr_ev_kill(loop, w);
+            break;
+        }
+    }
+    if(!loop->running)
+    { sr_ev_reap(loop); }
+} /* -- sr_ev_del_fd -- */
+
+struct sr_ev_watch* sr_ev_add_timer(struct sr_event_loop* loop,
+                                    unsigned int interval_ms,
+                                    sr_ev_timer_cb cb, void* arg)
+{
+    struct itimerspec its;
+    struct epoll_event ev;
+    struct sr_ev_watch* w;
+    int tfd;
+
+    /* -- REQUIRES -- */
+    assert(loop);
+    assert(cb);
+    assert(interval_ms > 0);
+
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(tfd < 0)
+    {
+        perror("timerfd_create(..):sr_event.c::sr_ev_add_timer(..)");
+        return 0;
+    }
+
+    its.it_interval.tv_sec  = interval_ms / 1000;
+    its.it_interval.tv_nsec = (interval_ms % 1000) * 1000000L;
+    its.it_value = its.it_interval;
+    if(timerfd_settime(tfd, 0, &its, 0) < 0)
+    {
+        perror("timerfd_settime(..):sr_event.c::sr_ev_add_timer(..)");
+        close(tfd);
+        return 0;
+    }
+
+    w = sr_ev_new_watch(loop, tfd);
+    w->is_timer = 1;
+    w->interval_ms = interval_ms;
+    w->timer_cb = cb;
+    w->arg = arg;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = w;
+    if(epoll_ctl(loop->epfd, EPOLL_CTL_ADD, tfd, &ev) < 0)
+    {
+        perror("epoll_ctl(..):sr_event.c::sr_ev_add_timer(..)");
+        close(tfd);
+        w->fd = SR_EV_DEAD_FD;
+        sr_ev_reap(loop);
+        return 0;
+    }
+    return w;
+} /* -- sr_ev_add_timer -- */
+
+void sr_ev_del_timer(struct sr_event_loop* loop, struct sr_ev_watch* timer)
+{
+    if(!timer)
+    { return; }
+    sr_ev_kill(loop, timer);
+    if(!loop->running)
+    { sr_ev_reap(loop); }
+} /* -- sr_ev_del_timer -- */
+
+void sr_ev_stop(struct sr_event_loop* loop)
+{
+    loop->running = 0;
+} /* -- sr_ev_stop -- */
+
+int sr_ev_run(struct sr_event_loop* loop)
+{
+    struct epoll_event events[SR_EV_MAX_EVENTS];
+    int n, i;
+
+    /* -- REQUIRES -- */
+    assert(loop);
+
+    loop->running = 1;
+    sr_rcu_register(&(loop->rcu));
+    while(loop->running && loop->watches)
+    {
+        /* nothing from the last batch is held past here */
+        sr_rcu_offline(&(loop->rcu));
+        n = epoll_wait(loop->epfd, events, SR_EV_MAX_EVENTS, -1);
+        sr_rcu_online(&(loop->rcu));
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            perror("epoll_wait(..):sr_event.c::sr_ev_run(..)");
+            sr_rcu_unregister(&(loop->rcu));
+            loop->running = 0;
+            return -1;
+        }
+
+        /* one clock read per batch; handlers use sr_clock_now() */
+        sr_clock_refresh();
+
+        for(i = 0; i < n && loop->running; i++)
+        {
+            struct sr_ev_watch* w = (struct sr_ev_watch*)events[i].data.ptr;
+            if(w->fd == SR_EV_DEAD_FD)
+            { continue; }
+
+            if(w->is_timer)
+            {
+                uint64_t expirations;
+                /* drain the timerfd; a late wakeup still runs the callback
+                   once, the callbacks themselves work from the clock */
+                if(read(w->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                { continue; }
+                w->timer_cb(loop, w->arg);
+            }
+            else
+            {
+                w->fd_cb(loop, w->fd, events[i].events, w->arg);
+            }
+        }
+
+        sr_ev_reap(loop);
+    }
+    sr_rcu_unregister(&(loop->rcu));
+    loop->running = 0;
+    return 0;
+} /* -- sr_ev_run -- */
@@ -0,0 +1,83 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_event.h
+ *
+ * Description:
+ *
+ * Single-threaded event loop (reactor) for the router.  Socket I/O and all
+ * timeouts (ARP retries, NAT expiry, inbound SYN holds) are dispatched from
+ * one epoll set.  Periodic timers are backed by timerfd; one-shot timeouts
+ * go on the loop's timing wheel (sr_timer.h), which a single timerfd ticks.
+ *
+ * The running loop is an RCU reader (sr_rcu.h): quiescent between batches,
+ * offline in epoll_wait.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_EVENT_H
+#define SR_EVENT_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#include "sr_timer.h"
+#include "sr_clock.h"
+#include "sr_rcu.h"
+
+struct sr_event_loop;
+
+/* called when a watched fd becomes ready; 'events' is the epoll mask */
+typedef void (*sr_ev_fd_cb)(struct sr_event_loop* loop, int fd,
+                            uint32_t events, void* arg);
+
+/* called each time a periodic timer fires */
+typedef void (*sr_ev_timer_cb)(struct sr_event_loop* loop, void* arg);
+
+/* ----------------------------------------------------------------------------
+ * struct sr_ev_watch
+ *
+ * One registered fd or timer.  Timers own their timerfd.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_ev_watch
+{
+    int fd;
+    int is_timer;
+    unsigned int interval_ms;  /* timers only */
+    sr_ev_fd_cb fd_cb;
+    sr_ev_timer_cb timer_cb;
+    void* arg;
+    struct sr_ev_watch* next;
+};
+
+struct sr_event_loop
+{
+    int epfd;
+    int running;
+    struct sr_ev_watch* watches;
+    struct sr_timer_wheel timers; /* one-shot timeouts, see sr_timer.h */
+    struct sr_ev_watch* tick;     /* drives 'timers' */
+    struct sr_rcu_reader rcu;     /* registered while running */
+};
+
+int  sr_ev_init(struct sr_event_loop* loop);
+void sr_ev_destroy(struct sr_event_loop* loop);
+
+/* Watch 'fd' for 'events' (EPOLLIN etc.). Returns 0 on success. */
+int  sr_ev_add_fd(struct sr_event_loop* loop, int fd, uint32_t events,
+                  sr_ev_fd_cb cb, void* arg);
+void sr_ev_del_fd(struct sr_event_loop* loop, int fd);
+
+/* Add a periodic timer firing every 'interval_ms' milliseconds.
+   Returns the watch (pass to sr_ev_del_timer) or NULL on failure. */
+struct sr_ev_watch* sr_ev_add_timer(struct sr_event_loop* loop,
+                                    unsigned int interval_ms,
+                                    sr_ev_timer_cb cb, void* arg);
+void sr_ev_del_timer(struct sr_event_loop* loop, struct sr_ev_watch* timer);
+
+/* Dispatch events until sr_ev_stop is called or nothing is left to watch.
+   Returns 0 on a clean stop, -1 on error. */
+int  sr_ev_run(struct sr_event_loop* loop);
+void sr_ev_stop(struct sr_event_loop* loop);
+
+#endif /* -- SR_EVENT_H -- */
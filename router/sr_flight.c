@@ -0,0 +1,279 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flight.c
+ *
+ * Description:
+ *
+ * Packet flight recorder.  See sr_flight.h.
+ *
+ * The dump is a pcapng file: one section header, one interface description
+ * block per interface name seen in the ring (millisecond timestamps), and
+ * one enhanced packet block per frame carrying the direction in epb_flags
+ * and the verdict as the packet comment.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "sr_flight.h"
+
+#define PCAPNG_SHB           0x0A0D0D0A
+#define PCAPNG_IDB           0x00000001
+#define PCAPNG_EPB           0x00000006
+#define PCAPNG_BYTE_ORDER    0x1A2B3C4D
+#define PCAPNG_OPT_END       0
+#define PCAPNG_OPT_COMMENT   1
+#define PCAPNG_IF_NAME       2
+#define PCAPNG_IF_TSRESOL    9
+#define PCAPNG_EPB_FLAGS     2
+#define PCAPNG_LINK_ETHERNET 1
+
+#define PAD4(x) (((x) + 3) & ~3U)
+
+/* interfaces named in one dump; anything beyond shares the last id */
+#define SR_FLIGHT_MAX_IFACES 32
+
+static const char* sr_flight_verdict_str[] = {
+    "pending", "forwarded", "nated", "local", "dropped", "sent"
+};
+
+int sr_flight_init(struct sr_flight* fr, unsigned int nframes)
+{
+    /* -- REQUIRES -- */
+    assert(fr);
+
+    fr->slots = 0;
+    fr->nslots = 0;
+    fr->seq = 0;
+    fr->rx = 0;
+    if(nframes == 0)
+    { return 0; }
+
+    fr->slots = (struct sr_flight_slot*)calloc(nframes, sizeof(struct sr_flight_slot));
+    if(!fr->slots)
+    {
+        perror("calloc(..):sr_flight.c::sr_flight_init(..)");
+        return -1;
+    }
+    fr->nslots = nframes;
+    return 0;
+} /* -- sr_flight_init -- */
+
+void sr_flight_destroy(struct sr_flight* fr)
+{
+    free(fr->slots);
+    fr->slots = 0;
+    fr->nslots = 0;
+    fr->rx = 0;
+} /* -- sr_flight_destroy -- */
+
+void sr_flight_record(struct sr_flight* fr, enum sr_flight_dir dir,
+                      const char* iface, const uint8_t* buf, unsigned int len)
+{
+    struct sr_flight_slot* slot;
+
+    if(!fr->slots)
+    { return; }
+
+    slot = &fr->slots[fr->seq % fr->nslots];
+    fr->seq++;
+
+    slot->ts = sr_clock_now();
+    slot->len = len;
+    slot->caplen = len < SR_FLIGHT_SNAPLEN ? len : SR_FLIGHT_SNAPLEN;
+    slot->dir = dir;
+    slot->why = 0;
+    strncpy(slot->iface, iface, sr_IFACE_NAMELEN - 1);
+    slot->iface[sr_IFACE_NAMELEN - 1] = '\0';
+    memcpy(slot->data, buf, slot->caplen);
+
+    if(dir == sr_flight_rx)
+    {
+        slot->verdict = sr_flight_pending;
+        fr->rx = slot;
+    }
+    else
+    {
+        slot->verdict = sr_flight_sent;
+        /* a long burst of transmits may have recycled the rx slot */
+        if(fr->rx == slot)
+        { fr->rx = 0; }
+    }
+} /* -- sr_flight_record -- */
+
+void sr_flight_verdict(struct sr_flight* fr, enum sr_flight_verdict verdict,
+                       const char* why)
+{
+    if(!fr->rx || fr->rx->verdict != sr_flight_pending)
+    { return; }
+    fr->rx->verdict = verdict;
+    fr->rx->why = why;
+} /* -- sr_flight_verdict -- */
+
+/*---------------------------------------------------------------------------
+ * pcapng output
+ *---------------------------------------------------------------------------*/
+
+static void sr_flight_put32(FILE* fp, uint32_t v)
+{ fwrite(&v, sizeof(v), 1, fp); }
+
+static void sr_flight_put16(FILE* fp, uint16_t v)
+{ fwrite(&v, sizeof(v), 1, fp); }
+
+static void sr_flight_pad(FILE* fp, unsigned int len)
+{
+    static const uint8_t zero[4];
+    fwrite(zero, 1, PAD4(len) - len, fp);
+}
+
+static void sr_flight_put_opt(FILE* fp, uint16_t code, const void* val, uint16_t len)
+{
+    sr_flight_put16(fp, code);
+    sr_flight_put16(fp, len);
+    fwrite(val, 1, len, fp);
+    sr_flight_pad(fp, len);
+}
+
+static void sr_flight_write_shb(FILE* fp)
+{
+    uint32_t blen = 28;
+
+    sr_flight_put32(fp, PCAPNG_SHB);
+    sr_flight_put32(fp, blen);
+    sr_flight_put32(fp, PCAPNG_BYTE_ORDER);
+    sr_flight_put16(fp, 1);             /* version 1.0 */
+    sr_flight_put16(fp, 0);
+    sr_flight_put32(fp, 0xFFFFFFFF);    /* section length unknown */
+    sr_flight_put32(fp, 0xFFFFFFFF);
+    sr_flight_put32(fp, blen);
+}
+
+static void sr_flight_write_idb(FILE* fp, const char* name)
+{
+    uint16_t nlen = strlen(name);
+    uint8_t tsresol = 3;                /* milliseconds */
+    uint32_t blen = 16 + 4 + PAD4(nlen) + 4 + 4 + 4 + 4;
+
+    sr_flight_put32(fp, PCAPNG_IDB);
+    sr_flight_put32(fp, blen);
+    sr_flight_put16(fp, PCAPNG_LINK_ETHERNET);
+    sr_flight_put16(fp, 0);
+    sr_flight_put32(fp, SR_FLIGHT_SNAPLEN);
+    sr_flight_put_opt(fp, PCAPNG_IF_NAME, name, nlen);
+    sr_flight_put_opt(fp, PCAPNG_IF_TSRESOL, &tsresol, 1);
+    sr_flight_put32(fp, PCAPNG_OPT_END);
+    sr_flight_put32(fp, blen);
+}
+
+static void sr_flight_write_epb(FILE* fp, const struct sr_flight_slot* slot,
+                                uint32_t ifid, uint64_t ts)
+{
+    char comment[128];
+    uint16_t clen;
+    uint32_t flags = slot->dir == sr_flight_rx ? 1 : 2;  /* inbound/outbound */
+    uint32_t blen;
+
+    if(slot->why)
+    {
+        snprintf(comment, sizeof(comment), "%s: %s",
+                 sr_flight_verdict_str[slot->verdict], slot->why);
+    }
+    else
+    {
+        snprintf(comment, sizeof(comment), "%s",
+                 sr_flight_verdict_str[slot->verdict]);
+    }
+    clen = strlen(comment);
+
+    blen = 28 + PAD4(slot->caplen) + 4 + 4 + 4 + PAD4(clen) + 4 + 4;
+
+    sr_flight_put32(fp, PCAPNG_EPB);
+    sr_flight_put32(fp, blen);
+    sr_flight_put32(fp, ifid);
+    sr_flight_put32(fp, (uint32_t)(ts >> 32));
+    sr_flight_put32(fp, (uint32_t)ts);
+    sr_flight_put32(fp, slot->caplen);
+    sr_flight_put32(fp, slot->len);
+    fwrite(slot->data, 1, slot->caplen, fp);
+    sr_flight_pad(fp, slot->caplen);
+    sr_flight_put_opt(fp, PCAPNG_EPB_FLAGS, &flags, 4);
+    sr_flight_put_opt(fp, PCAPNG_OPT_COMMENT, comment, clen);
+    sr_flight_put32(fp, PCAPNG_OPT_END);
+    sr_flight_put32(fp, blen);
+}
+
+int sr_flight_dump(struct sr_flight* fr, const char* path)
+{
+    const char* ifnames[SR_FLIGHT_MAX_IFACES];
+    unsigned int nifs = 0;
+    uint64_t first, i;
+    uint32_t ifid;
+    sr_msec_t mono;
+    struct timespec wall;
+    int64_t offset;
+    FILE* fp;
+    unsigned int j;
+
+    /* -- REQUIRES -- */
+    assert(fr);
+    assert(path);
+
+    if(!fr->slots)
+    { return 0; }
+
+    fp = fopen(path, "wb");
+    if(!fp)
+    {
+        perror("fopen(..):sr_flight.c::sr_flight_dump(..)");
+        return -1;
+    }
+
+    /* slots carry loop-clock time; shift it onto the wall clock */
+    mono = sr_clock_refresh();
+    clock_gettime(CLOCK_REALTIME, &wall);
+    offset = ((int64_t)wall.tv_sec * 1000 + wall.tv_nsec / 1000000) - (int64_t)mono;
+
+    first = fr->seq > fr->nslots ? fr->seq - fr->nslots : 0;
+
+    /* pcapng wants every interface described before its first packet */
+    sr_flight_write_shb(fp);
+    for(i = first; i < fr->seq; i++)
+    {
+        const char* name = fr->slots[i % fr->nslots].iface;
+        for(j = 0; j < nifs; j++)
+        {
+            if(strcmp(ifnames[j], name) == 0)
+            { break; }
+        }
+        if(j == nifs && nifs < SR_FLIGHT_MAX_IFACES)
+        {
+            ifnames[nifs++] = name;
+            sr_flight_write_idb(fp, name);
+        }
+    }
+
+    for(i = first; i < fr->seq; i++)
+    {
+        const struct sr_flight_slot* slot = &fr->slots[i % fr->nslots];
+        ifid = nifs ? nifs - 1 : 0;
+        for(j = 0; j < nifs; j++)
+        {
+            if(strcmp(ifnames[j], slot->iface) == 0)
+            {
+                ifid = j;
+                break;
+            }
+        }
+        sr_flight_write_epb(fp, slot, ifid, (uint64_t)((int64_t)slot->ts + offset));
+    }
+
+    if(fclose(fp) != 0)
+    {
+        perror("fclose(..):sr_flight.c::sr_flight_dump(..)");
+        return -1;
+    }
+    return (int)(fr->seq - first);
+} /* -- sr_flight_dump -- */
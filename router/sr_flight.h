@@ -0,0 +1,82 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_flight.h
+ *
+ * Description:
+ *
+ * Packet flight recorder.  Keeps the last N frames the router received or
+ * sent in a fixed ring of preallocated slots, each tagged with direction,
+ * interface and what the pipeline did with it (forwarded, NATed, answered
+ * locally, dropped and why).  Nothing is written anywhere until someone
+ * asks: sr_flight_dump() writes the ring out as a pcapng file, with the
+ * verdict in each packet's comment.
+ *
+ * Recording a frame is a bounded memcpy into the next slot; the timestamp
+ * is the cached loop clock (sr_clock.h), so no system call is made.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FLIGHT_H
+#define SR_FLIGHT_H
+
+#include <stdint.h>
+
+#include "sr_if.h"
+#include "sr_clock.h"
+
+#define SR_FLIGHT_DEFAULT_FRAMES 1024
+#define SR_FLIGHT_SNAPLEN        256   /* bytes kept per frame */
+
+enum sr_flight_dir {
+    sr_flight_rx = 1,
+    sr_flight_tx = 2
+};
+
+enum sr_flight_verdict {
+    sr_flight_pending = 0,   /* still being processed */
+    sr_flight_forwarded,
+    sr_flight_nated,
+    sr_flight_local,         /* consumed or answered by the router */
+    sr_flight_dropped,
+    sr_flight_sent           /* transmitted frame */
+};
+
+struct sr_flight_slot
+{
+    sr_msec_t ts;
+    uint32_t len;                   /* length on the wire */
+    uint16_t caplen;                /* bytes in 'data' */
+    uint8_t dir;                    /* enum sr_flight_dir */
+    uint8_t verdict;                /* enum sr_flight_verdict */
+    const char* why;                /* static string detail, may be NULL */
+    char iface[sr_IFACE_NAMELEN];
+    uint8_t data[SR_FLIGHT_SNAPLEN];
+};
+
+struct sr_flight
+{
+    struct sr_flight_slot* slots;   /* NULL when the recorder is off */
+    unsigned int nslots;
+    uint64_t seq;                   /* frames ever recorded */
+    struct sr_flight_slot* rx;      /* received frame being processed */
+};
+
+/* Allocate 'nframes' slots; 0 turns the recorder off. Returns 0 on success. */
+int  sr_flight_init(struct sr_flight* fr, unsigned int nframes);
+void sr_flight_destroy(struct sr_flight* fr);
+
+/* Record a frame. A received frame becomes the target of sr_flight_verdict
+   until the next one arrives. */
+void sr_flight_record(struct sr_flight* fr, enum sr_flight_dir dir,
+                      const char* iface, const uint8_t* buf, unsigned int len);
+
+/* Tag the received frame being processed, unless it already has a verdict.
+   'why' is optional detail and must be a string literal (it is kept by
+   pointer). */
+void sr_flight_verdict(struct sr_flight* fr, enum sr_flight_verdict verdict,
+                       const char* why);
+
+/* Write every recorded frame, oldest first, to 'path' as pcapng.
+   Returns the number of frames written or -1 on error. */
+int  sr_flight_dump(struct sr_flight* fr, const char* path);
+
+#endif /* -- SR_FLIGHT_H -- */
@@ -0,0 +1,121 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_icmplimit.c
+ *
+ * Description:
+ *
+ * Token buckets for router-generated ICMP errors.  See sr_icmplimit.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "sr_icmplimit.h"
+#include "sr_protocol.h"
+
+#define SR_ICMP_LIMIT_COST  1000      /* tokens per message */
+#define SR_ICMP_LIMIT_MAX   1000000   /* rate or burst, messages */
+
+static void sr_icmp_bucket_fill(struct sr_icmp_bucket* b, uint32_t burst, sr_msec_t now)
+{
+    b->tokens = burst * SR_ICMP_LIMIT_COST;
+    b->last = now;
+}
+
+/* Refill for the time since the last call; 1 if a message's worth is left.
+   A rate in messages per second is the same number of tokens per ms. */
+static int sr_icmp_bucket_ready(struct sr_icmp_bucket* b, uint32_t rate,
+                                uint32_t burst, sr_msec_t now)
+{
+    uint64_t tokens;
+
+    if(now > b->last)
+    {
+        tokens = b->tokens + (uint64_t)(now - b->last) * rate;
+        if(tokens > (uint64_t)burst * SR_ICMP_LIMIT_COST)
+        { tokens = (uint64_t)burst * SR_ICMP_LIMIT_COST; }
+        b->tokens = (uint32_t)tokens;
+        b->last = now;
+    }
+    return b->tokens >= SR_ICMP_LIMIT_COST;
+}
+
+static uint32_t sr_icmp_limit_hash(uint32_t dst)
+{
+    return (dst * 2654435761u) >> (32 - SR_ICMP_LIMIT_DEST_BITS);
+}
+
+void sr_icmp_limit_init(struct sr_icmp_limit* lim)
+{
+    sr_msec_t now = sr_clock_now();
+
+    /* -- REQUIRES -- */
+    assert(lim);
+
+    sr_icmp_bucket_fill(&lim->unreach, lim->type_burst, now);
+    sr_icmp_bucket_fill(&lim->exceeded, lim->type_burst, now);
+    memset(lim->dest, 0, sizeof(lim->dest));
+} /* -- sr_icmp_limit_init -- */
+
+int sr_icmp_limit_allow(struct sr_icmp_limit* lim, uint8_t type, uint32_t dst)
+{
+    struct sr_icmp_bucket* tb;
+    struct sr_icmp_bucket* db = 0;
+    sr_msec_t now;
+
+    if(type == icmp_type_dest_unreachable)
+    { tb = &lim->unreach; }
+    else if(type == icmp_type_time_exceeded)
+    { tb = &lim->exceeded; }
+    else
+    { return 1; }
+
+    now = sr_clock_now();
+    if(lim->type_rate && !sr_icmp_bucket_ready(tb, lim->type_rate, lim->type_burst, now))
+    { return 0; }
+    if(lim->dest_rate)
+    {
+        /* slots are not tagged: a destination shares whatever tokens its
+           slot holds; a fresh (zeroed) one refills from time 0, to a full
+           burst */
+        db = &lim->dest[sr_icmp_limit_hash(dst)];
+        if(!sr_icmp_bucket_ready(db, lim->dest_rate, lim->dest_burst, now))
+        { return 0; }
+    }
+
+    /* both have a token: take them */
+    if(lim->type_rate)
+    { tb->tokens -= SR_ICMP_LIMIT_COST; }
+    if(db)
+    { db->tokens -= SR_ICMP_LIMIT_COST; }
+    return 1;
+} /* -- sr_icmp_limit_allow -- */
+
+int sr_icmp_limit_parse(const char* arg, uint32_t* rate, uint32_t* burst)
+{
+    char* end;
+    unsigned long r, b;
+
+    /* -- REQUIRES -- */
+    assert(arg);
+    assert(rate);
+    assert(burst);
+
+    r = strtoul(arg, &end, 10);
+    if(end == arg)
+    { return -1; }
+    b = r;
+    if(*end == '/')
+    {
+        arg = end + 1;
+        b = strtoul(arg, &end, 10);
+        if(end == arg)
+        { return -1; }
+    }
+    if(*end != '\0' || r > SR_ICMP_LIMIT_MAX || b > SR_ICMP_LIMIT_MAX || (r && !b))
+    { return -1; }
+    *rate = (uint32_t)r;
+    *burst = (uint32_t)b;
+    return 0;
+} /* -- sr_icmp_limit_parse -- */
@@ -0,0 +1,76 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_icmplimit.h
+ *
+ * Description:
+ *
+ * Rate limits on the ICMP errors the router generates (destination
+ * unreachable, time exceeded), as RFC 1812 4.3.2.8 asks.  A traceroute or
+ * a flood of expiring or unroutable packets would otherwise cost a route
+ * lookup, an allocation and a transmit per packet in, and aim the answers
+ * at whoever the sources claim to be.
+ *
+ * Two token buckets stand between an error and its construction: one per
+ * ICMP type, bounding the router's total output, and one per destination,
+ * so a single busy source cannot use up the type's budget for everyone
+ * else.  An error is sent only if both have a token, and then takes one
+ * from each.  Echo replies are not errors and are never limited.
+ *
+ * Buckets count thousandths of a message and refill from sr_clock_now(),
+ * so a check is a few integer operations on the cached clock.  The
+ * per-destination buckets live in a direct-mapped table; a destination
+ * that lands on a slot held by another takes it over with the tokens left
+ * in it, so destinations that collide share a bucket instead of each
+ * refilling it on the way in.
+ *
+ * A rate of 0 turns that bucket off.  The state belongs to the forwarding
+ * thread and takes no lock.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ICMPLIMIT_H
+#define SR_ICMPLIMIT_H
+
+#include <stdint.h>
+
+#include "sr_clock.h"
+
+#define SR_ICMP_LIMIT_DEST_BITS 10
+#define SR_ICMP_LIMIT_DEST_SZ   (1 << SR_ICMP_LIMIT_DEST_BITS)
+
+/* defaults, messages per second and burst */
+#define SR_ICMP_LIMIT_TYPE_RATE  1000
+#define SR_ICMP_LIMIT_TYPE_BURST 100
+#define SR_ICMP_LIMIT_DEST_RATE  10
+#define SR_ICMP_LIMIT_DEST_BURST 10
+
+struct sr_icmp_bucket
+{
+    uint32_t tokens;              /* thousandths of a message */
+    sr_msec_t last;               /* when it was last refilled */
+};
+
+struct sr_icmp_limit
+{
+    /* configuration, set before sr_icmp_limit_init */
+    uint32_t type_rate;           /* per ICMP type, messages per second */
+    uint32_t type_burst;
+    uint32_t dest_rate;           /* per destination */
+    uint32_t dest_burst;
+
+    struct sr_icmp_bucket unreach;   /* icmp_type_dest_unreachable */
+    struct sr_icmp_bucket exceeded;  /* icmp_type_time_exceeded */
+    struct sr_icmp_bucket dest[SR_ICMP_LIMIT_DEST_SZ];  /* by hash of the destination */
+};
+
+/* Fill every bucket; the configuration is left as it is. */
+void sr_icmp_limit_init(struct sr_icmp_limit* lim);
+
+/* 1 if an ICMP message of 'type' to 'dst' (network byte order) may be
+   sent now, taking its tokens; 0 if it is to be suppressed. */
+int sr_icmp_limit_allow(struct sr_icmp_limit* lim, uint8_t type, uint32_t dst);
+
+/* Parse "rate[/burst]" into the two; the burst defaults to the rate.
+   0 on success. */
+int sr_icmp_limit_parse(const char* arg, uint32_t* rate, uint32_t* burst);
+
+#endif /* -- SR_ICMPLIMIT_H -- */
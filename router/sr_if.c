@@ -24,6 +24,7 @@
 
 #include "sr_if.h"
 #include "sr_router.h"
+#include "sr_rt.h"
 
 /*--------------------------------------------------------------------- 
  * Method: sr_get_interface
@@ -54,44 +55,116 @@ struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name)
     return 0;
 } /* -- sr_get_interface -- */
 
-/* Custom method: get interface by specified IP addr
- * modified from the provided 'sr_get_interface' above */
-struct sr_if* sr_get_interface_by_ip(struct sr_instance* sr, uint32_t ip) {
-    struct sr_if* if_walker = 0;
+/*---------------------------------------------------------------------
+ * Local address tables
+ *
+ * Every IP and ARP packet asks whether it is addressed to the router, so
+ * local IPs and MACs are hashed to their interface index rather than
+ * found by walking the list.  Linear probing; the tables are rebuilt from
+ * the interfaces whenever an address is configured, which only happens
+ * at start-up.
+ *
+ *---------------------------------------------------------------------*/
 
-    /* -- REQUIRES -- */
-    assert(ip);
-    assert(sr);
+static unsigned int sr_if_hash32(uint32_t key)
+{
+    return (unsigned int)((key * 0x9e3779b1U) >> (32 - SR_IF_HASH_BITS));
+}
 
-    if_walker = sr->if_list;
+static unsigned int sr_if_hash_mac(const unsigned char* addr)
+{
+    uint32_t key = ((uint32_t)addr[2] << 24 | (uint32_t)addr[3] << 16 |
+                    (uint32_t)addr[4] << 8 | addr[5]) ^
+                   ((uint32_t)addr[0] << 8 | addr[1]);
+    return sr_if_hash32(key);
+}
 
-    while(if_walker) {
-        if(if_walker->ip == ip) {
-            return if_walker;
+static void sr_if_rehash(struct sr_instance* sr)
+{
+    static const unsigned char zero_mac[ETHER_ADDR_LEN];
+    struct sr_if* iface;
+    unsigned int i, h;
+
+    memset(sr->if_by_ip, 0, sizeof(sr->if_by_ip));
+    memset(sr->if_by_mac, 0, sizeof(sr->if_by_mac));
+
+    for(i = 0; i < sr->nifaces; i++)
+    {
+        iface = sr->ifaces[i];
+        if(iface->ip)
+        {
+            for(h = sr_if_hash32(iface->ip); sr->if_by_ip[h].ip;
+                h = (h + 1) & (SR_IF_HASH_SZ - 1))
+            {
+                if(sr->if_by_ip[h].ip == iface->ip)
+                { break; }       /* duplicate address: first one wins */
+            }
+            if(!sr->if_by_ip[h].ip)
+            {
+                sr->if_by_ip[h].ip = iface->ip;
+                sr->if_by_ip[h].index = i;
+            }
+        }
+        if(memcmp(iface->addr, zero_mac, ETHER_ADDR_LEN) != 0)
+        {
+            for(h = sr_if_hash_mac(iface->addr); sr->if_by_mac[h].used;
+                h = (h + 1) & (SR_IF_HASH_SZ - 1))
+            {
+                if(memcmp(sr->if_by_mac[h].addr, iface->addr, ETHER_ADDR_LEN) == 0)
+                { break; }
+            }
+            if(!sr->if_by_mac[h].used)
+            {
+                memcpy(sr->if_by_mac[h].addr, iface->addr, ETHER_ADDR_LEN);
+                sr->if_by_mac[h].used = 1;
+                sr->if_by_mac[h].index = i;
+            }
         }
-        if_walker = if_walker->next;
     }
-    return 0;
+} /* -- sr_if_rehash -- */
+
+unsigned int sr_if_index_by_ip(struct sr_instance* sr, uint32_t ip_nbo)
+{
+    unsigned int h;
+
+    for(h = sr_if_hash32(ip_nbo); sr->if_by_ip[h].ip;
+        h = (h + 1) & (SR_IF_HASH_SZ - 1))
+    {
+        if(sr->if_by_ip[h].ip == ip_nbo)
+        { return sr->if_by_ip[h].index; }
+    }
+    return SR_IF_NONE;
+} /* -- sr_if_index_by_ip -- */
+
+unsigned int sr_if_index_by_mac(struct sr_instance* sr, const unsigned char* addr)
+{
+    unsigned int h;
+
+    for(h = sr_if_hash_mac(addr); sr->if_by_mac[h].used;
+        h = (h + 1) & (SR_IF_HASH_SZ - 1))
+    {
+        if(memcmp(sr->if_by_mac[h].addr, addr, ETHER_ADDR_LEN) == 0)
+        { return sr->if_by_mac[h].index; }
+    }
+    return SR_IF_NONE;
+} /* -- sr_if_index_by_mac -- */
+
+/* Custom method: get interface by specified IP addr */
+struct sr_if* sr_get_interface_by_ip(struct sr_instance* sr, uint32_t ip) {
+    /* -- REQUIRES -- */
+    assert(ip);
+    assert(sr);
+
+    return sr_if_at(sr, sr_if_index_by_ip(sr, ip));
 }
 
-/* Custom method: get interface by specified MAC addr 
- * modified from the provided 'sr_get_interface' above */
+/* Custom method: get interface by specified MAC addr */
 struct sr_if* sr_get_interface_by_mac(struct sr_instance* sr, unsigned char* addr) {
-    struct sr_if* if_walker = 0;
-    
     /* -- REQUIRES -- */
     assert(addr);
     assert(sr);
-    
-    if_walker = sr->if_list;
-    
-    while(if_walker) {
-        if(memcmp(if_walker->addr, addr, ETHER_ADDR_LEN) == 0) {
-            return if_walker;
-        }
-        if_walker = if_walker->next;
-    }
-    return 0;
+
+    return sr_if_at(sr, sr_if_index_by_mac(sr, addr));
 }
 
 /*--------------------------------------------------------------------- 
@@ -102,6 +175,28 @@ struct sr_if* sr_get_interface_by_mac(struct sr_instance* sr, unsigned char* add
  *
  *---------------------------------------------------------------------*/
 
+static void sr_index_interface(struct sr_instance* sr, struct sr_if* iface)
+{
+    /* an interface that could not forward would drop everything routed
+       to it without a word; better not to come up at all */
+    if(iface->index >= SR_IF_MAX)
+    {
+        fprintf(stderr, "Interface %s: the router supports at most %d interfaces\n",
+                iface->name, SR_IF_MAX);
+        exit(1);
+    }
+    sr->ifaces[iface->index] = iface;
+    sr->nifaces = iface->index + 1;
+
+    if(strncmp(iface->name, NAT_INT_INTF, sr_IFACE_NAMELEN) == 0)
+    { sr->nat_int_if = iface; }
+    else if(strncmp(iface->name, NAT_EXT_INTF, sr_IFACE_NAMELEN) == 0)
+    { sr->nat_ext_if = iface; }
+
+    /* routes read before the server told us about the interface */
+    sr_rt_bind_interface(sr, iface);
+} /* -- sr_index_interface -- */
+
 void sr_add_interface(struct sr_instance* sr, const char* name)
 {
     struct sr_if* if_walker = 0;
@@ -113,10 +208,12 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     /* -- empty list special case -- */
     if(sr->if_list == 0)
     {
-        sr->if_list = (struct sr_if*)malloc(sizeof(struct sr_if));
+        sr->if_list = (struct sr_if*)calloc(1, sizeof(struct sr_if));
         assert(sr->if_list);
         sr->if_list->next = 0;
+        sr->if_list->index = 0;
         strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
+        sr_index_interface(sr, sr->if_list);
         return;
     }
 
@@ -125,11 +222,13 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     while(if_walker->next)
     {if_walker = if_walker->next; }
 
-    if_walker->next = (struct sr_if*)malloc(sizeof(struct sr_if));
+    if_walker->next = (struct sr_if*)calloc(1, sizeof(struct sr_if));
     assert(if_walker->next);
+    if_walker->next->index = if_walker->index + 1;
     if_walker = if_walker->next;
     strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
     if_walker->next = 0;
+    sr_index_interface(sr, if_walker);
 } /* -- sr_add_interface -- */ 
 
 /*--------------------------------------------------------------------- 
@@ -153,6 +252,9 @@ void sr_set_ether_addr(struct sr_instance* sr, const unsigned char* addr)
 
     /* -- copy address -- */
     memcpy(if_walker->addr,addr,6);
+    sr_if_rehash(sr);
+    sr_nh_invalidate(sr);   /* cached next hops hold the old source MAC */
+    sr_ctl_build(sr, if_walker);
 
 } /* -- sr_set_ether_addr -- */
 
@@ -177,6 +279,8 @@ void sr_set_ether_ip(struct sr_instance* sr, uint32_t ip_nbo)
 
     /* -- copy address -- */
     if_walker->ip = ip_nbo;
+    sr_if_rehash(sr);
+    sr_ctl_build(sr, if_walker);
 
 } /* -- sr_set_ether_ip -- */
 
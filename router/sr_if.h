@@ -28,6 +28,27 @@
 
 struct sr_instance;
 
+#define SR_IF_MAX  16            /* interfaces; more is a fatal error */
+#define SR_IF_NONE (~0U)         /* index of no interface */
+
+/* open-addressed tables from local IP and MAC to interface index, kept at
+   most a quarter full */
+#define SR_IF_HASH_BITS 6
+#define SR_IF_HASH_SZ   (1 << SR_IF_HASH_BITS)
+
+struct sr_if_ip_slot
+{
+  uint32_t ip;                  /* network byte order, 0 when empty */
+  unsigned int index;
+};
+
+struct sr_if_mac_slot
+{
+  unsigned char addr[ETHER_ADDR_LEN];
+  unsigned char used;
+  unsigned int index;
+};
+
 /* ----------------------------------------------------------------------------
  * struct sr_if
  *
@@ -41,9 +62,16 @@ struct sr_if
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  unsigned int index;           /* position in the list; see sr_if_at() */
   struct sr_if* next;
 };
 
+/* Interfaces are named on the wire and in the routing table file, and
+   resolved to their index once; the packet path goes through the dense
+   sr->ifaces array instead of comparing names.  NULL for SR_IF_NONE. */
+#define sr_if_at(sr, idx) \
+    ((idx) < (sr)->nifaces ? (sr)->ifaces[idx] : (struct sr_if*)0)
+
 struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name);
 void sr_add_interface(struct sr_instance*, const char*);
 void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
@@ -55,4 +83,8 @@ void sr_print_if(struct sr_if*);
 struct sr_if* sr_get_interface_by_ip(struct sr_instance*, uint32_t);
 struct sr_if* sr_get_interface_by_mac(struct sr_instance*, unsigned char*);
 
+/* O(1) through the address tables; SR_IF_NONE if not ours */
+unsigned int sr_if_index_by_ip(struct sr_instance*, uint32_t ip_nbo);
+unsigned int sr_if_index_by_mac(struct sr_instance*, const unsigned char*);
+
 #endif /* --  sr_INTERFACE_H -- */
@@ -23,7 +23,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <pwd.h>
+#include <time.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <sys/signalfd.h>
 
 #ifdef _LINUX_
 #include <getopt.h>
@@ -32,6 +35,12 @@
 #include "sr_dumper.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_replay.h"
+#include "sr_prof.h"
+#include "sr_stats.h"
+#include "sr_admin.h"
+#include "sr_metrics.h"
+#include "sr_shmstats.h"
 
 extern char* optarg;
 
@@ -50,8 +59,6 @@ extern char* optarg;
 #define DEFAULT_ICMP_QUERY_TIMEOUT 60
 #define DEFAULT_TCP_ESTABLISHED_IDLE_TIMEOUT 7440
 #define DEFAULT_TCP_TRANSITORY_IDLE_TIMEOUT 300
-#define MIN_TCP_ESTABLISHED_IDLE_TIMEOUT 7440
-#define MIN_TCP_TRANSITORY_IDLE_TIMEOUT 240
 /*---------------------------------------------*/
 
 static void usage(char* );
@@ -59,6 +66,10 @@ static void sr_init_instance(struct sr_instance* );
 static void sr_destroy_instance(struct sr_instance* );
 static void sr_set_user(struct sr_instance* );
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable);
+static void sr_server_readable(struct sr_event_loop* loop, int fd,
+                               uint32_t events, void* arg);
+static void sr_dump_signal(struct sr_event_loop* loop, int fd,
+                           uint32_t events, void* arg);
 
 /*-----------------------------------------------------------------------------
  *---------------------------------------------------------------------------*/
@@ -71,9 +82,28 @@ int main(int argc, char **argv)
     char *server = DEFAULT_SERVER;
     char *rtable = DEFAULT_RTABLE;
     char *template = NULL;
+    char *rtsnap = 0;
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    int snaplen = PACKET_DUMP_SIZE;
+    unsigned long rotate_mb = 0;
+    unsigned int rotate_secs = 0;
+    int flight_frames = SR_FLIGHT_DEFAULT_FRAMES;
+    char *replay_pcap = 0;
+    char *replay_ifmap = 0;
+    char *replay_ifconf = 0;
+    char *replay_out = 0;
+    int profile = 0;
+    char *admin_path = 0;
+    int metrics_port = 0;
+    char *shm_name = 0;
+    uint32_t icmp_type_rate = SR_ICMP_LIMIT_TYPE_RATE;
+    uint32_t icmp_type_burst = SR_ICMP_LIMIT_TYPE_BURST;
+    uint32_t icmp_dest_rate = SR_ICMP_LIMIT_DEST_RATE;
+    uint32_t icmp_dest_burst = SR_ICMP_LIMIT_DEST_BURST;
+    sigset_t dump_sigs;
+    int dump_fd;
     struct sr_instance sr;
 
     /*-----------NAT COMMAND LINE FLAGS------------*/
@@ -86,7 +116,7 @@ int main(int argc, char **argv)
 
     printf("Using %s\n", VERSION_INFO);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:nI:E:R:")) != EOF)
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:B:l:L:C:G:F:XA:m:S:K:k:P:M:H:O:T:nI:E:R:")) != EOF)
     {
         switch (c)
         {
@@ -112,9 +142,60 @@ int main(int argc, char **argv)
             case 'l':
                 logfile = optarg;
                 break;
+            case 'L':
+                snaplen = atoi((char *) optarg);
+                break;
+            case 'C':
+                rotate_mb = strtoul((char *) optarg, 0, 10);
+                break;
+            case 'G':
+                rotate_secs = atoi((char *) optarg);
+                break;
+            case 'F':
+                flight_frames = atoi((char *) optarg);
+                break;
+            case 'X':
+                profile = 1;
+                break;
+            case 'A':
+                admin_path = optarg;
+                break;
+            case 'm':
+                metrics_port = atoi((char *) optarg);
+                break;
+            case 'S':
+                shm_name = optarg;
+                break;
+            case 'K':
+                if(sr_icmp_limit_parse(optarg, &icmp_type_rate, &icmp_type_burst) != 0) {
+                    fprintf(stderr, "ICMP error limit per type (K) must be rate[/burst].\n");
+                    return -1;
+                }
+                break;
+            case 'k':
+                if(sr_icmp_limit_parse(optarg, &icmp_dest_rate, &icmp_dest_burst) != 0) {
+                    fprintf(stderr, "ICMP error limit per destination (k) must be rate[/burst].\n");
+                    return -1;
+                }
+                break;
+            case 'P':
+                replay_pcap = optarg;
+                break;
+            case 'M':
+                replay_ifmap = optarg;
+                break;
+            case 'H':
+                replay_ifconf = optarg;
+                break;
+            case 'O':
+                replay_out = optarg;
+                break;
             case 'r':
                 rtable = optarg;
                 break;
+            case 'B':
+                rtsnap = optarg;
+                break;
             case 'T':
                 template = optarg;
                 break;
@@ -145,6 +226,8 @@ int main(int argc, char **argv)
 
     /* -- zero out sr instance -- */
     sr_init_instance(&sr);
+    if(rtsnap)
+    { strncpy(sr.rt_snap, rtsnap, sizeof(sr.rt_snap) - 1); }
 
     /* -- set up routing table from file -- */
     if(template == NULL) {
@@ -165,8 +248,9 @@ int main(int argc, char **argv)
     /* -- set up file pointer for logging of raw packets -- */
     if(logfile != 0)
     {
-        sr.logfile = sr_dump_open(logfile,0,PACKET_DUMP_SIZE);
-        if(!sr.logfile)
+        sr.logger = sr_dump_async_open(logfile, snaplen,
+                                       rotate_mb * 1024 * 1024, rotate_secs);
+        if(!sr.logger)
         {
             fprintf(stderr,"Error opening up dump file %s\n",
                     logfile);
@@ -174,25 +258,40 @@ int main(int argc, char **argv)
         }
     }
 
-    Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
-    if(template)
-        Debug("Requesting topology template %s\n", template);
-    else
-        Debug("Requesting topology %d\n", topo);
-
-    /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,port,server) == -1)
+    if(replay_pcap)
     {
-        return 1;
+        /* offline: interfaces come from a file instead of HWINFO */
+        Debug("Replaying %s\n", replay_pcap);
+        if(sr_replay_open(&sr, replay_pcap, replay_ifmap, replay_ifconf,
+                          replay_out) != 0)
+        {
+            return 1;
+        }
+        if(template != NULL)
+        { sr_load_rt_wrap(&sr, rtable); }
     }
+    else
+    {
+        Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
+        if(template)
+            Debug("Requesting topology template %s\n", template);
+        else
+            Debug("Requesting topology %d\n", topo);
+
+        /* connect to server and negotiate session */
+        if(sr_connect_to_server(&sr,port,server) == -1)
+        {
+            return 1;
+        }
 
-    if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
-        Debug("Connected to new instantiation of topology template %s\n", template);
-        sr_load_rt_wrap(&sr, "rtable.vrhost");
-    }
-    else {
-      /* Read from specified routing table */
-      sr_load_rt_wrap(&sr, rtable);
+        if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
+            Debug("Connected to new instantiation of topology template %s\n", template);
+            sr_load_rt_wrap(&sr, "rtable.vrhost");
+        }
+        else {
+          /* Read from specified routing table */
+          sr_load_rt_wrap(&sr, rtable);
+        }
     }
 
     /* NAT config */
@@ -207,17 +306,139 @@ int main(int argc, char **argv)
     sr.nat.tcp_transitory_idle_timeout = tcp_transitory_idle_timeout;
     sr.nat.sr = &sr;
 
+    /* ICMP error rate limits, see sr_icmplimit.h */
+    sr.icmp_limit.type_rate = icmp_type_rate;
+    sr.icmp_limit.type_burst = icmp_type_burst;
+    sr.icmp_limit.dest_rate = icmp_dest_rate;
+    sr.icmp_limit.dest_burst = icmp_dest_burst;
+
     /* call router init (for arp subsystem etc.) */
     sr_init(&sr);
 
+    /* -- flight recorder, dumped on SIGUSR1; counters and stage latency on
+          SIGUSR2; SIGHUP reloads the routing table -- */
+    if(sr_flight_init(&sr.flight, flight_frames > 0 ? flight_frames : 0) != 0)
+    {
+        return 1;
+    }
+    if(profile)
+    {
+#ifndef SR_PROFILE
+        fprintf(stderr, "Warning: built without SR_PROFILE, -X records nothing\n");
+#endif
+        sr_prof_enable();
+    }
+    sigemptyset(&dump_sigs);
+    sigaddset(&dump_sigs, SIGUSR1);
+    sigaddset(&dump_sigs, SIGUSR2);
+    sigaddset(&dump_sigs, SIGHUP);
+    dump_fd = signalfd(-1, &dump_sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(dump_fd < 0 ||
+       sr_ev_add_fd(&sr.evloop, dump_fd, EPOLLIN, sr_dump_signal, &sr) != 0)
+    {
+        perror("signalfd(..):sr_main.c::main(..)");
+        return 1;
+    }
+
+    /* -- control socket, served from its own thread -- */
+    if(admin_path)
+    {
+        sr.admin = sr_admin_open(&sr, admin_path);
+        if(!sr.admin)
+        { return 1; }
+    }
+    if(metrics_port > 0)
+    {
+        sr.metrics = sr_metrics_open(&sr, (unsigned short)metrics_port);
+        if(!sr.metrics)
+        { return 1; }
+    }
+    if(shm_name)
+    {
+        sr.shmstats = sr_shmstats_open(&sr, shm_name, SR_SHMSTATS_PERIOD_MS);
+        if(!sr.shmstats)
+        { return 1; }
+    }
+
+    if(sr.replay)
+    {
+        sr_replay_run(&sr);
+        sr_stats_print(stderr, &sr);
+        if(profile)
+        { sr_prof_dump(stderr); }
+        sr_replay_close(&sr);
+        sr_destroy_instance(&sr);
+        return 0;
+    }
+
     /* -- whizbang main loop ;-) */
-    while( sr_read_from_server(&sr) == 1);
+    if(sr_ev_add_fd(&sr.evloop, sr.sockfd, EPOLLIN, sr_server_readable, &sr) != 0)
+    {
+        return 1;
+    }
+    sr_ev_run(&sr.evloop);
 
     sr_destroy_instance(&sr);
 
     return 0;
 }/* -- main -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_server_readable(..)
+ * Scope: local
+ *
+ * Event loop callback for the server socket: handle one command, and stop
+ * the loop once the session is closed or fails.
+ *---------------------------------------------------------------------------*/
+
+static void sr_server_readable(struct sr_event_loop* loop, int fd,
+                               uint32_t events, void* arg)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+
+    if(sr_read_from_server(sr) != 1)
+    { sr_ev_stop(loop); }
+} /* -- sr_server_readable -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_dump_signal(..)
+ * Scope: local
+ *
+ * Event loop callback for the dump signals.  SIGUSR1 writes the flight
+ * recorder to sr_flight.<unix time>.pcapng in the working directory;
+ * SIGUSR2 prints the counters and stage latency histograms to stderr.
+ * SIGHUP re-reads the routing table file, off the loop.
+ *---------------------------------------------------------------------------*/
+
+static void sr_dump_signal(struct sr_event_loop* loop, int fd,
+                           uint32_t events, void* arg)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct signalfd_siginfo info;
+    char path[64];
+    int n;
+
+    while(read(fd, &info, sizeof(info)) == sizeof(info))
+    {
+        if(info.ssi_signo == SIGHUP)
+        {
+            sr_rt_reload_async(sr);
+            continue;
+        }
+        if(info.ssi_signo == SIGUSR2)
+        {
+            sr_stats_print(stderr, sr);
+            if(sr_prof_enabled)
+            { sr_prof_dump(stderr); }
+            continue;
+        }
+        snprintf(path, sizeof(path), "sr_flight.%ld.pcapng", (long)time(0));
+        n = sr_flight_dump(&sr->flight, path);
+        if(n >= 0)
+        { fprintf(stderr, "Flight recorder: %d frames written to %s\n", n, path); }
+    }
+} /* -- sr_dump_signal -- */
+
 /*-----------------------------------------------------------------------------
  * Method: usage(..)
  * Scope: local
@@ -228,11 +449,20 @@ static void usage(char* argv0)
     printf("Simple Router Client\n");
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
-    printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
+    printf("           [-t topo id] [-r routing table; SIGHUP reloads it] \n");
+    printf("           [-B binary snapshot of the routing table, made or used] \n");
+    printf("           [-l log file] [-L snaplen] \n");
+    printf("           [-C rotate log every N MB] [-G rotate log every N seconds] \n");
+    printf("           [-F flight recorder frames, 0 = off; SIGUSR1 dumps] \n");
+    printf("           [-X profile stage latency; SIGUSR2 dumps it with the counters] \n");
+    printf("           [-A admin socket path] [-m metrics port on 127.0.0.1] \n");
+    printf("           [-S shared memory statistics name, e.g. %s; read with srstat] \n", SR_SHMSTATS_NAME);
+    printf("           [-K ICMP errors per second per type[/burst]] [-k the same per destination; 0 = no limit] \n");
+    printf("           [-P replay pcap -M interface map -H interface config [-O output pcap]] \n");
     printf("           [-I icmp query timeout] [-E tcp established idle timeout] [-R tcp transitory idle timeout] \n");
-    printf("   defaults server=%s port=%d host=%s I=%d E=%d R=%d \n",
-            DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST, DEFAULT_ICMP_QUERY_TIMEOUT, DEFAULT_TCP_ESTABLISHED_IDLE_TIMEOUT, DEFAULT_TCP_TRANSITORY_IDLE_TIMEOUT );
+    printf("   defaults server=%s port=%d host=%s I=%d E=%d R=%d K=%d/%d k=%d/%d \n",
+            DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST, DEFAULT_ICMP_QUERY_TIMEOUT, DEFAULT_TCP_ESTABLISHED_IDLE_TIMEOUT, DEFAULT_TCP_TRANSITORY_IDLE_TIMEOUT,
+            SR_ICMP_LIMIT_TYPE_RATE, SR_ICMP_LIMIT_TYPE_BURST, SR_ICMP_LIMIT_DEST_RATE, SR_ICMP_LIMIT_DEST_BURST );
 } /* -- usage -- */
 
 /*-----------------------------------------------------------------------------
@@ -272,11 +502,31 @@ static void sr_destroy_instance(struct sr_instance* sr)
     /* REQUIRES */
     assert(sr);
 
-    if(sr->logfile)
+    if(sr->admin)
+    {
+        sr_admin_close(sr->admin);
+        sr->admin = 0;
+    }
+    if(sr->metrics)
+    {
+        sr_metrics_close(sr->metrics);
+        sr->metrics = 0;
+    }
+    if(sr->shmstats)
+    {
+        sr_shmstats_close(sr->shmstats);
+        sr->shmstats = 0;
+    }
+
+    if(sr->logger)
     {
-        sr_dump_close(sr->logfile);
+        sr_dump_async_close(sr->logger);
+        sr->logger = 0;
     }
 
+    sr_ev_destroy(&(sr->evloop));
+    sr_flight_destroy(&(sr->flight));
+
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
     */
@@ -291,6 +541,8 @@ static void sr_destroy_instance(struct sr_instance* sr)
 
 static void sr_init_instance(struct sr_instance* sr)
 {
+    sigset_t sigs;
+
     /* REQUIRES */
     assert(sr);
 
@@ -299,8 +551,41 @@ static void sr_init_instance(struct sr_instance* sr)
     sr->host[0] = 0;
     sr->topo_id = 0;
     sr->if_list = 0;
-    sr->routing_table = 0;
-    sr->logfile = 0;
+    sr->nifaces = 0;
+    memset(sr->if_by_ip, 0, sizeof(sr->if_by_ip));
+    memset(sr->if_by_mac, 0, sizeof(sr->if_by_mac));
+    sr->nat_int_if = 0;
+    sr->nat_ext_if = 0;
+    sr->rtable = 0;
+    sr->rt_file[0] = 0;
+    sr->rt_snap[0] = 0;
+    sr->rt_gen = 0;
+    sr->logger = 0;
+    sr->replay = 0;
+    sr->admin = 0;
+    sr->metrics = 0;
+    sr->shmstats = 0;
+    sr_ctl_init(&(sr->ctl));
+    sr_flight_init(&(sr->flight), 0);
+
+    /* SIGUSR1, SIGUSR2 and SIGHUP are taken from a signalfd on the event loop; block
+       them before any helper thread starts so they inherit the mask */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGUSR1);
+    sigaddset(&sigs, SIGUSR2);
+    sigaddset(&sigs, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &sigs, 0);
+
+    /* a client of the admin socket or the metrics endpoint that hangs up
+       before reading its answer must cost only that answer: writes to it
+       fail with EPIPE instead of killing the router */
+    signal(SIGPIPE, SIG_IGN);
+
+    if(sr_ev_init(&(sr->evloop)) != 0)
+    {
+        fprintf(stderr, "Error setting up event loop\n");
+        exit(1);
+    }
 } /* -- sr_init_instance -- */
 
 /*-----------------------------------------------------------------------------
@@ -327,12 +612,12 @@ int sr_verify_routing_table(struct sr_instance* sr)
     /* -- REQUIRES --*/
     assert(sr);
 
-    if( (sr->if_list == 0) || (sr->routing_table == 0))
+    if( (sr->if_list == 0) || (sr->rtable == 0) || (sr->rtable->routes == 0))
     {
         return 999; /* doh! */
     }
 
-    rt_walker = sr->routing_table;
+    rt_walker = sr->rtable->routes;
 
     while(rt_walker)
     {
@@ -355,7 +640,7 @@ int sr_verify_routing_table(struct sr_instance* sr)
 } /* -- sr_verify_routing_table -- */
 
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
-    if(sr_load_rt(sr, rtable) != 0) {
+    if(sr_load_rt(sr, rtable) < 0) {
         fprintf(stderr,"Error setting up routing table from file %s\n",
                 rtable);
         exit(1);
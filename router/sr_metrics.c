@@ -0,0 +1,430 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_metrics.c
+ *
+ * Description:
+ *
+ * Prometheus exporter.  See sr_metrics.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_metrics.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_nat.h"
+#include "sr_stats.h"
+#include "sr_prof.h"
+
+#define SR_METRICS_REQUEST 2048  /* longest request header we read */
+#define SR_METRICS_IO_SECS 5     /* give up on a slow client */
+
+/* latency buckets: 2^k ns for k in [LO, HI], about 128ns to 1s */
+#define SR_METRICS_LE_LO   7
+#define SR_METRICS_LE_HI   30
+
+/*---------------------------------------------------------------------
+ * Exposition format
+ *---------------------------------------------------------------------*/
+
+/* label values from the counter names: runs of anything but [a-z0-9]
+   become one '_', as sr_admin does for its keys */
+static void sr_metrics_label(FILE* out, const char* name)
+{
+    int gap = 0;
+
+    for(; *name; name++)
+    {
+        if(isalnum((unsigned char)*name))
+        {
+            if(gap)
+            { fputc('_', out); }
+            fputc(tolower((unsigned char)*name), out);
+            gap = 0;
+        }
+        else
+        { gap = 1; }
+    }
+}
+
+static void sr_metrics_head(FILE* out, const char* name, const char* type,
+                            const char* help)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void sr_metrics_interfaces(struct sr_metrics* metrics, FILE* out,
+                                  const struct sr_stats* st)
+{
+    static const char* names[4] = {
+        "sr_interface_receive_packets_total", "sr_interface_receive_bytes_total",
+        "sr_interface_transmit_packets_total", "sr_interface_transmit_bytes_total"
+    };
+    static const char* helps[4] = {
+        "Frames received on the interface.", "Bytes received on the interface.",
+        "Frames sent on the interface.", "Bytes sent on the interface."
+    };
+    struct sr_if* iface;
+    const struct sr_stats_iface* i;
+    uint64_t v;
+    int m;
+
+    for(m = 0; m < 4; m++)
+    {
+        sr_metrics_head(out, names[m], "counter", helps[m]);
+        for(iface = metrics->sr->if_list; iface; iface = iface->next)
+        {
+            if(iface->index >= SR_STATS_MAX_IFACES)
+            { continue; }
+            i = &(st->iface[iface->index]);
+            v = m == 0 ? i->rx_packets : m == 1 ? i->rx_bytes :
+                m == 2 ? i->tx_packets : i->tx_bytes;
+            fprintf(out, "%s{interface=\"%s\"} %llu\n", names[m], iface->name,
+                    (unsigned long long)v);
+        }
+    }
+} /* -- sr_metrics_interfaces -- */
+
+static void sr_metrics_tables(FILE* out, const struct sr_stats* st)
+{
+    const double pool = MAX_NAT_PORT - MIN_NAT_PORT + 1;
+    int i;
+
+    sr_metrics_head(out, "sr_nat_lookups_total", "counter",
+                    "NAT table lookups by result.");
+    fprintf(out, "sr_nat_lookups_total{result=\"hit\"} %llu\n"
+            "sr_nat_lookups_total{result=\"miss\"} %llu\n",
+            (unsigned long long)st->counter[sr_stat_nat_hit],
+            (unsigned long long)st->counter[sr_stat_nat_miss]);
+    sr_metrics_head(out, "sr_nat_mappings_created_total", "counter",
+                    "NAT mappings inserted.");
+    fprintf(out, "sr_nat_mappings_created_total %llu\n",
+            (unsigned long long)st->counter[sr_stat_nat_insert]);
+    sr_metrics_head(out, "sr_nat_mappings_expired_total", "counter",
+                    "NAT mappings removed by their idle timer.");
+    fprintf(out, "sr_nat_mappings_expired_total %llu\n",
+            (unsigned long long)st->counter[sr_stat_nat_expire]);
+
+    /* each mapping holds one external port (or ICMP id) of its type */
+    sr_metrics_head(out, "sr_nat_mappings", "gauge",
+                    "NAT mappings in the table by type.");
+    fprintf(out, "sr_nat_mappings{type=\"icmp\"} %lld\n"
+            "sr_nat_mappings{type=\"tcp\"} %lld\n",
+            (long long)st->gauge[sr_gauge_nat_icmp],
+            (long long)st->gauge[sr_gauge_nat_tcp]);
+    sr_metrics_head(out, "sr_nat_held_syns", "gauge",
+                    "Unsolicited inbound SYNs held before a port unreachable.");
+    fprintf(out, "sr_nat_held_syns %lld\n", (long long)st->gauge[sr_gauge_nat_syns]);
+    sr_metrics_head(out, "sr_nat_syn_drops_total", "counter",
+                    "Unsolicited inbound SYNs dropped unanswered by the table's bounds.");
+    fprintf(out, "sr_nat_syn_drops_total %llu\n",
+            (unsigned long long)st->counter[sr_stat_nat_syn_drop]);
+    sr_metrics_head(out, "sr_nat_port_pool_utilization", "gauge",
+                    "Fraction of the external port pool in use by type.");
+    fprintf(out, "sr_nat_port_pool_utilization{type=\"icmp\"} %g\n"
+            "sr_nat_port_pool_utilization{type=\"tcp\"} %g\n",
+            st->gauge[sr_gauge_nat_icmp] / pool,
+            st->gauge[sr_gauge_nat_tcp] / pool);
+
+    sr_metrics_head(out, "sr_arp_lookups_total", "counter",
+                    "ARP cache lookups for outgoing packets by result.");
+    fprintf(out, "sr_arp_lookups_total{result=\"hit\"} %llu\n"
+            "sr_arp_lookups_total{result=\"miss\"} %llu\n",
+            (unsigned long long)st->counter[sr_stat_arp_hit],
+            (unsigned long long)st->counter[sr_stat_arp_miss]);
+    sr_metrics_head(out, "sr_nexthop_cache_lookups_total", "counter",
+                    "Next-hop cache lookups for forwarded packets by result.");
+    fprintf(out, "sr_nexthop_cache_lookups_total{result=\"hit\"} %llu\n"
+            "sr_nexthop_cache_lookups_total{result=\"miss\"} %llu\n",
+            (unsigned long long)st->counter[sr_stat_nh_hit],
+            (unsigned long long)st->counter[sr_stat_nh_miss]);
+    sr_metrics_head(out, "sr_nat_flow_cache_lookups_total", "counter",
+                    "NAT flow cache lookups for TCP packets by result.");
+    fprintf(out, "sr_nat_flow_cache_lookups_total{result=\"hit\"} %llu\n"
+            "sr_nat_flow_cache_lookups_total{result=\"miss\"} %llu\n",
+            (unsigned long long)st->counter[sr_stat_nat_flow_hit],
+            (unsigned long long)st->counter[sr_stat_nat_flow_miss]);
+    sr_metrics_head(out, "sr_icmp_errors_suppressed_total", "counter",
+                    "Router-generated ICMP errors suppressed by rate limiting by type.");
+    fprintf(out, "sr_icmp_errors_suppressed_total{type=\"dest_unreachable\"} %llu\n"
+            "sr_icmp_errors_suppressed_total{type=\"time_exceeded\"} %llu\n",
+            (unsigned long long)st->counter[sr_stat_icmp_unreach_limited],
+            (unsigned long long)st->counter[sr_stat_icmp_exceeded_limited]);
+    sr_metrics_head(out, "sr_arp_queue_drops_total", "counter",
+                    "Packets dropped from the ARP queue unresolved.");
+    fprintf(out, "sr_arp_queue_drops_total %llu\n",
+            (unsigned long long)st->counter[sr_stat_arp_queue_drop]);
+    sr_metrics_head(out, "sr_arp_cache_entries", "gauge",
+                    "Valid ARP cache entries.");
+    fprintf(out, "sr_arp_cache_entries %lld\n",
+            (long long)st->gauge[sr_gauge_arp_entries]);
+    sr_metrics_head(out, "sr_arp_pending_requests", "gauge",
+                    "Next hops with an ARP request outstanding.");
+    fprintf(out, "sr_arp_pending_requests %lld\n",
+            (long long)st->gauge[sr_gauge_arp_requests]);
+    sr_metrics_head(out, "sr_arp_queued_packets", "gauge",
+                    "Packets waiting for ARP resolution.");
+    fprintf(out, "sr_arp_queued_packets %lld\n",
+            (long long)st->gauge[sr_gauge_arp_queued]);
+
+    sr_metrics_head(out, "sr_drops_total", "counter",
+                    "Packets discarded by reason.");
+    for(i = 0; i < sr_drop_nreasons; i++)
+    {
+        fputs("sr_drops_total{reason=\"", out);
+        sr_metrics_label(out, sr_drop_reason_name(i));
+        fprintf(out, "\"} %llu\n", (unsigned long long)st->drops[i]);
+    }
+} /* -- sr_metrics_tables -- */
+
+static void sr_metrics_latency(FILE* out)
+{
+    struct sr_prof_hist* merged;
+    struct sr_prof_hist* h;
+    int c, s, k;
+
+    if(!sr_prof_enabled)
+    { return; }
+
+    merged = (struct sr_prof_hist*)malloc(sr_prof_nclasses * sr_prof_nstages *
+                                          sizeof(struct sr_prof_hist));
+    assert(merged);
+    sr_prof_read(merged);
+
+    sr_metrics_head(out, "sr_stage_latency_seconds", "histogram",
+                    "Packet path latency by packet class and stage.");
+    for(c = 0; c < sr_prof_nclasses; c++)
+    {
+        for(s = 0; s < sr_prof_nstages; s++)
+        {
+            h = &merged[c * sr_prof_nstages + s];
+            if(h->count == 0)
+            { continue; }
+            for(k = SR_METRICS_LE_LO; k <= SR_METRICS_LE_HI; k++)
+            {
+                fprintf(out, "sr_stage_latency_seconds_bucket{class=\"%s\","
+                        "stage=\"%s\",le=\"%g\"} %llu\n",
+                        sr_prof_class_name(c), sr_prof_stage_name(s),
+                        (double)(1UL << k) * 1e-9, (unsigned long long)
+                        sr_prof_count_below_ns(h, (double)(1UL << k)));
+            }
+            fprintf(out, "sr_stage_latency_seconds_bucket{class=\"%s\","
+                    "stage=\"%s\",le=\"+Inf\"} %llu\n",
+                    sr_prof_class_name(c), sr_prof_stage_name(s),
+                    (unsigned long long)h->count);
+            fprintf(out, "sr_stage_latency_seconds_sum{class=\"%s\",stage=\"%s\"} %g\n",
+                    sr_prof_class_name(c), sr_prof_stage_name(s),
+                    sr_prof_cycles_to_ns(h->sum) * 1e-9);
+            fprintf(out, "sr_stage_latency_seconds_count{class=\"%s\",stage=\"%s\"} %llu\n",
+                    sr_prof_class_name(c), sr_prof_stage_name(s),
+                    (unsigned long long)h->count);
+        }
+    }
+    free(merged);
+} /* -- sr_metrics_latency -- */
+
+/*---------------------------------------------------------------------
+ * HTTP
+ *---------------------------------------------------------------------*/
+
+/* A scraper that gave up and closed makes the writes fail with EPIPE
+   (SIGPIPE is ignored, see sr_init_instance); the answer is dropped. */
+static void sr_metrics_reply(int fd, const char* status, const char* body,
+                             size_t len)
+{
+    FILE* out = fdopen(dup(fd), "w");
+
+    if(!out)
+    {
+        perror("fdopen(..):sr_metrics.c::sr_metrics_reply(..)");
+        return;
+    }
+    fprintf(out, "HTTP/1.0 %s\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %lu\r\n"
+            "Connection: close\r\n\r\n", status, (unsigned long)len);
+    fwrite(body, 1, len, out);
+    fclose(out);
+}
+
+/* Read one request and answer it.  Returns 0 when the thread should stop. */
+static int sr_metrics_serve(struct sr_metrics* metrics, int fd)
+{
+    struct pollfd pfd[2];
+    struct timeval tv;
+    char req[SR_METRICS_REQUEST];
+    struct sr_stats st;
+    size_t used = 0;
+    ssize_t n;
+    char* body = 0;
+    size_t len = 0;
+    FILE* out;
+
+    tv.tv_sec = SR_METRICS_IO_SECS;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    req[0] = '\0';
+
+    /* the header is all we need; wait for its blank line */
+    while(!strstr(req, "\r\n\r\n"))
+    {
+        pfd[0].fd = fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = metrics->stop_fd[0];
+        pfd[1].events = POLLIN;
+        n = poll(pfd, 2, SR_METRICS_IO_SECS * 1000);
+        if(n < 0 && errno == EINTR)
+        { continue; }
+        if(pfd[1].revents)
+        {
+            close(fd);
+            return 0;
+        }
+        if(n <= 0)
+        {
+            close(fd);
+            return 1;
+        }
+        n = read(fd, req + used, sizeof(req) - 1 - used);
+        if(n <= 0)
+        {
+            close(fd);
+            return 1;
+        }
+        used += n;
+        req[used] = '\0';
+        if(used == sizeof(req) - 1)
+        { break; }
+    }
+
+    if(strncmp(req, "GET /metrics ", 13) != 0 &&
+       strncmp(req, "GET /metrics?", 13) != 0)
+    {
+        sr_metrics_reply(fd, "404 Not Found", "not found\n", 10);
+        close(fd);
+        return 1;
+    }
+
+    out = open_memstream(&body, &len);
+    assert(out);
+    sr_stats_read(&st);
+    sr_metrics_interfaces(metrics, out, &st);
+    sr_metrics_tables(out, &st);
+    sr_metrics_latency(out);
+    fclose(out);
+
+    sr_metrics_reply(fd, "200 OK", body, len);
+    free(body);
+    close(fd);
+    return 1;
+} /* -- sr_metrics_serve -- */
+
+static void* sr_metrics_main(void* arg)
+{
+    struct sr_metrics* metrics = (struct sr_metrics*)arg;
+    struct pollfd pfd[2];
+    int fd;
+
+    for(;;)
+    {
+        pfd[0].fd = metrics->listen_fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = metrics->stop_fd[0];
+        pfd[1].events = POLLIN;
+        if(poll(pfd, 2, -1) < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            perror("poll(..):sr_metrics.c::sr_metrics_main(..)");
+            break;
+        }
+        if(pfd[1].revents)
+        { break; }
+
+        fd = accept(metrics->listen_fd, 0, 0);
+        if(fd < 0)
+        { continue; }
+        if(!sr_metrics_serve(metrics, fd))
+        { break; }
+    }
+    return 0;
+} /* -- sr_metrics_main -- */
+
+struct sr_metrics* sr_metrics_open(struct sr_instance* sr, unsigned short port)
+{
+    struct sr_metrics* metrics;
+    struct sockaddr_in addr;
+    int on = 1;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    metrics = (struct sr_metrics*)calloc(1, sizeof(struct sr_metrics));
+    assert(metrics);
+    metrics->sr = sr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    metrics->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(metrics->listen_fd < 0)
+    {
+        perror("socket(..):sr_metrics.c::sr_metrics_open(..)");
+        free(metrics);
+        return 0;
+    }
+    setsockopt(metrics->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if(bind(metrics->listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+       listen(metrics->listen_fd, 4) != 0)
+    {
+        perror("bind(..):sr_metrics.c::sr_metrics_open(..)");
+        close(metrics->listen_fd);
+        free(metrics);
+        return 0;
+    }
+    if(pipe(metrics->stop_fd) != 0)
+    {
+        perror("pipe(..):sr_metrics.c::sr_metrics_open(..)");
+        close(metrics->listen_fd);
+        free(metrics);
+        return 0;
+    }
+    if(pthread_create(&(metrics->thread), 0, sr_metrics_main, metrics) != 0)
+    {
+        fprintf(stderr, "Error starting metrics thread\n");
+        close(metrics->stop_fd[0]);
+        close(metrics->stop_fd[1]);
+        close(metrics->listen_fd);
+        free(metrics);
+        return 0;
+    }
+    return metrics;
+} /* -- sr_metrics_open -- */
+
+void sr_metrics_close(struct sr_metrics* metrics)
+{
+    if(!metrics)
+    { return; }
+
+    if(write(metrics->stop_fd[1], "x", 1) != 1)
+    { perror("write(..):sr_metrics.c::sr_metrics_close(..)"); }
+    pthread_join(metrics->thread, 0);
+
+    close(metrics->stop_fd[0]);
+    close(metrics->stop_fd[1]);
+    close(metrics->listen_fd);
+    free(metrics);
+} /* -- sr_metrics_close -- */
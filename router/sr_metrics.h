@@ -0,0 +1,37 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_metrics.h
+ *
+ * Description:
+ *
+ * Prometheus exporter.  A minimal HTTP/1.0 server on a loopback port, run
+ * by its own thread, answers GET /metrics with the text exposition format:
+ * per-interface packets and bytes, NAT and ARP events, drops by reason,
+ * NAT table occupancy and port pool utilization, ARP cache size and queue
+ * depth, and the stage latency histograms when profiling is on.
+ *
+ * Everything comes from sr_stats_read() and sr_prof_read(), which sum the
+ * per-thread blocks; a scrape takes no lock the packet path uses.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_METRICS_H
+#define SR_METRICS_H
+
+#include <pthread.h>
+
+struct sr_instance;
+
+struct sr_metrics
+{
+    struct sr_instance* sr;
+    int listen_fd;
+    int stop_fd[2];               /* pipe; written to stop the thread */
+    pthread_t thread;
+};
+
+/* Listen on 127.0.0.1:'port' and start the thread. Returns NULL on error. */
+struct sr_metrics* sr_metrics_open(struct sr_instance* sr, unsigned short port);
+
+void sr_metrics_close(struct sr_metrics* metrics);
+
+#endif /* -- SR_METRICS_H -- */
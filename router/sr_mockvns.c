@@ -0,0 +1,717 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_mockvns.c
+ *
+ * Description:
+ *
+ * Minimal stand-alone VNS server for end-to-end load tests on one box, in
+ * place of POX/Mininet/lab5.py.  It speaks the vnscommand.h protocol to a
+ * single router over TCP: VNS_AUTH_REQUEST/REPLY/STATUS (any credentials
+ * are accepted), VNSOPEN or VNS_OPEN_TEMPLATE (answered with VNS_RTABLE),
+ * VNSHWINFO and VNSPACKET.
+ *
+ * Once the router has its hardware info the server plays every host on
+ * the topology: it answers the router's ARP requests for any address and
+ * blasts traffic at it over the real socket, either generated ICMP echo
+ * frames or a pcap capture.  Generated frames carry a sequence number and
+ * send time in their payload, so frames coming back (forwarded, or echo
+ * replies) give end-to-end latency through sr_vns_comm.c and the router.
+ *
+ * Topology file, one interface per line (default: the lab topology):
+ *
+ *     <name> <ip> <mac>          e.g. eth1 10.0.1.1 ca:fe:00:00:00:01
+ *
+ * usage: sr_mockvns [-p port] [-t topology] [-r rtable]
+ *                   [-m forward|ping] [-n packets] [-R pps] [-W window]
+ *                   [-P replay.pcap -i iface]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "vnscommand.h"
+
+#define MOCK_DEFAULT_PORT    8888
+#define MOCK_DEFAULT_PACKETS 100000
+#define MOCK_DEFAULT_WINDOW  256
+#define MOCK_MAX_IFACES      16
+#define MOCK_IDLE_MS         2000   /* give up waiting for stragglers */
+#define MOCK_MAGIC           0x534d5631   /* "SMV1" */
+#define MOCK_ECHO_ID         0x4d56
+
+struct mock_iface
+{
+    char name[sr_IFACE_NAMELEN];
+    uint32_t ip;                    /* network byte order */
+    uint8_t mac[ETHER_ADDR_LEN];
+};
+
+/* what rides in the payload of generated frames */
+struct mock_stamp
+{
+    uint32_t magic;
+    uint32_t seq;
+    uint64_t sent_ns;
+} __attribute__ ((packed));
+
+struct mock_frame
+{
+    char iface[sr_IFACE_NAMELEN];
+    unsigned int len;
+    uint8_t* buf;
+};
+
+struct mock
+{
+    int fd;
+    struct mock_iface ifaces[MOCK_MAX_IFACES];
+    int nifaces;
+
+    /* receive buffer for partial messages */
+    uint8_t* rbuf;
+    size_t rlen, rcap;
+
+    /* traffic */
+    struct mock_frame* frames;      /* replay mode */
+    unsigned long nframes;
+    int ping;                       /* echo the router instead of forwarding */
+    unsigned long sent, received, arp_replies;
+    uint64_t last_rx_ns;            /* when traffic last came back */
+    uint32_t* lat_ns;
+};
+
+static uint64_t mock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* host MACs are derived from the host's IP */
+static void mock_host_mac(uint32_t ip, uint8_t* mac)
+{
+    mac[0] = 0x02;
+    mac[1] = 0x00;
+    memcpy(mac + 2, &ip, 4);
+}
+
+/*---------------------------------------------------------------------------
+ * protocol I/O
+ *---------------------------------------------------------------------------*/
+
+static int mock_write(struct mock* m, const void* buf, size_t len)
+{
+    const uint8_t* p = (const uint8_t*)buf;
+
+    while(len > 0)
+    {
+        ssize_t n = write(m->fd, p, len);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            perror("write(..):sr_mockvns.c::mock_write(..)");
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int mock_send_packet(struct mock* m, const char* iface,
+                            const uint8_t* frame, unsigned int len)
+{
+    uint8_t msg[sizeof(c_packet_header) + 2048];
+    c_packet_header* hdr = (c_packet_header*)msg;
+
+    if(len > sizeof(msg) - sizeof(c_packet_header))
+    { return -1; }
+    hdr->mLen = htonl(sizeof(c_packet_header) + len);
+    hdr->mType = htonl(VNSPACKET);
+    memset(hdr->mInterfaceName, 0, sizeof(hdr->mInterfaceName));
+    strncpy(hdr->mInterfaceName, iface, sizeof(hdr->mInterfaceName) - 1);
+    memcpy(msg + sizeof(c_packet_header), frame, len);
+    return mock_write(m, msg, sizeof(c_packet_header) + len);
+}
+
+/* Block until a whole message is buffered, or up to 'timeout_ms' (-1 waits
+   forever). Returns the message (valid until the next call) or NULL. */
+static uint8_t* mock_read_msg(struct mock* m, int timeout_ms, uint32_t* len_out)
+{
+    struct pollfd pfd;
+    uint32_t len;
+    ssize_t n;
+
+    for(;;)
+    {
+        if(m->rlen >= 4)
+        {
+            memcpy(&len, m->rbuf, 4);
+            len = ntohl(len);
+            if(len < sizeof(c_base))
+            {
+                fprintf(stderr, "mockvns: bad message length %u\n", len);
+                exit(1);
+            }
+            if(m->rlen >= len)
+            {
+                *len_out = len;
+                return m->rbuf;
+            }
+        }
+
+        pfd.fd = m->fd;
+        pfd.events = POLLIN;
+        if(poll(&pfd, 1, timeout_ms) <= 0)
+        { return 0; }
+
+        if(m->rcap - m->rlen < 4096)
+        {
+            m->rcap = m->rcap ? m->rcap * 2 : 65536;
+            m->rbuf = (uint8_t*)realloc(m->rbuf, m->rcap);
+            assert(m->rbuf);
+        }
+        n = read(m->fd, m->rbuf + m->rlen, m->rcap - m->rlen);
+        if(n <= 0)
+        {
+            fprintf(stderr, "mockvns: router closed the connection\n");
+            exit(n == 0 ? 0 : 1);
+        }
+        m->rlen += n;
+    }
+}
+
+/* drop the message returned by the last mock_read_msg */
+static void mock_consume(struct mock* m, uint32_t len)
+{
+    memmove(m->rbuf, m->rbuf + len, m->rlen - len);
+    m->rlen -= len;
+}
+
+static uint32_t mock_expect(struct mock* m, uint32_t type)
+{
+    uint32_t len, got;
+    uint8_t* msg = mock_read_msg(m, -1, &len);
+
+    got = ntohl(((c_base*)msg)->mType);
+    if(got != type)
+    {
+        fprintf(stderr, "mockvns: expected message %u, got %u\n", type, got);
+        exit(1);
+    }
+    return len;
+}
+
+/*---------------------------------------------------------------------------
+ * session setup
+ *---------------------------------------------------------------------------*/
+
+static void mock_handshake(struct mock* m, const char* rtable)
+{
+    uint8_t buf[sizeof(c_auth_status) + 64];
+    c_auth_request* req = (c_auth_request*)buf;
+    c_auth_status* status = (c_auth_status*)buf;
+    c_hwinfo hw;
+    uint32_t len, type;
+    uint8_t* msg;
+    int i, n = 0;
+
+    /* authentication: any reply is accepted */
+    req->mLen = htonl(sizeof(c_auth_request) + 8);
+    req->mType = htonl(VNS_AUTH_REQUEST);
+    memcpy(req->salt, "mockvns!", 8);
+    mock_write(m, buf, sizeof(c_auth_request) + 8);
+    mock_consume(m, mock_expect(m, VNS_AUTH_REPLY));
+
+    status->mLen = htonl(sizeof(c_auth_status) + 1);
+    status->mType = htonl(VNS_AUTH_STATUS);
+    status->auth_ok = 1;
+    status->msg[0] = '\0';
+    mock_write(m, buf, sizeof(c_auth_status) + 1);
+
+    /* open: a template open also wants the routing table */
+    msg = mock_read_msg(m, -1, &len);
+    type = ntohl(((c_base*)msg)->mType);
+    if(type == VNS_OPEN_TEMPLATE)
+    {
+        c_open_template* ot = (c_open_template*)msg;
+        char host[IDSIZE + 1];
+        char* body = 0;
+        long blen = 0;
+        c_rtable* rt;
+        FILE* fp;
+
+        memcpy(host, ot->mVirtualHostID, IDSIZE);
+        host[IDSIZE] = '\0';
+        mock_consume(m, len);
+
+        if(rtable && (fp = fopen(rtable, "r")))
+        {
+            fseek(fp, 0, SEEK_END);
+            blen = ftell(fp);
+            fseek(fp, 0, SEEK_SET);
+            body = (char*)malloc(blen);
+            assert(body);
+            if(fread(body, 1, blen, fp) != (size_t)blen)
+            { blen = 0; }
+            fclose(fp);
+        }
+        rt = (c_rtable*)calloc(1, sizeof(c_rtable) + blen);
+        assert(rt);
+        rt->mLen = htonl(sizeof(c_rtable) + blen);
+        rt->mType = htonl(VNS_RTABLE);
+        strncpy(rt->mVirtualHostID, host, IDSIZE);
+        memcpy(rt->rtable, body, blen);
+        mock_write(m, rt, sizeof(c_rtable) + blen);
+        free(rt);
+        free(body);
+    }
+    else if(type == VNSOPEN)
+    { mock_consume(m, len); }
+    else
+    {
+        fprintf(stderr, "mockvns: expected an open, got message %u\n", type);
+        exit(1);
+    }
+
+    /* hardware info, in the order sr_handle_hwinfo expects */
+    memset(&hw, 0, sizeof(hw));
+    for(i = 0; i < m->nifaces; i++)
+    {
+        hw.mHWInfo[n].mKey = htonl(HWINTERFACE);
+        strncpy(hw.mHWInfo[n++].value, m->ifaces[i].name, 31);
+        hw.mHWInfo[n].mKey = htonl(HWETHIP);
+        memcpy(hw.mHWInfo[n++].value, &m->ifaces[i].ip, 4);
+        hw.mHWInfo[n].mKey = htonl(HWETHER);
+        memcpy(hw.mHWInfo[n++].value, m->ifaces[i].mac, ETHER_ADDR_LEN);
+    }
+    len = 2 * sizeof(uint32_t) + n * sizeof(c_hw_entry);
+    hw.mLen = htonl(len);
+    hw.mType = htonl(VNSHWINFO);
+    mock_write(m, &hw, len);
+}
+
+/*---------------------------------------------------------------------------
+ * traffic
+ *---------------------------------------------------------------------------*/
+
+static struct mock_iface* mock_iface_by_name(struct mock* m, const char* name)
+{
+    int i;
+    for(i = 0; i < m->nifaces; i++)
+    {
+        if(strncmp(m->ifaces[i].name, name, sr_IFACE_NAMELEN) == 0)
+        { return &m->ifaces[i]; }
+    }
+    return 0;
+}
+
+/* a host on the first interface pings the router, or a host behind the
+   second interface through it */
+static unsigned int mock_gen_echo(struct mock* m, uint8_t* frame, uint32_t seq)
+{
+    struct mock_iface* in = &m->ifaces[0];
+    struct mock_iface* out = &m->ifaces[m->nifaces > 1 ? 1 : 0];
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)frame;
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)(eth + 1);
+    sr_icmp_hdr_t* icmp = (sr_icmp_hdr_t*)(ip + 1);
+    struct mock_stamp stamp;
+    unsigned int l4_len = sizeof(sr_icmp_hdr_t) + sizeof(stamp) + 16;
+    uint32_t src = htonl(ntohl(in->ip) + 99);   /* e.g. 10.0.1.100 */
+    uint32_t dst = m->ping ? in->ip : htonl(ntohl(out->ip) + 20);
+
+    memset(frame, 0, sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + l4_len);
+    memcpy(eth->ether_dhost, in->mac, ETHER_ADDR_LEN);
+    mock_host_mac(src, eth->ether_shost);
+    eth->ether_type = htons(ethertype_ip);
+
+    ip->ip_v = 4;
+    ip->ip_hl = 5;
+    ip->ip_len = htons(sizeof(sr_ip_hdr_t) + l4_len);
+    ip->ip_ttl = 64;
+    ip->ip_p = ip_protocol_icmp;
+    ip->ip_src = src;
+    ip->ip_dst = dst;
+    ip->ip_sum = cksum(ip, sizeof(sr_ip_hdr_t));
+
+    icmp->icmp_type = icmp_type_echo_request;
+    icmp->icmp_id = htons(MOCK_ECHO_ID);
+    icmp->icmp_seq = htons(seq);
+    stamp.magic = htonl(MOCK_MAGIC);
+    stamp.seq = seq;
+    stamp.sent_ns = mock_ns();
+    memcpy(icmp + 1, &stamp, sizeof(stamp));
+    icmp->icmp_sum = cksum(icmp, l4_len);
+
+    return sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + l4_len;
+}
+
+static void mock_arp_reply(struct mock* m, const char* iface,
+                           const uint8_t* frame, unsigned int len)
+{
+    sr_arp_hdr_t* req = (sr_arp_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+    uint8_t reply[sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t)];
+    sr_ethernet_hdr_t* eth = (sr_ethernet_hdr_t*)reply;
+    sr_arp_hdr_t* arp = (sr_arp_hdr_t*)(eth + 1);
+    uint8_t mac[ETHER_ADDR_LEN];
+
+    if(len < sizeof(reply) || ntohs(req->ar_op) != arp_op_request)
+    { return; }
+
+    mock_host_mac(req->ar_tip, mac);
+    memcpy(eth->ether_dhost, req->ar_sha, ETHER_ADDR_LEN);
+    memcpy(eth->ether_shost, mac, ETHER_ADDR_LEN);
+    eth->ether_type = htons(ethertype_arp);
+    memcpy(arp, req, sizeof(*arp));
+    arp->ar_op = htons(arp_op_reply);
+    memcpy(arp->ar_sha, mac, ETHER_ADDR_LEN);
+    arp->ar_sip = req->ar_tip;
+    memcpy(arp->ar_tha, req->ar_sha, ETHER_ADDR_LEN);
+    arp->ar_tip = req->ar_sip;
+
+    mock_send_packet(m, iface, reply, sizeof(reply));
+    m->arp_replies++;
+}
+
+/* handle one frame the router sent; returns 1 if it was measured traffic */
+static int mock_handle_frame(struct mock* m, const char* iface,
+                             const uint8_t* frame, unsigned int len)
+{
+    const sr_ip_hdr_t* ip;
+    struct mock_stamp stamp;
+    unsigned int off = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) +
+                       sizeof(sr_icmp_hdr_t);
+
+    if(len < sizeof(sr_ethernet_hdr_t))
+    { return 0; }
+    if(ethertype((uint8_t*)frame) == ethertype_arp)
+    {
+        mock_arp_reply(m, iface, frame, len);
+        return 0;
+    }
+    if(ethertype((uint8_t*)frame) != ethertype_ip)
+    { return 0; }
+
+    m->received++;
+    m->last_rx_ns = mock_ns();
+    ip = (const sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+    if(ip->ip_p == ip_protocol_icmp && len >= off + sizeof(stamp))
+    {
+        memcpy(&stamp, frame + off, sizeof(stamp));
+        if(ntohl(stamp.magic) == MOCK_MAGIC && m->lat_ns &&
+           stamp.seq < m->sent)
+        { m->lat_ns[stamp.seq] = (uint32_t)(mock_ns() - stamp.sent_ns); }
+    }
+    return 1;
+}
+
+/* process whatever the router has sent within 'timeout_ms' */
+static int mock_poll(struct mock* m, int timeout_ms)
+{
+    uint32_t len, type;
+    uint8_t* msg;
+    int got = 0;
+
+    while((msg = mock_read_msg(m, got ? 0 : timeout_ms, &len)))
+    {
+        type = ntohl(((c_base*)msg)->mType);
+        if(type == VNSPACKET && len >= sizeof(c_packet_header))
+        {
+            char iface[sr_IFACE_NAMELEN];
+            memset(iface, 0, sizeof(iface));
+            memcpy(iface, ((c_packet_header*)msg)->mInterfaceName, 16);
+            got += mock_handle_frame(m, iface, msg + sizeof(c_packet_header),
+                                     len - sizeof(c_packet_header));
+        }
+        mock_consume(m, len);
+    }
+    return got;
+}
+
+static int mock_cmp(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void mock_run(struct mock* m, unsigned long count, unsigned long rate,
+                     unsigned long window)
+{
+    uint8_t frame[256];
+    uint64_t start, last_progress, now, elapsed;
+    unsigned long measured = 0, i;
+    unsigned int len;
+
+    if(m->frames)
+    { count = m->nframes; }
+    else
+    {
+        m->lat_ns = (uint32_t*)calloc(count, sizeof(uint32_t));
+        assert(m->lat_ns);
+    }
+
+    /* let the router print its tables and settle */
+    mock_poll(m, 200);
+
+    start = last_progress = mock_ns();
+    while(m->sent < count)
+    {
+        now = mock_ns();
+        if(m->sent - m->received < window &&
+           (!rate || (now - start) * rate >= m->sent * 1000000000ULL))
+        {
+            if(m->frames)
+            {
+                struct mock_frame* f = &m->frames[m->sent];
+                mock_send_packet(m, f->iface, f->buf, f->len);
+            }
+            else
+            {
+                len = mock_gen_echo(m, frame, m->sent);
+                mock_send_packet(m, m->ifaces[0].name, frame, len);
+            }
+            m->sent++;
+            if(mock_poll(m, 0))
+            { last_progress = mock_ns(); }
+            continue;
+        }
+        /* window full or rate limited: wait for the router */
+        if(mock_poll(m, 1))
+        { last_progress = mock_ns(); }
+        else if(mock_ns() - last_progress > MOCK_IDLE_MS * 1000000ULL)
+        {
+            /* losses stalled the window; count them and move on */
+            m->received = m->sent;
+            last_progress = mock_ns();
+        }
+    }
+
+    /* drain stragglers; the run ends with the last frame back */
+    while(mock_poll(m, MOCK_IDLE_MS) > 0)
+    { }
+    elapsed = (m->last_rx_ns > start ? m->last_rx_ns : mock_ns()) - start;
+
+    printf("mockvns: sent %lu, received %lu, %lu ARP replies, %.3f s, %.0f pps\n",
+           m->sent, m->received, m->arp_replies, elapsed / 1e9,
+           m->sent / (elapsed / 1e9));
+
+    if(m->lat_ns)
+    {
+        for(i = 0; i < count; i++)
+        {
+            if(m->lat_ns[i])
+            { m->lat_ns[measured++] = m->lat_ns[i]; }
+        }
+        if(measured)
+        {
+            qsort(m->lat_ns, measured, sizeof(uint32_t), mock_cmp);
+            printf("mockvns: latency over %lu frames: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+                   measured, m->lat_ns[measured / 2] / 1e3,
+                   m->lat_ns[measured * 99 / 100] / 1e3,
+                   m->lat_ns[measured - 1] / 1e3);
+        }
+        else
+        { printf("mockvns: no generated frames came back\n"); }
+    }
+}
+
+/*---------------------------------------------------------------------------
+ * configuration
+ *---------------------------------------------------------------------------*/
+
+static void mock_add_iface(struct mock* m, const char* name, const char* ip,
+                           const char* mac)
+{
+    struct mock_iface* ifc;
+    unsigned int b[ETHER_ADDR_LEN];
+    struct in_addr in;
+    int i;
+
+    if(m->nifaces == MOCK_MAX_IFACES || inet_aton(ip, &in) == 0 ||
+       sscanf(mac, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6)
+    {
+        fprintf(stderr, "mockvns: bad interface %s %s %s\n", name, ip, mac);
+        exit(1);
+    }
+    ifc = &m->ifaces[m->nifaces++];
+    strncpy(ifc->name, name, sr_IFACE_NAMELEN - 1);
+    ifc->ip = in.s_addr;
+    for(i = 0; i < ETHER_ADDR_LEN; i++)
+    { ifc->mac[i] = (uint8_t)b[i]; }
+}
+
+static void mock_load_topology(struct mock* m, const char* path)
+{
+    char line[256], name[sr_IFACE_NAMELEN], ip[64], mac[64];
+    FILE* fp;
+
+    if(!path)
+    {
+        /* the lab topology: client on eth1, servers on eth2 */
+        mock_add_iface(m, "eth1", "10.0.1.1", "ca:fe:00:00:00:01");
+        mock_add_iface(m, "eth2", "172.64.3.1", "ca:fe:00:00:00:02");
+        return;
+    }
+    if(!(fp = fopen(path, "r")))
+    {
+        perror(path);
+        exit(1);
+    }
+    while(fgets(line, sizeof(line), fp))
+    {
+        if(sscanf(line, "%31s %63s %63s", name, ip, mac) == 3 && name[0] != '#')
+        { mock_add_iface(m, name, ip, mac); }
+    }
+    fclose(fp);
+    if(m->nifaces == 0)
+    {
+        fprintf(stderr, "mockvns: no interfaces in %s\n", path);
+        exit(1);
+    }
+}
+
+/* frames of a capture in the format sr_dump writes, all sent on 'iface' */
+static void mock_load_pcap(struct mock* m, const char* path, const char* iface)
+{
+    struct pcap_file_hdr { uint32_t magic; uint16_t maj, min; int32_t zone;
+                           uint32_t sigfigs, snaplen, linktype; } fh;
+    struct { uint32_t sec, usec, caplen, len; } rh;
+    unsigned long cap = 0;
+    FILE* fp;
+
+    if(!(fp = fopen(path, "rb")) || fread(&fh, sizeof(fh), 1, fp) != 1 ||
+       fh.magic != 0xa1b2c3d4)
+    {
+        fprintf(stderr, "mockvns: %s is not a pcap file\n", path);
+        exit(1);
+    }
+    while(fread(&rh, sizeof(rh), 1, fp) == 1)
+    {
+        struct mock_frame* f;
+        if(m->nframes == cap)
+        {
+            cap = cap ? cap * 2 : 1024;
+            m->frames = (struct mock_frame*)realloc(m->frames, cap * sizeof(*f));
+            assert(m->frames);
+        }
+        f = &m->frames[m->nframes];
+        f->buf = (uint8_t*)malloc(rh.caplen);
+        assert(f->buf);
+        if(fread(f->buf, 1, rh.caplen, fp) != rh.caplen)
+        {
+            free(f->buf);
+            break;
+        }
+        f->len = rh.caplen;
+        strncpy(f->iface, iface, sr_IFACE_NAMELEN - 1);
+        f->iface[sr_IFACE_NAMELEN - 1] = '\0';
+        m->nframes++;
+    }
+    fclose(fp);
+}
+
+static void mock_usage(const char* argv0)
+{
+    fprintf(stderr, "usage: %s [-p port] [-t topology] [-r rtable]\n", argv0);
+    fprintf(stderr, "       [-m forward|ping] [-n packets] [-R pps] [-W window]\n");
+    fprintf(stderr, "       [-P replay.pcap -i iface]\n");
+}
+
+int main(int argc, char** argv)
+{
+    struct mock m;
+    struct sockaddr_in addr;
+    unsigned short port = MOCK_DEFAULT_PORT;
+    unsigned long count = MOCK_DEFAULT_PACKETS, rate = 0;
+    unsigned long window = MOCK_DEFAULT_WINDOW;
+    const char *topology = 0, *rtable = 0, *pcap = 0, *iface = 0;
+    int c, lfd, one = 1;
+
+    memset(&m, 0, sizeof(m));
+
+    while((c = getopt(argc, argv, "hp:t:r:m:n:R:W:P:i:")) != EOF)
+    {
+        switch(c)
+        {
+            case 'p': port = atoi(optarg); break;
+            case 't': topology = optarg; break;
+            case 'r': rtable = optarg; break;
+            case 'm': m.ping = strcmp(optarg, "ping") == 0; break;
+            case 'n': count = strtoul(optarg, 0, 10); break;
+            case 'R': rate = strtoul(optarg, 0, 10); break;
+            case 'W': window = strtoul(optarg, 0, 10); break;
+            case 'P': pcap = optarg; break;
+            case 'i': iface = optarg; break;
+            default:
+                mock_usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if(window == 0)
+    { window = 1; }
+
+    mock_load_topology(&m, topology);
+    if(pcap)
+    {
+        if(!iface)
+        { iface = m.ifaces[0].name; }
+        if(!mock_iface_by_name(&m, iface))
+        {
+            fprintf(stderr, "mockvns: no interface %s\n", iface);
+            return 1;
+        }
+        mock_load_pcap(&m, pcap, iface);
+    }
+
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, 1) < 0)
+    {
+        perror("mockvns: bind/listen");
+        return 1;
+    }
+    printf("mockvns: waiting for the router on port %u\n", port);
+    fflush(stdout);
+
+    m.fd = accept(lfd, 0, 0);
+    if(m.fd < 0)
+    {
+        perror("mockvns: accept");
+        return 1;
+    }
+    close(lfd);
+    setsockopt(m.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    mock_handshake(&m, rtable);
+    mock_run(&m, count, rate, window);
+
+    {
+        c_close bye;
+        memset(&bye, 0, sizeof(bye));
+        bye.mLen = htonl(sizeof(bye));
+        bye.mType = htonl(VNSCLOSE);
+        strcpy(bye.mErrorMessage, "mockvns: run complete");
+        mock_write(&m, &bye, sizeof(bye));
+    }
+    close(m.fd);
+    return 0;
+}
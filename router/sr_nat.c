@@ -1,5 +1,4 @@
 
-#include <signal.h>
 #include <assert.h>
 #include "sr_nat.h"
 #include <unistd.h>
@@ -7,10 +6,14 @@
 #include <string.h>
 #include "sr_if.h"
 #include "sr_router.h"
+#include "sr_stats.h"
 
 int next_tcp_port = -1;
 int next_icmp_port = -1;
 
+/* all NAT timeouts run on the router's timing wheel */
+#define NAT_TIMERS(nat) (&((nat)->sr->evloop.timers))
+
 int sr_nat_init(struct sr_nat *nat) { /* Initializes the nat */
 
   assert(nat);
@@ -20,19 +23,14 @@ int sr_nat_init(struct sr_nat *nat) { /* Initializes the nat */
   pthread_mutexattr_settype(&(nat->attr), PTHREAD_MUTEX_RECURSIVE);
   int success = pthread_mutex_init(&(nat->lock), &(nat->attr));
 
-  /* Initialize timeout thread */
-
-  pthread_attr_init(&(nat->thread_attr));
-  pthread_attr_setdetachstate(&(nat->thread_attr), PTHREAD_CREATE_JOINABLE);
-  pthread_attr_setscope(&(nat->thread_attr), PTHREAD_SCOPE_SYSTEM);
-  pthread_attr_setscope(&(nat->thread_attr), PTHREAD_SCOPE_SYSTEM);
-  pthread_create(&(nat->thread), &(nat->thread_attr), sr_nat_timeout, nat);
-
   /* CAREFUL MODIFYING CODE ABOVE THIS LINE! */
 
   /* Initialize any variables here */
   nat->mappings = NULL;
-  nat->inbounds = NULL;
+  nat->inbounds = (struct sr_nat_tcp_syn*)calloc(SR_NAT_SYN_BUCKETS * SR_NAT_SYN_WAYS, sizeof(struct sr_nat_tcp_syn));
+  nat->inbound_sources = (uint8_t*)calloc(1 << SR_NAT_SYN_SOURCE_BITS, sizeof(uint8_t));
+  nat->flows = (struct sr_nat_flow*)calloc(SR_NAT_FLOW_SZ, sizeof(struct sr_nat_flow));
+  nat->ext_used = (uint8_t*)calloc(2 * (MAX_NAT_PORT + 1) / 8, sizeof(uint8_t));
   next_tcp_port = MIN_NAT_PORT;
   next_icmp_port = MIN_NAT_PORT;
 
@@ -40,6 +38,19 @@ int sr_nat_init(struct sr_nat *nat) { /* Initializes the nat */
 }
 
 
+/* Slot of the per-source SYN count for a source address */
+static unsigned int sr_nat_syn_source(uint32_t src_ip) {
+  return (unsigned int)((src_ip * 0x9e3779b1U) >> (32 - SR_NAT_SYN_SOURCE_BITS));
+}
+
+/* Empty a held SYN's slot */
+static void sr_nat_syn_release(struct sr_nat *nat, struct sr_nat_tcp_syn *inbound) {
+  sr_timer_cancel(NAT_TIMERS(nat), &(inbound->timer));
+  nat->inbound_sources[sr_nat_syn_source(inbound->ip)]--;
+  inbound->used = 0;
+  SR_STATS_GAUGE(sr_gauge_nat_syns, -1);
+}
+
 int sr_nat_destroy(struct sr_nat *nat) {  /* Destroys the nat (free memory) */
 
   pthread_mutex_lock(&(nat->lock));
@@ -50,63 +61,84 @@ int sr_nat_destroy(struct sr_nat *nat) {  /* Destroys the nat (free memory) */
   while(mapping) {
     struct sr_nat_mapping *mapping_to_destroy = mapping;
     mapping = mapping->next;
-    free(mapping_to_destroy);
+    sr_nat_remove_mapping(nat, mapping_to_destroy);
   }
 
-  /* free linked list structured inbound SYNs */
-  struct sr_nat_tcp_syn *inbound = nat->inbounds;
-  while(inbound){
-    struct sr_nat_tcp_syn *inbound_syn_to_destroy = inbound;
-    inbound = inbound->next;
-    free(inbound_syn_to_destroy);
+  /* disarm the held inbound SYNs, then free their table */
+  int i;
+  for(i = 0; nat->inbounds && i < SR_NAT_SYN_BUCKETS * SR_NAT_SYN_WAYS; i++) {
+    if(nat->inbounds[i].used) {
+      sr_nat_syn_release(nat, &(nat->inbounds[i]));
+    }
   }
+  free(nat->inbounds);
+  free(nat->inbound_sources);
+  nat->inbounds = NULL;
+  nat->inbound_sources = NULL;
+
+  free(nat->flows);
+  nat->flows = NULL;
+  free(nat->ext_used);
+  nat->ext_used = NULL;
 
-  pthread_kill(nat->thread, SIGKILL);
   return pthread_mutex_destroy(&(nat->lock)) &&
     pthread_mutexattr_destroy(&(nat->attr));
 
 }
 
-void *sr_nat_timeout(void *nat_ptr) {  /* Periodic Timeout handling */
-  struct sr_nat *nat = (struct sr_nat *)nat_ptr;
-  while (1) {
-    sleep(1.0);
-    pthread_mutex_lock(&(nat->lock));
-
-    time_t current = time(NULL);
-
-    /* Handle inbound SYNs */
-    struct sr_nat_tcp_syn *prev_inbound = NULL;
-    struct sr_nat_tcp_syn *curr_inbound = nat->inbounds;
-    while(curr_inbound) { /* traverse all inbound SYNs */
-      /* do not respond to unsolicited inbound SYN packet for at least 6 seconds */
-      if(difftime(current, curr_inbound->last_received) > 6) {
-        struct sr_nat_mapping *mapping = sr_nat_lookup_external(nat, curr_inbound->port, nat_mapping_tcp);
-        if(!mapping) {
-          send_icmp_msg(nat->sr, curr_inbound->packet, curr_inbound->len, icmp_type_dest_unreachable, icmp_dest_unreachable_port);
-        }
+/* Idle timeout (seconds) that applies to a mapping: ICMP query timeout, or
+   for TCP the established timeout while any of its connections is
+   established, and the transitory timeout otherwise (opening, closing,
+   closed, or nothing seen yet). */
+static int sr_nat_mapping_idle_timeout(struct sr_nat *nat, struct sr_nat_mapping *mapping) {
+  struct sr_nat_connection *conn;
 
-        /* removing from list */
-        if(prev_inbound) { /* not linked list head */
-          prev_inbound->next = curr_inbound->next;
-          free(curr_inbound->packet);
-          free(curr_inbound);
-          curr_inbound = prev_inbound->next;
-        } else { /* linked list head */
-          nat->inbounds = curr_inbound->next;
-          free(curr_inbound->packet);
-          free(curr_inbound);
-          curr_inbound = nat->inbounds;
-        }
-      } else {
-        prev_inbound = curr_inbound;
-        curr_inbound = curr_inbound->next;
-      }
+  if(mapping->type == nat_mapping_icmp) {
+    return nat->icmp_query_timeout;
+  }
+  for(conn = mapping->conns; conn; conn = conn->next) {
+    if(conn->tcp_state == tcp_established) {
+      return nat->tcp_established_idle_timeout;
     }
+  }
+  return nat->tcp_transitory_idle_timeout;
+}
 
-    pthread_mutex_unlock(&(nat->lock));
+/* Idle timer of a mapping. Packets only refresh last_updated, so the
+   mapping may have been used since the timer was armed: re-arm it for the
+   remainder of its idle timeout in that case, otherwise remove it. */
+static void sr_nat_mapping_timeout(struct sr_timer *timer, void *nat_ptr) {
+  struct sr_nat *nat = (struct sr_nat *)nat_ptr;
+  struct sr_nat_mapping *mapping = sr_timer_entry(timer, struct sr_nat_mapping, timer);
+
+  pthread_mutex_lock(&(nat->lock));
+
+  sr_msec_t idle = sr_clock_now() - mapping->last_updated;
+  sr_msec_t timeout = (sr_msec_t)sr_nat_mapping_idle_timeout(nat, mapping) * 1000;
+  if(idle < timeout) {
+    sr_timer_add(NAT_TIMERS(nat), timer, (unsigned int)(timeout - idle));
+  } else {
+    sr_nat_remove_mapping(nat, mapping);
+    SR_STATS_INC(sr_stat_nat_expire);
   }
-  return NULL;
+
+  pthread_mutex_unlock(&(nat->lock));
+}
+
+/* Hold timer of an unsolicited inbound SYN: answer with ICMP port
+   unreachable unless a mapping for the port appeared meanwhile. */
+static void sr_nat_syn_timeout(struct sr_timer *timer, void *nat_ptr) {
+  struct sr_nat *nat = (struct sr_nat *)nat_ptr;
+  struct sr_nat_tcp_syn *inbound = sr_timer_entry(timer, struct sr_nat_tcp_syn, timer);
+
+  pthread_mutex_lock(&(nat->lock));
+
+  if(!sr_nat_get_mapping(nat, inbound->port, nat_mapping_tcp)) {
+    send_icmp_msg(nat->sr, inbound->hdr, inbound->hdr_len, icmp_type_dest_unreachable, icmp_dest_unreachable_port);
+  }
+  sr_nat_syn_release(nat, inbound);
+
+  pthread_mutex_unlock(&(nat->lock));
 }
 
 /* Get the mapping associated with given external port.
@@ -123,6 +155,7 @@ struct sr_nat_mapping *sr_nat_lookup_external(struct sr_nat *nat,
   while(mapping) {
     /* traverse the linked list structured mapping table */
     if(mapping->aux_ext == aux_ext && mapping->type == type) {
+      mapping->last_updated = sr_clock_now(); /* a lookup means the mapping is in use */
       copy = (struct sr_nat_mapping*)malloc(sizeof(struct sr_nat_mapping));
       memcpy(copy, mapping, sizeof(struct sr_nat_mapping));
       break;
@@ -148,6 +181,7 @@ struct sr_nat_mapping *sr_nat_lookup_internal(struct sr_nat *nat,
   while(mapping) {
     /* traverse the linked list structured mapping table */
     if(mapping->ip_int == ip_int && mapping->aux_int == aux_int && mapping->type == type) {
+      mapping->last_updated = sr_clock_now(); /* a lookup means the mapping is in use */
       copy = (struct sr_nat_mapping*)malloc(sizeof(struct sr_nat_mapping));
       memcpy(copy, mapping, sizeof(struct sr_nat_mapping));
       break;
@@ -159,6 +193,32 @@ struct sr_nat_mapping *sr_nat_lookup_internal(struct sr_nat *nat,
   return copy;
 }
 
+/* Bit of ext_used for an external port or id of 'type' */
+#define SR_NAT_EXT_BIT(type, aux) ((type) == nat_mapping_icmp ? (MAX_NAT_PORT + 1) + (aux) : (aux))
+
+/* The next external port or id of 'type' no mapping holds, from where the
+   last one left off, or -1 if every one in [MIN_NAT_PORT, MAX_NAT_PORT]
+   is taken. Caller holds nat->lock. */
+static int sr_nat_alloc_ext(struct sr_nat *nat, sr_nat_mapping_type type) {
+  int *next = type == nat_mapping_icmp ? &next_icmp_port : &next_tcp_port;
+  unsigned int bit;
+  int tries, aux;
+
+  for(tries = 0; tries <= MAX_NAT_PORT - MIN_NAT_PORT; tries++) {
+    aux = (*next)++;
+    if(*next > MAX_NAT_PORT) {
+      *next = MIN_NAT_PORT;
+    }
+    /* a long-lived mapping may still hold it from the last time round */
+    bit = SR_NAT_EXT_BIT(type, aux);
+    if(!(nat->ext_used[bit / 8] & (1 << (bit % 8)))) {
+      nat->ext_used[bit / 8] |= 1 << (bit % 8);
+      return aux;
+    }
+  }
+  return -1;
+}
+
 /* Insert a new mapping into the nat's mapping table.
    Actually returns a copy to the new mapping, for thread safety.
  */
@@ -170,38 +230,45 @@ struct sr_nat_mapping *sr_nat_insert_mapping(struct sr_nat *nat,
   /* handle insert here, create a mapping, and then return a copy of it */
   struct sr_nat_mapping *copy = NULL; /* the retured map entry */
   struct sr_nat_mapping *mapping = NULL;
+  int aux_ext;
 
   /* do not insert the duplicate if this mapping is already existed */
   mapping = sr_nat_lookup_internal(nat, ip_int, aux_int, type);
   if(mapping) {
+    pthread_mutex_unlock(&(nat->lock));
     return mapping;
   }
 
+  /* assign aux_ext (TCP external port, or ICMP ID) in increasing order,
+     skipping those still in use */
+  aux_ext = sr_nat_alloc_ext(nat, type);
+  if(aux_ext < 0) {
+    pthread_mutex_unlock(&(nat->lock));
+    return NULL;
+  }
+
   /* construct the mapping */
   mapping = (struct sr_nat_mapping*)malloc(sizeof(struct sr_nat_mapping));
   mapping->type = type;
   mapping->ip_int = ip_int;
   mapping->ip_ext = 0; /* assign external IP addr later */
   mapping->aux_int = aux_int;
-  mapping->last_updated = time(NULL);
+  mapping->aux_ext = (uint16_t)aux_ext;
+  mapping->last_updated = sr_clock_now();
   mapping->conns = NULL;
-  /* assign aux_ext in increasing order */
-  if(type == nat_mapping_icmp) { /* ICMP: aux_ext is ICMP ID */  
-    mapping->aux_ext = next_icmp_port++;
-    if(next_icmp_port > MAX_NAT_PORT) {
-      next_icmp_port = MIN_NAT_PORT;
-    }
-  } else if(type == nat_mapping_tcp) { /* TCP: aux_ext is TCP external port number */
-    mapping->aux_ext = next_tcp_port++;
-    if(next_tcp_port > MAX_NAT_PORT) {
-      next_tcp_port = MIN_NAT_PORT;
-    }
-  }
+  sr_timer_init(&(mapping->timer), sr_nat_mapping_timeout, nat);
+  sr_timer_add(NAT_TIMERS(nat), &(mapping->timer), sr_nat_mapping_idle_timeout(nat, mapping) * 1000);
 
   /* insert the constructed map entry to the head of the mapping table */
   /* in this case, it is unrelated whether the original mapping table is NULL */
+  mapping->prev = NULL;
   mapping->next = nat->mappings;
+  if(nat->mappings) {
+    nat->mappings->prev = mapping;
+  }
   nat->mappings = mapping;
+  SR_STATS_INC(sr_stat_nat_insert);
+  SR_STATS_GAUGE(type == nat_mapping_icmp ? sr_gauge_nat_icmp : sr_gauge_nat_tcp, 1);
 
   copy = (struct sr_nat_mapping*)malloc(sizeof(struct sr_nat_mapping));
   memcpy(copy, mapping, sizeof(struct sr_nat_mapping));
@@ -210,49 +277,77 @@ struct sr_nat_mapping *sr_nat_insert_mapping(struct sr_nat *nat,
   return copy;
 }
 
+/* Clear the flow cache entries that still point at a connection about to
+   be freed; slots since taken by another flow are left as they are */
+static void sr_nat_flow_forget(struct sr_nat *nat, struct sr_nat_connection *conn) {
+  int dir;
+
+  for(dir = nat_flow_out; dir <= nat_flow_in; dir++) {
+    if(conn->flow[dir] && nat->flows[conn->flow[dir] - 1].conn == conn) {
+      nat->flows[conn->flow[dir] - 1].valid = 0;
+    }
+  }
+}
+
 /* Custom: remove a map entry from NAT's mapping table */
-void sr_nat_remove_mapping(struct sr_nat *nat, struct sr_nat_mapping *curr_mapping, struct sr_nat_mapping *prev_mapping) {
-  
+void sr_nat_remove_mapping(struct sr_nat *nat, struct sr_nat_mapping *curr_mapping) {
+  unsigned int bit;
+
   pthread_mutex_lock(&(nat->lock));
 
   /* remove this map entry from the linked list structured mapping table */
-  if(!prev_mapping) {
+  if(!curr_mapping->prev) {
     nat->mappings = curr_mapping->next;
   } else {
-    prev_mapping->next = curr_mapping->next;
+    curr_mapping->prev->next = curr_mapping->next;
   }
+  if(curr_mapping->next) {
+    curr_mapping->next->prev = curr_mapping->prev;
+  }
+  sr_timer_cancel(NAT_TIMERS(nat), &(curr_mapping->timer));
+  bit = SR_NAT_EXT_BIT(curr_mapping->type, curr_mapping->aux_ext);
+  nat->ext_used[bit / 8] &= ~(1 << (bit % 8)); /* its port is free again */
+  SR_STATS_GAUGE(curr_mapping->type == nat_mapping_icmp ? sr_gauge_nat_icmp : sr_gauge_nat_tcp, -1);
 
   /* destroy all associated connections, then destroy this map entry */
   struct sr_nat_connection *conn = curr_mapping->conns;
   while(conn) {
+    struct sr_nat_connection *next_conn = conn->next;
+    sr_nat_flow_forget(nat, conn);
     free(conn);
-    conn = conn->next;
+    conn = next_conn;
   }
   free(curr_mapping);
 
   pthread_mutex_unlock(&(nat->lock));
 }
 
-/* Custom: get a connection from the mapping's connection table */
-struct sr_nat_connection *sr_nat_get_conn(struct sr_nat_mapping *mapping, uint32_t ip) {
-  
-  /* pthread_mutex_lock(&(nat->lock)); */
+/* Custom: get the mapping itself for an external port; caller holds nat->lock */
+struct sr_nat_mapping *sr_nat_get_mapping(struct sr_nat *nat, uint16_t aux_ext, sr_nat_mapping_type type) {
+  struct sr_nat_mapping *mapping = nat->mappings;
 
-  struct sr_nat_connection *copy = NULL;
+  while(mapping) {
+    if(mapping->aux_ext == aux_ext && mapping->type == type) {
+      return mapping;
+    }
+    mapping = mapping->next;
+  }
+  return NULL;
+}
+
+/* Custom: get a connection from the mapping's connection table.
+   Returns the connection itself, so state changes stick; caller holds nat->lock */
+struct sr_nat_connection *sr_nat_get_conn(struct sr_nat_mapping *mapping, uint32_t ip) {
   struct sr_nat_connection *conn = mapping->conns;
 
   /* traverse all associated connections */
   while(conn) {
     if(conn->ip == ip) {
-      copy = (struct sr_nat_connection*)malloc(sizeof(struct sr_nat_connection));
-      memcpy(copy, conn, sizeof(struct sr_nat_connection));
-      break;
+      return conn;
     }
     conn = conn->next; /* linked list structure */
   }
-
-  /* pthread_mutex_unlock(&(nat->lock)); */
-  return copy;
+  return NULL;
 }
 
 /* Custom: insert a connection to the mapping's connection table */
@@ -265,7 +360,7 @@ struct sr_nat_connection *sr_nat_add_conn(struct sr_nat_mapping *mapping, uint32
   memset(conn, 0, sizeof(struct sr_nat_connection));
   conn->ip = ip;
   conn->tcp_state = tcp_closed;
-  conn->last_updated = time(NULL);
+  conn->last_updated = sr_clock_now();
 
   /* insert this connection to the head of mapping's connection table */
   /* in this case, it is unrelated whether the original connection table is NULL */
@@ -288,35 +383,357 @@ void sr_nat_remove_conn(struct sr_nat *nat, struct sr_nat_mapping *mapping, stru
     prev_conn->next = curr_conn->next;
   }
 
+  sr_nat_flow_forget(nat, curr_conn);
   free(curr_conn);
 
   pthread_mutex_unlock(&(nat->lock));
 }
 
-/* Custom: add the inbound TCP SYN connection */
-void add_inbound_syn(struct sr_nat *nat, uint32_t src_ip, uint16_t src_port, uint8_t *packet, unsigned int len) {
-  struct sr_nat_tcp_syn *inbound = nat->inbounds;
+/* Custom: hold an unsolicited inbound TCP SYN, see sr_nat.h */
+void add_inbound_syn(struct sr_nat *nat, uint32_t src_ip, uint16_t port, uint8_t *packet, unsigned int len) {
+  uint32_t h = ((src_ip * 0x9e3779b1U) ^ port) * 0x85ebca6bU;
+  struct sr_nat_tcp_syn *set = &(nat->inbounds[(h >> (32 - SR_NAT_SYN_BUCKET_BITS)) * SR_NAT_SYN_WAYS]);
+  struct sr_nat_tcp_syn *inbound = NULL;
+  uint8_t *held = &(nat->inbound_sources[sr_nat_syn_source(src_ip)]);
+  sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+  unsigned int hdr_len;
+  int i;
+
+  if(!nat->inbounds || len < sizeof(sr_ethernet_hdr_t) + ICMP_DATA_SIZE) {
+    return;
+  }
+  /* what the ICMP error will quote of it (see send_icmp_msg) */
+  hdr_len = sizeof(sr_ethernet_hdr_t) + ip_hdr->ip_hl * 4 + 8;
+  if(hdr_len < sizeof(sr_ethernet_hdr_t) + ICMP_DATA_SIZE || hdr_len > len) {
+    hdr_len = sizeof(sr_ethernet_hdr_t) + ICMP_DATA_SIZE;
+  }
 
-  /* traverse all inbound SYNs */
-  while(inbound) {
-    /* do not add the duplicate if this SYN is already existed */
-    if((inbound->ip == src_ip) && (inbound->port == src_port)) {
+  for(i = 0; i < SR_NAT_SYN_WAYS; i++) {
+    /* do not add the duplicate if this SYN is already held */
+    if(set[i].used && set[i].ip == src_ip && set[i].port == port) {
       return;
     }
-    inbound = inbound->next;
+    /* an empty slot, or else the oldest */
+    if(!inbound || (inbound->used && (!set[i].used || set[i].last_received < inbound->last_received))) {
+      inbound = &(set[i]);
+    }
+  }
+
+  if(*held >= SR_NAT_SYN_PER_SOURCE) {
+    SR_STATS_INC(sr_stat_nat_syn_drop);
+    return;
+  }
+  if(inbound->used) {
+    sr_nat_syn_release(nat, inbound);
+    SR_STATS_INC(sr_stat_nat_syn_drop);
   }
 
-  /* construct the SYN */
-  inbound = (struct sr_nat_tcp_syn*)malloc(sizeof(struct sr_nat_tcp_syn));
   inbound->ip = src_ip;
-  inbound->port = src_port;
-  inbound->packet = (uint8_t*)malloc(len);
-  memcpy(inbound->packet, packet, len);
-  inbound->len = len;
-  inbound->last_received = time(NULL);
-
-  /* insert this SYN to the head of inbound SYN table */
-  /* in this case, it is unrelated whether the original table is NULL */
-  inbound->next = nat->inbounds;
-  nat->inbounds = inbound;
-}
\ No newline at end of file
+  inbound->port = port;
+  inbound->used = 1;
+  memcpy(inbound->hdr, packet, hdr_len);
+  inbound->hdr_len = (uint8_t)hdr_len;
+  inbound->last_received = sr_clock_now();
+  sr_timer_init(&(inbound->timer), sr_nat_syn_timeout, nat);
+  sr_timer_add(NAT_TIMERS(nat), &(inbound->timer), SR_NAT_UNSOLICITED_SYN_TO * 1000);
+  (*held)++;
+  SR_STATS_GAUGE(sr_gauge_nat_syns, 1);
+}
+
+/* Flow cache slot of a packet's addresses and ports */
+static unsigned int sr_nat_flow_hash(uint32_t src_ip, uint32_t dst_ip, uint32_t ports, sr_nat_flow_dir dir) {
+  uint32_t h = (src_ip * 0x9e3779b1U) ^ dst_ip;
+  h = (h * 0x85ebca6bU) ^ ports ^ dir;
+  return (unsigned int)((h * 0x9e3779b1U) >> (32 - SR_NAT_FLOW_BITS));
+}
+
+/* One's complement sum of the change of a 32-bit field, word by word as
+   stored (the sum does not care about byte order) */
+static uint32_t sr_nat_cksum_diff32(uint32_t from, uint32_t to) {
+  return (~from & 0xffff) + (~from >> 16) + (to & 0xffff) + (to >> 16);
+}
+
+/* Apply a precomputed change to a checksum, RFC 1624 eqn. 3 */
+static uint16_t sr_nat_cksum_adjust(uint16_t sum, uint32_t delta) {
+  uint32_t s = (uint16_t)~sum + delta;
+  s = (s & 0xffff) + (s >> 16);
+  s = (s & 0xffff) + (s >> 16);
+  sum = (uint16_t)~s;
+  return sum ? sum : 0xffff; /* as cksum() writes it */
+}
+
+/* Remember the furthest acknowledgment, and the window with it, from the
+   side that sent a segment with ACK set: where that side would accept a
+   RST. */
+static void sr_nat_tcp_ack(struct sr_nat_connection *conn, int out, sr_tcp_hdr_t *tcp_hdr) {
+  uint32_t ack = ntohl(tcp_hdr->acknowledgment);
+
+  if(!tcp_hdr->ack) {
+    return;
+  }
+  if(out) {
+    if(!(conn->seen & SR_NAT_TCP_ACK_OUT) || (int32_t)(ack - conn->client_ack) >= 0) {
+      conn->client_ack = ack;
+      conn->client_win = ntohs(tcp_hdr->window_size);
+      conn->seen |= SR_NAT_TCP_ACK_OUT;
+    }
+  } else {
+    if(!(conn->seen & SR_NAT_TCP_ACK_IN) || (int32_t)(ack - conn->server_ack) >= 0) {
+      conn->server_ack = ack;
+      conn->server_win = ntohs(tcp_hdr->window_size);
+      conn->seen |= SR_NAT_TCP_ACK_IN;
+    }
+  }
+}
+
+/* 1 if a RST from one side (out: the client) falls where the other side
+   would accept it (RFC 793 3.4, RFC 5961 3): in the window it last
+   acknowledged, or, while that side has acknowledged nothing, carrying the
+   ACK of its SYN. Window scaling is not followed, so the window is the
+   unscaled one and a RST far into a scaled window is not believed. */
+static int sr_nat_tcp_rst_valid(struct sr_nat_connection *conn, int out, sr_tcp_hdr_t *tcp_hdr) {
+  uint32_t seq = ntohl(tcp_hdr->seq);
+  uint32_t ack = ntohl(tcp_hdr->acknowledgment);
+  uint8_t peer_ack = out ? SR_NAT_TCP_ACK_IN : SR_NAT_TCP_ACK_OUT;
+  uint8_t peer_syn = out ? SR_NAT_TCP_SYN_IN : SR_NAT_TCP_SYN_OUT;
+  uint32_t rcv_nxt = out ? conn->server_ack : conn->client_ack;
+  uint32_t rcv_wnd = out ? conn->server_win : conn->client_win;
+
+  if(conn->seen & peer_ack) {
+    return (uint32_t)(seq - rcv_nxt) < (rcv_wnd ? rcv_wnd : 1);
+  }
+  return (conn->seen & peer_syn) && tcp_hdr->ack &&
+    ack == (out ? conn->server_seq : conn->client_seq) + 1;
+}
+
+/* Custom: rewrite an established flow's packet from the flow cache, see sr_nat.h */
+int sr_nat_flow_apply(struct sr_nat *nat, sr_nat_flow_dir dir, uint8_t *packet, unsigned int len) {
+  sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+  sr_tcp_hdr_t *tcp_hdr = (sr_tcp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
+  struct sr_nat_flow *flow;
+  uint32_t ports;
+
+  if(!nat->flows || ip_hdr->ip_p != ip_protocol_tcp || ip_hdr->ip_hl != 5 ||
+     len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_tcp_hdr_t) ||
+     ip_hdr->ip_ttl <= 1) {
+    return 0;
+  }
+  /* segments that can move the connection state always go the full way */
+  if(tcp_hdr->syn || tcp_hdr->fin || tcp_hdr->rst) {
+    return 0;
+  }
+
+  memcpy(&ports, &(tcp_hdr->src_port), sizeof(ports));
+  flow = &(nat->flows[sr_nat_flow_hash(ip_hdr->ip_src, ip_hdr->ip_dst, ports, dir)]);
+  if(!flow->valid || flow->dir != dir ||
+     flow->src_ip != ip_hdr->ip_src || flow->dst_ip != ip_hdr->ip_dst || flow->ports != ports) {
+    return 0;
+  }
+
+  /* the mapping and connection are read by the admin thread's dumps under
+     the lock; uncontended otherwise */
+  pthread_mutex_lock(&(nat->lock));
+  if(flow->conn->tcp_state != tcp_established) {
+    pthread_mutex_unlock(&(nat->lock));
+    return 0;
+  }
+  /* what the mapping lookup and the state machine would have refreshed */
+  flow->mapping->last_updated = sr_clock_now();
+  flow->conn->last_updated = flow->mapping->last_updated;
+  sr_nat_tcp_ack(flow->conn, dir == nat_flow_out, tcp_hdr);
+  pthread_mutex_unlock(&(nat->lock));
+
+  if(dir == nat_flow_out) {
+    ip_hdr->ip_src = flow->new_ip;
+    tcp_hdr->src_port = flow->new_port;
+  } else {
+    ip_hdr->ip_dst = flow->new_ip;
+    tcp_hdr->dst_port = flow->new_port;
+  }
+  ip_hdr->ip_ttl--;
+  ip_hdr->ip_sum = sr_nat_cksum_adjust(ip_hdr->ip_sum, flow->ip_delta);
+  tcp_hdr->checksum = sr_nat_cksum_adjust(tcp_hdr->checksum, flow->tcp_delta);
+  return 1;
+}
+
+/* Custom: cache the rewrite of an established flow, see sr_nat.h */
+void sr_nat_flow_store(struct sr_nat *nat, sr_nat_flow_dir dir, uint8_t *packet,
+  uint32_t new_ip, uint16_t new_port, struct sr_nat_mapping *mapping, struct sr_nat_connection *conn) {
+  sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+  sr_tcp_hdr_t *tcp_hdr = (sr_tcp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
+  struct sr_nat_flow *flow;
+  unsigned int slot;
+  uint32_t ports;
+  uint32_t old_ip;
+  uint16_t old_port;
+
+  if(!nat->flows || ip_hdr->ip_hl != 5) {
+    return;
+  }
+
+  memcpy(&ports, &(tcp_hdr->src_port), sizeof(ports));
+  slot = sr_nat_flow_hash(ip_hdr->ip_src, ip_hdr->ip_dst, ports, dir);
+  flow = &(nat->flows[slot]);
+  conn->flow[dir] = (uint16_t)(slot + 1);
+  flow->src_ip = ip_hdr->ip_src;
+  flow->dst_ip = ip_hdr->ip_dst;
+  flow->ports = ports;
+  flow->dir = dir;
+  flow->new_ip = new_ip;
+  flow->new_port = new_port;
+  flow->mapping = mapping;
+  flow->conn = conn;
+
+  old_ip = dir == nat_flow_out ? ip_hdr->ip_src : ip_hdr->ip_dst;
+  old_port = dir == nat_flow_out ? tcp_hdr->src_port : tcp_hdr->dst_port;
+  /* the address is in the IP header and the TCP pseudo-header; the TTL
+     shares a word with the protocol, and drops by one in its high byte */
+  flow->ip_delta = sr_nat_cksum_diff32(old_ip, new_ip) + htons(0xfeff);
+  flow->tcp_delta = sr_nat_cksum_diff32(old_ip, new_ip) + (uint16_t)~old_port + new_port;
+  flow->valid = 1;
+}
+
+/* Custom: track a TCP segment through its connection's states, see sr_nat.h */
+void sr_nat_tcp_track(struct sr_nat *nat, struct sr_nat_mapping *mapping, struct sr_nat_connection *conn,
+  sr_nat_flow_dir dir, uint8_t *packet, unsigned int len) {
+  sr_ip_hdr_t *ip_hdr = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
+  sr_tcp_hdr_t *tcp_hdr = (sr_tcp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
+  uint32_t seq = ntohl(tcp_hdr->seq);
+  uint32_t ack = ntohl(tcp_hdr->acknowledgment);
+  int out = (dir == nat_flow_out);
+  int before = sr_nat_mapping_idle_timeout(nat, mapping);
+  int after;
+
+  assert(len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_tcp_hdr_t));
+
+  if(tcp_hdr->rst) {
+    /* either end gave up on it: nothing more will be acknowledged. A RST
+       out of the window is a stray or a guess, and changes nothing */
+    if(sr_nat_tcp_rst_valid(conn, out, tcp_hdr)) {
+      conn->tcp_state = tcp_time_wait;
+    }
+  } else if(tcp_hdr->syn) {
+    if(conn->tcp_state == tcp_closed || conn->tcp_state == tcp_time_wait) {
+      /* a new connection, possibly reusing the ports of a closed one */
+      conn->seen = 0;
+      conn->tcp_state = out ? tcp_syn_sent : tcp_syn_received;
+    } else if(conn->tcp_state == tcp_syn_sent && !out) {
+      conn->tcp_state = tcp_syn_received;
+    }
+    if(out) {
+      conn->client_seq = seq;
+      conn->seen |= SR_NAT_TCP_SYN_OUT;
+    } else {
+      conn->server_seq = seq;
+      conn->seen |= SR_NAT_TCP_SYN_IN;
+    }
+  } else {
+    /* the handshake completes with the ACK of the second SYN, from either
+       side (simultaneous open included) */
+    if((conn->tcp_state == tcp_syn_sent || conn->tcp_state == tcp_syn_received) && tcp_hdr->ack &&
+       (conn->seen & (SR_NAT_TCP_SYN_OUT | SR_NAT_TCP_SYN_IN)) == (SR_NAT_TCP_SYN_OUT | SR_NAT_TCP_SYN_IN) &&
+       ack == (out ? conn->server_seq : conn->client_seq) + 1) {
+      conn->tcp_state = tcp_established;
+    }
+
+    /* closing only applies to a connection that was open */
+    if(conn->tcp_state == tcp_established || conn->tcp_state == tcp_fin_wait_1 ||
+       conn->tcp_state == tcp_close_wait || conn->tcp_state == tcp_last_ack) {
+      if(tcp_hdr->fin) {
+        /* a FIN takes the sequence number after the segment's data */
+        unsigned int hdrs = ip_hdr->ip_hl * 4 + (tcp_hdr->offset >> 4) * 4;
+        unsigned int ip_len = ntohs(ip_hdr->ip_len);
+        uint32_t fin_ack = seq + (ip_len > hdrs ? ip_len - hdrs : 0) + 1;
+        if(out) {
+          conn->client_fin = fin_ack;
+          conn->seen |= SR_NAT_TCP_FIN_OUT;
+        } else {
+          conn->server_fin = fin_ack;
+          conn->seen |= SR_NAT_TCP_FIN_IN;
+        }
+      }
+      /* sequence space wraps: "at or past" is a signed difference */
+      if(tcp_hdr->ack) {
+        if(!out && (conn->seen & SR_NAT_TCP_FIN_OUT) && (int32_t)(ack - conn->client_fin) >= 0) {
+          conn->seen |= SR_NAT_TCP_FIN_OUT_ACK;
+        } else if(out && (conn->seen & SR_NAT_TCP_FIN_IN) && (int32_t)(ack - conn->server_fin) >= 0) {
+          conn->seen |= SR_NAT_TCP_FIN_IN_ACK;
+        }
+      }
+
+      if((conn->seen & (SR_NAT_TCP_FIN_OUT_ACK | SR_NAT_TCP_FIN_IN_ACK)) == (SR_NAT_TCP_FIN_OUT_ACK | SR_NAT_TCP_FIN_IN_ACK)) {
+        conn->tcp_state = tcp_time_wait;
+      } else if((conn->seen & (SR_NAT_TCP_FIN_OUT | SR_NAT_TCP_FIN_IN)) == (SR_NAT_TCP_FIN_OUT | SR_NAT_TCP_FIN_IN)) {
+        conn->tcp_state = tcp_last_ack;
+      } else if(conn->seen & SR_NAT_TCP_FIN_OUT) {
+        conn->tcp_state = tcp_fin_wait_1;
+      } else if(conn->seen & SR_NAT_TCP_FIN_IN) {
+        conn->tcp_state = tcp_close_wait;
+      }
+    }
+  }
+
+  if(!tcp_hdr->rst) {
+    sr_nat_tcp_ack(conn, out, tcp_hdr);
+  }
+
+  /* the idle timer only re-arms itself for longer timeouts, so bring it
+     forward when this segment shortened the mapping's */
+  after = sr_nat_mapping_idle_timeout(nat, mapping);
+  if(after < before) {
+    sr_timer_reschedule(NAT_TIMERS(nat), &(mapping->timer), after * 1000);
+  }
+}
+
+/* Custom: copy a range of the mapping table for a dump, see sr_nat.h */
+unsigned int sr_nat_copy_range(struct sr_nat *nat, sr_nat_mapping_type type,
+  uint16_t lo, uint16_t hi, struct sr_nat_mapping **copies) {
+  unsigned int n = 0;
+
+  *copies = NULL;
+
+  pthread_mutex_lock(&(nat->lock));
+
+  struct sr_nat_mapping *mapping;
+  for(mapping = nat->mappings; mapping; mapping = mapping->next) {
+    if(mapping->type != type || mapping->aux_ext < lo || mapping->aux_ext > hi) {
+      continue;
+    }
+
+    struct sr_nat_mapping *copy = (struct sr_nat_mapping*)malloc(sizeof(struct sr_nat_mapping));
+    memcpy(copy, mapping, sizeof(struct sr_nat_mapping));
+    copy->conns = NULL;
+    copy->prev = NULL;
+
+    /* connections come out in reverse order, which does not matter */
+    struct sr_nat_connection *conn;
+    for(conn = mapping->conns; conn; conn = conn->next) {
+      struct sr_nat_connection *conn_copy = (struct sr_nat_connection*)malloc(sizeof(struct sr_nat_connection));
+      memcpy(conn_copy, conn, sizeof(struct sr_nat_connection));
+      conn_copy->next = copy->conns;
+      copy->conns = conn_copy;
+    }
+
+    copy->next = *copies;
+    *copies = copy;
+    n++;
+  }
+
+  pthread_mutex_unlock(&(nat->lock));
+  return n;
+}
+
+/* Custom: free a list made by sr_nat_copy_range */
+void sr_nat_free_copies(struct sr_nat_mapping *copies) {
+  while(copies) {
+    struct sr_nat_mapping *next = copies->next;
+    struct sr_nat_connection *conn = copies->conns;
+    while(conn) {
+      struct sr_nat_connection *next_conn = conn->next;
+      free(conn);
+      conn = next_conn;
+    }
+    free(copies);
+    copies = next;
+  }
+}
@@ -5,6 +5,29 @@
 #include <inttypes.h>
 #include <time.h>
 #include <pthread.h>
+#include "sr_timer.h"
+#include "sr_clock.h"
+#include "sr_protocol.h"
+
+/* do not respond to unsolicited inbound SYNs for at least this long */
+#define SR_NAT_UNSOLICITED_SYN_TO 6
+
+/* Unsolicited inbound SYNs waiting out SR_NAT_UNSOLICITED_SYN_TO are held
+   in a fixed table of SR_NAT_SYN_BUCKETS sets of SR_NAT_SYN_WAYS slots, by
+   source address and external port. A SYN arriving at a full set takes
+   the slot of the set's oldest, and a source may hold at most
+   SR_NAT_SYN_PER_SOURCE of them (counted by a hash of the address, so
+   sources that collide share a limit); SYNs past either bound are dropped
+   without an answer. A flood costs neither memory nor more than a set's
+   worth of work per SYN. */
+#define SR_NAT_SYN_BUCKET_BITS 10
+#define SR_NAT_SYN_BUCKETS (1 << SR_NAT_SYN_BUCKET_BITS)
+#define SR_NAT_SYN_WAYS 4
+#define SR_NAT_SYN_PER_SOURCE 8
+#define SR_NAT_SYN_SOURCE_BITS 12
+/* all the port unreachable answer needs of the SYN: its IP header, options
+   included, and the first 8 bytes of TCP, behind its Ethernet header */
+#define SR_NAT_SYN_HDR_LEN (sizeof(sr_ethernet_hdr_t) + ICMP_QUOTE_MAX)
 
 /* do not use the well-known ports (0 - 1023) */
 #define MIN_NAT_PORT 1024 
@@ -13,6 +36,10 @@
 #define NAT_INT_INTF "eth1"
 #define NAT_EXT_INTF "eth2"
 
+/* lower bounds on the TCP idle timeouts (seconds), RFC 5382 */
+#define MIN_TCP_ESTABLISHED_IDLE_TIMEOUT 7440
+#define MIN_TCP_TRANSITORY_IDLE_TIMEOUT 240
+
 typedef enum {
   nat_mapping_icmp,
   nat_mapping_tcp
@@ -33,13 +60,31 @@ typedef enum {
   tcp_closed,
 } sr_tcp_connection_state;
 
+/* what a connection has seen so far, sr_nat_connection.seen */
+#define SR_NAT_TCP_SYN_OUT     0x01 /* from the client (inside) */
+#define SR_NAT_TCP_SYN_IN      0x02 /* from the server (outside) */
+#define SR_NAT_TCP_FIN_OUT     0x04
+#define SR_NAT_TCP_FIN_IN      0x08
+#define SR_NAT_TCP_FIN_OUT_ACK 0x10 /* the client's FIN acknowledged */
+#define SR_NAT_TCP_FIN_IN_ACK  0x20
+#define SR_NAT_TCP_ACK_OUT     0x40 /* client_ack and client_win are set */
+#define SR_NAT_TCP_ACK_IN      0x80
+
 struct sr_nat_connection {
   /* add TCP connection state data members here */
   uint32_t ip; /* external server IP */
   uint32_t client_seq; /* client sequence number */
   uint32_t server_seq; /* server sequence number */
+  uint32_t client_fin; /* acknowledgment number covering the client's FIN */
+  uint32_t server_fin;
+  uint32_t client_ack; /* furthest acknowledgment from the client */
+  uint32_t server_ack;
+  uint16_t client_win; /* window the client last advertised, unscaled */
+  uint16_t server_win;
+  uint16_t flow[2]; /* flow cache slot + 1 by sr_nat_flow_dir, 0 if none */
+  uint8_t seen; /* SR_NAT_TCP_* */
   sr_tcp_connection_state tcp_state;
-  time_t last_updated;
+  sr_msec_t last_updated; /* monotonic ms, see sr_clock.h */
   struct sr_nat_connection *next; /* linked list structure */
 };
 
@@ -51,24 +96,61 @@ struct sr_nat_mapping {
   uint32_t ip_ext; /* external ip addr */
   uint16_t aux_int; /* internal port or icmp id */
   uint16_t aux_ext; /* external port or icmp id */
-  time_t last_updated; /* use to timeout mappings */
+  sr_msec_t last_updated; /* use to timeout mappings (monotonic ms) */
   struct sr_nat_connection *conns; /* list of connections. null for ICMP */
+  struct sr_timer timer; /* idle timeout, re-armed lazily from last_updated */
+  struct sr_nat_mapping *prev; /* doubly linked so expiry unlinks in O(1) */
   struct sr_nat_mapping *next; /* linked list structure */
 };
 
 struct sr_nat_tcp_syn {
-  uint32_t ip;
-  uint16_t port;
-  uint8_t *packet;
-  unsigned int len;
-  time_t last_received;
-  struct sr_nat_tcp_syn *next;
+  uint32_t ip; /* source, network byte order */
+  uint16_t port; /* external port it was sent to, host byte order */
+  uint8_t used;
+  uint8_t hdr[SR_NAT_SYN_HDR_LEN]; /* the frame, cut short */
+  uint8_t hdr_len; /* of it held in hdr */
+  sr_msec_t last_received; /* monotonic ms */
+  struct sr_timer timer; /* fires SR_NAT_UNSOLICITED_SYN_TO after arrival */
+};
+
+/* Established TCP flows, each with the rewrite its packets get worked out
+   in advance: the new address and port, and how both checksums change
+   (RFC 1624), TTL decrement included. A packet of such a flow is rewritten
+   from here in a few instructions; SYN, FIN and RST segments, and anything
+   not found, take the full path through the connection state machine.
+   Entries point into the mapping table; each connection remembers the
+   slots it was stored in, and freeing it (or its mapping) clears those
+   that still point at it, leaving the rest of the cache alone. Like the
+   table's other writers, the cache belongs to the forwarding thread. */
+#define SR_NAT_FLOW_BITS 12
+#define SR_NAT_FLOW_SZ (1 << SR_NAT_FLOW_BITS) /* direct mapped */
+
+typedef enum {
+  nat_flow_out, /* inside to outside: source rewritten */
+  nat_flow_in   /* outside to inside: destination rewritten */
+} sr_nat_flow_dir;
+
+struct sr_nat_flow {
+  uint32_t src_ip; /* key: the packet as received, network byte order */
+  uint32_t dst_ip;
+  uint32_t ports; /* source and destination port, as on the wire */
+  uint32_t new_ip; /* replaces ip_src going out, ip_dst coming in */
+  uint16_t new_port; /* network byte order */
+  uint8_t dir;
+  uint8_t valid;
+  uint32_t ip_delta; /* one's complement sums to add to the checksums */
+  uint32_t tcp_delta;
+  struct sr_nat_mapping *mapping;
+  struct sr_nat_connection *conn;
 };
 
 struct sr_nat {
   /* add any fields here */
   struct sr_nat_mapping *mappings;
-  struct sr_nat_tcp_syn *inbounds;
+  struct sr_nat_tcp_syn *inbounds; /* SR_NAT_SYN_BUCKETS * SR_NAT_SYN_WAYS */
+  uint8_t *inbound_sources; /* SYNs held per source address hash */
+  struct sr_nat_flow *flows; /* SR_NAT_FLOW_SZ of them */
+  uint8_t *ext_used; /* bit per external port (TCP) or id (ICMP) mapped, by type */
 
   int icmp_query_timeout;
   int tcp_established_idle_timeout;
@@ -78,14 +160,11 @@ struct sr_nat {
   /* threading */
   pthread_mutex_t lock;
   pthread_mutexattr_t attr;
-  pthread_attr_t thread_attr;
-  pthread_t thread;
 };
 
 
 int   sr_nat_init(struct sr_nat *nat);     /* Initializes the nat */
 int   sr_nat_destroy(struct sr_nat *nat);  /* Destroys the nat (free memory) */
-void *sr_nat_timeout(void *nat_ptr);  /* Periodic Timout */
 
 /* Get the mapping associated with given external port.
    You must free the returned structure if it is not NULL. */
@@ -97,17 +176,60 @@ struct sr_nat_mapping *sr_nat_lookup_external(struct sr_nat *nat,
 struct sr_nat_mapping *sr_nat_lookup_internal(struct sr_nat *nat,
   uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type );
 
-/* Insert a new mapping into the nat's mapping table.
+/* Insert a new mapping into the nat's mapping table, on an external port
+   (or ICMP id) no other mapping of its type holds. NULL if all of
+   [MIN_NAT_PORT, MAX_NAT_PORT] are taken.
    You must free the returned structure if it is not NULL. */
 struct sr_nat_mapping *sr_nat_insert_mapping(struct sr_nat *nat,
   uint32_t ip_int, uint16_t aux_int, sr_nat_mapping_type type );
 
 /* Custom */
-void sr_nat_remove_mapping(struct sr_nat *nat, struct sr_nat_mapping *curr_mapping, struct sr_nat_mapping *prev_mapping);
+void sr_nat_remove_mapping(struct sr_nat *nat, struct sr_nat_mapping *mapping);
+/* Get the mapping itself (not a copy) for a given external port.
+   nat->lock must be held while the result is used. */
+struct sr_nat_mapping *sr_nat_get_mapping(struct sr_nat *nat, uint16_t aux_ext, sr_nat_mapping_type type);
+/* Get a connection of a mapping returned by sr_nat_get_mapping.
+   nat->lock must be held while the result is used. */
 struct sr_nat_connection *sr_nat_get_conn(struct sr_nat_mapping *mapping, uint32_t ip);
 struct sr_nat_connection *sr_nat_add_conn(struct sr_nat_mapping *mapping, uint32_t ip);
 void sr_nat_remove_conn(struct sr_nat *nat, struct sr_nat_mapping *mapping, struct sr_nat_connection *curr_conn, struct sr_nat_connection *prev_conn);
-void add_inbound_syn(struct sr_nat *nat, uint32_t src_ip, uint16_t src_port, uint8_t *packet, unsigned int len);
+/* Hold an unsolicited SYN (Ethernet frame) from src_ip to external 'port'
+   (host byte order), see SR_NAT_SYN_BUCKETS. */
+void add_inbound_syn(struct sr_nat *nat, uint32_t src_ip, uint16_t port, uint8_t *packet, unsigned int len);
+
+/* Follow a TCP segment (Ethernet frame) of connection 'conn' of the table's
+   own 'mapping' through the RFC 5382 / RFC 793 states, as seen from the
+   middle: SYNs from either side open it, FINs from both sides acknowledged
+   or a RST from either close it (time-wait). A RST counts only if its
+   sequence number is in the window the other side last acknowledged and
+   advertised (or, against a SYN, if it acknowledges that SYN); any other
+   is passed on without touching the state. A connection that stops
+   being established moves its mapping to the transitory idle timeout, so
+   a mapping whose connections have all closed is released once that has
+   passed (RFC 5382 REQ-5: never sooner than 4 minutes, for the peer's own
+   TIME_WAIT). Caller holds nat->lock. */
+void sr_nat_tcp_track(struct sr_nat *nat, struct sr_nat_mapping *mapping, struct sr_nat_connection *conn,
+  sr_nat_flow_dir dir, uint8_t *packet, unsigned int len);
+
+/* Rewrite a TCP packet (Ethernet frame) of an established flow from the
+   flow cache, decrementing the TTL. Returns 1 if it only needs routing now,
+   0 if it must go the full way. The TCP checksum is adjusted, not
+   verified. Takes nat->lock to refresh the mapping and connection. */
+int sr_nat_flow_apply(struct sr_nat *nat, sr_nat_flow_dir dir, uint8_t *packet, unsigned int len);
+/* Remember the rewrite about to be applied to 'packet', a segment of the
+   established connection 'conn' of the table's own 'mapping'. new_ip and
+   new_port are in network byte order. Caller holds nat->lock. */
+void sr_nat_flow_store(struct sr_nat *nat, sr_nat_flow_dir dir, uint8_t *packet,
+  uint32_t new_ip, uint16_t new_port, struct sr_nat_mapping *mapping, struct sr_nat_connection *conn);
+
+/* Copy the mappings of 'type' whose aux_ext is in [lo, hi], connections
+   included, into a new list at *copies. The lock is held for one walk of
+   the table, so dumping it a range at a time never stalls forwarding for
+   longer than a lookup does. Returns the number copied; free the list
+   with sr_nat_free_copies. */
+unsigned int sr_nat_copy_range(struct sr_nat *nat, sr_nat_mapping_type type,
+  uint16_t lo, uint16_t hi, struct sr_nat_mapping **copies);
+void sr_nat_free_copies(struct sr_nat_mapping *copies);
 
 
 #endif
\ No newline at end of file
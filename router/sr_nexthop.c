@@ -0,0 +1,65 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_nexthop.c
+ *
+ * Description:
+ *
+ * Per-destination next-hop cache.  See sr_nexthop.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <assert.h>
+
+#include "sr_nexthop.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+
+static unsigned int sr_nh_hash(uint32_t dst)
+{
+    return (unsigned int)((dst * 0x9e3779b1U) >> (32 - SR_NH_CACHE_BITS));
+}
+
+void sr_nh_init(struct sr_nh_cache* nh)
+{
+    /* -- REQUIRES -- */
+    assert(nh);
+
+    memset(nh, 0, sizeof(*nh));
+}
+
+struct sr_nh_entry* sr_nh_lookup(struct sr_instance* sr, uint32_t dst, uint32_t flow)
+{
+    struct sr_nh_entry* e = &(sr->nh.slot[sr_nh_hash(dst)]);
+
+    if(!e->valid || e->dst != dst ||
+       e->rt_gen != sr->rt_gen || e->arp_gen != sr->cache.gen ||
+       (e->npaths > 1 && sr_rt_pick(flow, e->npaths) != e->path))
+    {
+        sr->nh.miss_rt_gen = sr->rt_gen;
+        sr->nh.miss_arp_gen = sr->cache.gen;
+        /* before the route lookup reads the table pointer */
+        __sync_synchronize();
+        return 0;
+    }
+    return e;
+}
+
+void sr_nh_store(struct sr_instance* sr, uint32_t dst, uint32_t flow, uint32_t npaths,
+                 struct sr_if* iface, const uint8_t* frame)
+{
+    struct sr_nh_entry* e = &(sr->nh.slot[sr_nh_hash(dst)]);
+
+    /* -- REQUIRES -- */
+    assert(iface);
+    assert(frame);
+
+    e->dst = dst;
+    e->rt_gen = sr->nh.miss_rt_gen;
+    e->arp_gen = sr->nh.miss_arp_gen;
+    e->ifindex = iface->index;
+    e->npaths = npaths;
+    e->path = sr_rt_pick(flow, npaths);
+    memcpy(e->eth, frame, sizeof(e->eth));
+    e->valid = 1;
+}
@@ -0,0 +1,76 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_nexthop.h
+ *
+ * Description:
+ *
+ * Per-destination next-hop cache.  Forwarding a packet takes a route
+ * lookup, the route's interface and an ARP lookup under the cache lock;
+ * once all three have succeeded for a destination, the result is kept
+ * here as the egress interface and the twelve bytes of Ethernet addresses
+ * to write, so the next packet to that destination costs one probe and
+ * one memcpy.
+ *
+ * Entries are not flushed when things change.  Each records the routing
+ * generation (sr_instance.rt_gen, bumped when routes or interface
+ * addresses change) and ARP generation (sr_arpcache.gen, bumped on every
+ * insert and expiry) it was resolved under, and is ignored once either
+ * has moved on.  The generations are taken when the lookup misses, before
+ * the route is looked up, so a table swapped in by a reload meanwhile
+ * (sr_rt.h) leaves the entry already stale rather than wrongly current.
+ *
+ * A destination behind equal-cost paths (sr_rt.h) is cached for the path
+ * of the flow that last resolved it; a packet whose flow hash picks
+ * another path misses and takes the slot over.
+ *
+ * The cache belongs to the forwarding thread and takes no lock.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_NEXTHOP_H
+#define SR_NEXTHOP_H
+
+#include <stdint.h>
+
+#include "sr_protocol.h"
+
+struct sr_instance;
+struct sr_if;
+
+#define SR_NH_CACHE_BITS 10
+#define SR_NH_CACHE_SZ   (1 << SR_NH_CACHE_BITS)   /* direct mapped */
+
+struct sr_nh_entry
+{
+    uint32_t dst;                 /* destination IP, network byte order */
+    uint32_t rt_gen;              /* generations it was resolved under */
+    uint32_t arp_gen;
+    unsigned int ifindex;         /* egress interface */
+    uint32_t npaths;              /* equal-cost paths to 'dst' */
+    uint32_t path;                /* which one this is */
+    uint8_t eth[2 * ETHER_ADDR_LEN]; /* ether_dhost then ether_shost */
+    uint8_t valid;
+};
+
+struct sr_nh_cache
+{
+    struct sr_nh_entry slot[SR_NH_CACHE_SZ];
+    uint32_t miss_rt_gen;         /* generations at the last miss */
+    uint32_t miss_arp_gen;
+};
+
+/* Any thread: routes or interface addresses have changed */
+#define sr_nh_invalidate(sr) __sync_add_and_fetch(&((sr)->rt_gen), 1)
+
+void sr_nh_init(struct sr_nh_cache* nh);
+
+/* The resolved next hop for 'dst' and the packet's flow hash, or NULL if
+   it must be looked up. */
+struct sr_nh_entry* sr_nh_lookup(struct sr_instance* sr, uint32_t dst, uint32_t flow);
+
+/* Remember how 'frame' (its Ethernet addresses already filled in) was
+   sent to 'dst' out of 'iface', on the path of 'npaths' its flow picked,
+   after a miss on 'dst'. */
+void sr_nh_store(struct sr_instance* sr, uint32_t dst, uint32_t flow, uint32_t npaths,
+                 struct sr_if* iface, const uint8_t* frame);
+
+#endif /* -- SR_NEXTHOP_H -- */
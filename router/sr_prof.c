@@ -0,0 +1,311 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_prof.c
+ *
+ * Description:
+ *
+ * Per-stage latency histograms.  See sr_prof.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sr_prof.h"
+
+int sr_prof_enabled = 0;
+
+static __thread struct sr_prof_thread* sr_prof_self = 0;
+
+/* every thread's state, for the dump; threads only ever prepend */
+static struct sr_prof_thread* sr_prof_threads = 0;
+static pthread_mutex_t sr_prof_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double sr_prof_cycles_per_ns = 1.0;
+
+static const char* sr_prof_class_names[sr_prof_nclasses] = {
+    "other", "arp", "local", "forward", "nat-out", "nat-in"
+};
+
+static const char* sr_prof_stage_names[sr_prof_nstages] = {
+    "parse", "nat", "lpm", "arp", "cksum", "tx", "total"
+};
+
+static uint64_t sr_prof_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* the TSC where there is one; elsewhere plain nanoseconds */
+static uint64_t sr_prof_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return sr_prof_ns();
+#endif
+}
+
+static void sr_prof_calibrate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec nap;
+    uint64_t c0, c1, n0, n1;
+
+    nap.tv_sec = 0;
+    nap.tv_nsec = 20 * 1000000;
+    n0 = sr_prof_ns();
+    c0 = sr_prof_now();
+    nanosleep(&nap, 0);
+    n1 = sr_prof_ns();
+    c1 = sr_prof_now();
+    if(n1 > n0 && c1 > c0)
+    { sr_prof_cycles_per_ns = (double)(c1 - c0) / (double)(n1 - n0); }
+#endif
+}
+
+/* log-linear bucket: exact below 2^SUB_BITS, then SUB_BITS bits of
+   mantissa per power of two */
+static unsigned int sr_prof_bucket(uint64_t v)
+{
+    unsigned int msb;
+
+    if(v < (1u << SR_PROF_SUB_BITS))
+    { return (unsigned int)v; }
+    msb = 63 - __builtin_clzll(v);
+    return ((msb - SR_PROF_SUB_BITS + 1) << SR_PROF_SUB_BITS) +
+           (unsigned int)((v >> (msb - SR_PROF_SUB_BITS)) &
+                          ((1u << SR_PROF_SUB_BITS) - 1));
+}
+
+/* smallest value that falls in bucket 'b' */
+static uint64_t sr_prof_bucket_value(unsigned int b)
+{
+    unsigned int msb;
+
+    if(b < (1u << SR_PROF_SUB_BITS))
+    { return b; }
+    msb = (b >> SR_PROF_SUB_BITS) + SR_PROF_SUB_BITS - 1;
+    return (uint64_t)((1u << SR_PROF_SUB_BITS) +
+                      (b & ((1u << SR_PROF_SUB_BITS) - 1)))
+           << (msb - SR_PROF_SUB_BITS);
+}
+
+static void sr_prof_hist_add(struct sr_prof_hist* h, uint64_t v)
+{
+    h->count++;
+    h->sum += v;
+    h->bucket[sr_prof_bucket(v)]++;
+    if(v > h->max)
+    { h->max = v; }
+}
+
+static struct sr_prof_thread* sr_prof_thread_get(void)
+{
+    struct sr_prof_thread* t = sr_prof_self;
+
+    if(t)
+    { return t; }
+
+    t = (struct sr_prof_thread*)calloc(1, sizeof(struct sr_prof_thread));
+    assert(t);
+    pthread_mutex_lock(&sr_prof_lock);
+    t->next = sr_prof_threads;
+    sr_prof_threads = t;
+    pthread_mutex_unlock(&sr_prof_lock);
+    sr_prof_self = t;
+    return t;
+} /* -- sr_prof_thread_get -- */
+
+void sr_prof_enable(void)
+{
+    if(!sr_prof_enabled)
+    { sr_prof_calibrate(); }
+    sr_prof_enabled = 1;
+}
+
+void sr_prof_disable(void)
+{
+    sr_prof_enabled = 0;
+}
+
+void sr_prof_begin(void)
+{
+    struct sr_prof_thread* t = sr_prof_thread_get();
+
+    t->active = 1;
+    t->cls = sr_prof_class_other;
+    t->touched = 0;
+    t->start = t->last = sr_prof_now();
+} /* -- sr_prof_begin -- */
+
+void sr_prof_class(enum sr_prof_class cls)
+{
+    struct sr_prof_thread* t = sr_prof_self;
+
+    if(t && t->active)
+    { t->cls = cls; }
+}
+
+void sr_prof_stage(enum sr_prof_stage stage)
+{
+    struct sr_prof_thread* t = sr_prof_self;
+    uint64_t now;
+
+    if(!t || !t->active)
+    { return; }
+    now = sr_prof_now();
+    if(!(t->touched & (1u << stage)))
+    {
+        t->touched |= 1u << stage;
+        t->cycles[stage] = 0;
+    }
+    t->cycles[stage] += now - t->last;
+    t->last = now;
+} /* -- sr_prof_stage -- */
+
+void sr_prof_end(void)
+{
+    struct sr_prof_thread* t = sr_prof_self;
+    struct sr_prof_hist* row;
+    int s;
+
+    if(!t || !t->active)
+    { return; }
+    t->active = 0;
+
+    /* a stage the packet went through twice (two ARP lookups, say) is one
+       sample of the summed time */
+    row = t->hist[t->cls];
+    for(s = 0; s < sr_prof_stage_total; s++)
+    {
+        if(t->touched & (1u << s))
+        { sr_prof_hist_add(&row[s], t->cycles[s]); }
+    }
+    sr_prof_hist_add(&row[sr_prof_stage_total], sr_prof_now() - t->start);
+} /* -- sr_prof_end -- */
+
+double sr_prof_cycles_to_ns(uint64_t cycles)
+{
+    return cycles / sr_prof_cycles_per_ns;
+}
+
+double sr_prof_bucket_ns(unsigned int b)
+{
+    return sr_prof_cycles_to_ns(sr_prof_bucket_value(b));
+}
+
+double sr_prof_percentile_ns(const struct sr_prof_hist* h, double q)
+{
+    uint64_t want = (uint64_t)(q * h->count + 0.5);
+    uint64_t seen = 0;
+    unsigned int b;
+
+    if(want == 0)
+    { want = 1; }
+    for(b = 0; b < SR_PROF_BUCKETS; b++)
+    {
+        seen += h->bucket[b];
+        if(seen >= want)
+        { return sr_prof_bucket_ns(b); }
+    }
+    return sr_prof_cycles_to_ns(h->max);
+}
+
+uint64_t sr_prof_count_below_ns(const struct sr_prof_hist* h, double ns)
+{
+    uint64_t n = 0;
+    unsigned int b;
+
+    for(b = 0; b < SR_PROF_BUCKETS && sr_prof_bucket_ns(b) < ns; b++)
+    { n += h->bucket[b]; }
+    return n;
+}
+
+const char* sr_prof_class_name(enum sr_prof_class cls)
+{
+    return cls < sr_prof_nclasses ? sr_prof_class_names[cls] : "?";
+}
+
+const char* sr_prof_stage_name(enum sr_prof_stage stage)
+{
+    return stage < sr_prof_nstages ? sr_prof_stage_names[stage] : "?";
+}
+
+void sr_prof_read(struct sr_prof_hist* out)
+{
+    struct sr_prof_thread* t;
+    struct sr_prof_hist* h;
+    int c, s;
+    unsigned int b;
+
+    /* -- REQUIRES -- */
+    assert(out);
+
+    memset(out, 0, sr_prof_nclasses * sr_prof_nstages * sizeof(*out));
+
+    /* the owners keep writing while we read; a sample or two of skew
+       between count and buckets does not matter here */
+    pthread_mutex_lock(&sr_prof_lock);
+    for(t = sr_prof_threads; t; t = t->next)
+    {
+        for(c = 0; c < sr_prof_nclasses; c++)
+        {
+            for(s = 0; s < sr_prof_nstages; s++)
+            {
+                h = &out[c * sr_prof_nstages + s];
+                h->count += t->hist[c][s].count;
+                h->sum += t->hist[c][s].sum;
+                if(t->hist[c][s].max > h->max)
+                { h->max = t->hist[c][s].max; }
+                for(b = 0; b < SR_PROF_BUCKETS; b++)
+                { h->bucket[b] += t->hist[c][s].bucket[b]; }
+            }
+        }
+    }
+    pthread_mutex_unlock(&sr_prof_lock);
+} /* -- sr_prof_read -- */
+
+void sr_prof_dump(FILE* fp)
+{
+    struct sr_prof_hist* merged;
+    struct sr_prof_hist* h;
+    int c, s;
+
+    /* -- REQUIRES -- */
+    assert(fp);
+
+    merged = (struct sr_prof_hist*)malloc(sr_prof_nclasses * sr_prof_nstages *
+                                          sizeof(struct sr_prof_hist));
+    assert(merged);
+    sr_prof_read(merged);
+
+    fprintf(fp, "Stage latency (ns, %.2f cycles/ns)%s\n", sr_prof_cycles_per_ns,
+            sr_prof_enabled ? "" : " [profiling off]");
+    fprintf(fp, "%-8s %-6s %10s %8s %8s %8s %8s %10s\n",
+            "class", "stage", "count", "p50", "p90", "p99", "p99.9", "max");
+    for(c = 0; c < sr_prof_nclasses; c++)
+    {
+        for(s = 0; s < sr_prof_nstages; s++)
+        {
+            h = &merged[c * sr_prof_nstages + s];
+            if(h->count == 0)
+            { continue; }
+            fprintf(fp, "%-8s %-6s %10llu %8.0f %8.0f %8.0f %8.0f %10.0f\n",
+                    sr_prof_class_names[c], sr_prof_stage_names[s],
+                    (unsigned long long)h->count,
+                    sr_prof_percentile_ns(h, 0.50), sr_prof_percentile_ns(h, 0.90),
+                    sr_prof_percentile_ns(h, 0.99), sr_prof_percentile_ns(h, 0.999),
+                    sr_prof_cycles_to_ns(h->max));
+        }
+    }
+    fflush(fp);
+    free(merged);
+} /* -- sr_prof_dump -- */
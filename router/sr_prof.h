@@ -0,0 +1,119 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_prof.h
+ *
+ * Description:
+ *
+ * Per-stage latency profiling of the packet path.  sr_handlepacket takes a
+ * cycle counter stamp at ingress and each stage of the pipeline (parse and
+ * verify, NAT lookup, route lookup, ARP, checksums, transmit) marks where it
+ * ends; the cycles since the previous mark are charged to that stage.  When
+ * the packet is done, each stage it went through and its total are added to
+ * log-linear histograms (16 sub-buckets per power of two, so any reading is
+ * within about 6%) kept per packet class and per thread.  Threads never
+ * share a histogram; sr_prof_dump() merges them when someone asks.
+ *
+ * The hooks are compiled in only with -DSR_PROFILE (make PROFILE=-DSR_PROFILE)
+ * and then still do nothing but test a flag until sr_prof_enable() is called
+ * (sr -X).  Without SR_PROFILE they expand to nothing.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PROF_H
+#define SR_PROF_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+enum sr_prof_class {
+    sr_prof_class_other = 0,
+    sr_prof_class_arp,
+    sr_prof_class_local,          /* addressed to the router */
+    sr_prof_class_forward,
+    sr_prof_class_nat_out,        /* internal -> external */
+    sr_prof_class_nat_in,         /* external -> internal */
+    sr_prof_nclasses
+};
+
+enum sr_prof_stage {
+    sr_prof_stage_parse = 0,      /* header checks and demux */
+    sr_prof_stage_nat,            /* mapping lookup/insert, TCP state */
+    sr_prof_stage_lpm,            /* routing table lookup */
+    sr_prof_stage_arp,            /* ARP cache lookup or queueing */
+    sr_prof_stage_cksum,          /* TTL and checksum rewrites */
+    sr_prof_stage_tx,             /* handing the frame to the transport */
+    sr_prof_stage_total,          /* ingress to done, recorded by END */
+    sr_prof_nstages
+};
+
+#define SR_PROF_SUB_BITS 4
+#define SR_PROF_BUCKETS  ((64 - SR_PROF_SUB_BITS + 1) << SR_PROF_SUB_BITS)
+
+struct sr_prof_hist
+{
+    uint64_t count;
+    uint64_t sum;                           /* cycles */
+    uint64_t max;
+    uint32_t bucket[SR_PROF_BUCKETS];
+};
+
+/* one per thread that has handled a packet while profiling was on */
+struct sr_prof_thread
+{
+    struct sr_prof_hist hist[sr_prof_nclasses][sr_prof_nstages];
+
+    /* packet in progress */
+    int active;
+    int cls;
+    unsigned int touched;                   /* bit per stage */
+    uint64_t start;
+    uint64_t last;
+    uint64_t cycles[sr_prof_nstages];
+
+    struct sr_prof_thread* next;
+};
+
+extern int sr_prof_enabled;
+
+/* Calibrate the cycle counter and turn the hooks on. */
+void sr_prof_enable(void);
+void sr_prof_disable(void);
+
+void sr_prof_begin(void);
+void sr_prof_class(enum sr_prof_class cls);
+void sr_prof_stage(enum sr_prof_stage stage);
+void sr_prof_end(void);
+
+/* Merge every thread's histograms into 'out', which must hold
+   sr_prof_nclasses * sr_prof_nstages entries indexed [class][stage]. */
+void sr_prof_read(struct sr_prof_hist* out);
+
+/* Value at quantile 'q' (0..1) of a merged histogram, and the smallest
+   value in bucket 'b', both in nanoseconds. */
+double sr_prof_percentile_ns(const struct sr_prof_hist* h, double q);
+double sr_prof_bucket_ns(unsigned int b);
+double sr_prof_cycles_to_ns(uint64_t cycles);
+
+/* Samples in buckets starting below 'ns', for cumulative exports; exact to
+   the bucket width (about 6%). */
+uint64_t sr_prof_count_below_ns(const struct sr_prof_hist* h, double ns);
+
+const char* sr_prof_class_name(enum sr_prof_class cls);
+const char* sr_prof_stage_name(enum sr_prof_stage stage);
+
+/* Merge every thread's histograms and print count, percentiles and max in
+   nanoseconds for each class and stage that saw packets. */
+void sr_prof_dump(FILE* fp);
+
+#ifdef SR_PROFILE
+#define SR_PROF_BEGIN()    do { if(sr_prof_enabled) sr_prof_begin(); } while(0)
+#define SR_PROF_CLASS(c)   do { if(sr_prof_enabled) sr_prof_class(c); } while(0)
+#define SR_PROF_STAGE(s)   do { if(sr_prof_enabled) sr_prof_stage(s); } while(0)
+#define SR_PROF_END()      do { if(sr_prof_enabled) sr_prof_end(); } while(0)
+#else
+#define SR_PROF_BEGIN()    do { } while(0)
+#define SR_PROF_CLASS(c)   do { } while(0)
+#define SR_PROF_STAGE(s)   do { } while(0)
+#define SR_PROF_END()      do { } while(0)
+#endif /* SR_PROFILE */
+
+#endif /* -- SR_PROF_H -- */
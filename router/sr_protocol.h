@@ -75,6 +75,7 @@
   #endif
 #endif
 #define ICMP_DATA_SIZE 28
+#define ICMP_QUOTE_MAX (60 + 8) /* an IP header with all 40 bytes of options, and 8 */
 
 
 /* Structure of a ICMP header
@@ -0,0 +1,77 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rcu.c
+ *
+ * Description:
+ *
+ * Quiescent-state based read-copy-update.  See sr_rcu.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sr_rcu.h"
+
+#define SR_RCU_POLL_US 100
+
+volatile unsigned long sr_rcu_epoch = 1;
+
+static struct sr_rcu_reader* sr_rcu_readers = 0;
+/* guards the reader list and serializes writers */
+static pthread_mutex_t sr_rcu_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void sr_rcu_register(struct sr_rcu_reader* r)
+{
+    /* -- REQUIRES -- */
+    assert(r);
+
+    r->seen = SR_RCU_OFFLINE;
+    pthread_mutex_lock(&sr_rcu_lock);
+    r->next = sr_rcu_readers;
+    sr_rcu_readers = r;
+    pthread_mutex_unlock(&sr_rcu_lock);
+} /* -- sr_rcu_register -- */
+
+void sr_rcu_unregister(struct sr_rcu_reader* r)
+{
+    struct sr_rcu_reader** walker;
+
+    /* -- REQUIRES -- */
+    assert(r);
+
+    pthread_mutex_lock(&sr_rcu_lock);
+    for(walker = &sr_rcu_readers; *walker; walker = &((*walker)->next))
+    {
+        if(*walker == r)
+        {
+            *walker = r->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&sr_rcu_lock);
+} /* -- sr_rcu_unregister -- */
+
+void sr_rcu_online(struct sr_rcu_reader* r)
+{
+    r->seen = sr_rcu_epoch;
+    /* the store must be visible before the reader loads a shared pointer,
+       or a writer could miss it and free what is about to be read */
+    __sync_synchronize();
+} /* -- sr_rcu_online -- */
+
+void sr_rcu_synchronize(void)
+{
+    struct sr_rcu_reader* r;
+    unsigned long target;
+
+    pthread_mutex_lock(&sr_rcu_lock);
+    /* orders the caller's publishing store before the epoch moves */
+    target = __sync_add_and_fetch(&sr_rcu_epoch, 1);
+    for(r = sr_rcu_readers; r; r = r->next)
+    {
+        while(r->seen < target)
+        { usleep(SR_RCU_POLL_US); }
+    }
+    pthread_mutex_unlock(&sr_rcu_lock);
+} /* -- sr_rcu_synchronize -- */
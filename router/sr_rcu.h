@@ -0,0 +1,52 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rcu.h
+ *
+ * Description:
+ *
+ * Quiescent-state based read-copy-update, for data the forwarding loop
+ * reads on every packet and something else replaces now and then (the
+ * routing table, see sr_rt.h).
+ *
+ * A reader thread registers once and then reads the shared pointer with no
+ * lock at all.  It reports a quiescent point -- a moment at which it holds
+ * no reference into the shared data -- every so often, or goes offline
+ * while it blocks.  A writer builds the replacement off to the side,
+ * publishes it with a pointer store, calls sr_rcu_synchronize, which waits
+ * until every online reader has passed a quiescent point since, and only
+ * then frees the old copy.
+ *
+ * The event loop reports a quiescent point between epoll batches and is
+ * offline while it waits in epoll_wait, so an idle router never holds a
+ * writer up.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RCU_H
+#define SR_RCU_H
+
+#define SR_RCU_OFFLINE (~0UL)
+
+struct sr_rcu_reader
+{
+    volatile unsigned long seen;  /* epoch at the last quiescent point */
+    struct sr_rcu_reader* next;
+};
+
+extern volatile unsigned long sr_rcu_epoch;
+
+/* Make the calling thread a reader; it starts offline. */
+void sr_rcu_register(struct sr_rcu_reader* r);
+void sr_rcu_unregister(struct sr_rcu_reader* r);
+
+/* The reader holds no references here.  Cheap enough for every batch. */
+#define sr_rcu_quiescent(r) ((r)->seen = sr_rcu_epoch)
+
+/* Around blocking: no references may be held while offline. */
+#define sr_rcu_offline(r)   ((r)->seen = SR_RCU_OFFLINE)
+void sr_rcu_online(struct sr_rcu_reader* r);
+
+/* Wait until every reader has passed a quiescent point or been offline
+   since the call.  Never call it from a reader that is online. */
+void sr_rcu_synchronize(void);
+
+#endif /* -- SR_RCU_H -- */
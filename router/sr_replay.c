@@ -0,0 +1,316 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_replay.c
+ *
+ * Description:
+ *
+ * Offline pcap replay backend.  See sr_replay.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "sr_replay.h"
+#include "sr_router.h"
+#include "sr_dumper.h"
+
+#define SR_REPLAY_MAGIC_NSEC 0xa1b23c4d
+#define SR_REPLAY_MAX_CAPLEN 65535
+
+static uint32_t sr_replay_u32(const struct sr_replay* rp, const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    if(rp->swapped)
+    {
+        v = ((v & 0xff) << 24) | ((v & 0xff00) << 8) |
+            ((v >> 8) & 0xff00) | (v >> 24);
+    }
+    return v;
+}
+
+static int sr_replay_load(struct sr_replay* rp, const char* path)
+{
+    FILE* fp;
+    long size;
+    uint32_t magic;
+
+    fp = fopen(path, "rb");
+    if(!fp)
+    {
+        perror("fopen(..):sr_replay.c::sr_replay_load(..)");
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if(size < (long)sizeof(struct pcap_file_header))
+    {
+        fprintf(stderr, "Replay: %s is not a pcap file\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    rp->data = (uint8_t*)malloc(size);
+    assert(rp->data);
+    if(fread(rp->data, 1, size, fp) != (size_t)size)
+    {
+        perror("fread(..):sr_replay.c::sr_replay_load(..)");
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    rp->size = size;
+
+    memcpy(&magic, rp->data, sizeof(magic));
+    switch(magic)
+    {
+        case TCPDUMP_MAGIC:               rp->swapped = 0; rp->nsec = 0; break;
+        case SR_REPLAY_MAGIC_NSEC:        rp->swapped = 0; rp->nsec = 1; break;
+        case 0xd4c3b2a1:                  rp->swapped = 1; rp->nsec = 0; break;
+        case 0x4d3cb2a1:                  rp->swapped = 1; rp->nsec = 1; break;
+        default:
+            fprintf(stderr, "Replay: %s: bad pcap magic\n", path);
+            return -1;
+    }
+    if(sr_replay_u32(rp, rp->data + 20) != LINKTYPE_ETHERNET)
+    {
+        fprintf(stderr, "Replay: %s is not an Ethernet capture\n", path);
+        return -1;
+    }
+    return 0;
+} /* -- sr_replay_load -- */
+
+static int sr_replay_load_ifmap(struct sr_replay* rp, const char* path)
+{
+    FILE* fp;
+    char line[128];
+    char name[sr_IFACE_NAMELEN];
+    unsigned int cap = 0;
+
+    fp = fopen(path, "r");
+    if(!fp)
+    {
+        perror("fopen(..):sr_replay.c::sr_replay_load_ifmap(..)");
+        return -1;
+    }
+    while(fgets(line, sizeof(line), fp))
+    {
+        if(sscanf(line, "%31s", name) != 1 || name[0] == '#')
+        { continue; }
+        if(rp->nifmap == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            rp->ifmap = realloc(rp->ifmap, cap * sizeof(*rp->ifmap));
+            assert(rp->ifmap);
+        }
+        strcpy(rp->ifmap[rp->nifmap++], name);
+    }
+    fclose(fp);
+
+    if(rp->nifmap == 0)
+    {
+        fprintf(stderr, "Replay: interface map %s is empty\n", path);
+        return -1;
+    }
+    return 0;
+} /* -- sr_replay_load_ifmap -- */
+
+static int sr_replay_load_ifconf(struct sr_instance* sr, const char* path)
+{
+    FILE* fp;
+    char line[256];
+    char name[sr_IFACE_NAMELEN], ip[64], mac[64];
+    unsigned int m[6];
+    unsigned char addr[6];
+    struct in_addr in;
+    int i, n = 0;
+
+    fp = fopen(path, "r");
+    if(!fp)
+    {
+        perror("fopen(..):sr_replay.c::sr_replay_load_ifconf(..)");
+        return -1;
+    }
+    while(fgets(line, sizeof(line), fp))
+    {
+        if(sscanf(line, "%31s %63s %63s", name, ip, mac) != 3 || name[0] == '#')
+        { continue; }
+        if(inet_aton(ip, &in) == 0 ||
+           sscanf(mac, "%x:%x:%x:%x:%x:%x",
+                  &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 6)
+        {
+            fprintf(stderr, "Replay: %s: bad interface line: %s", path, line);
+            fclose(fp);
+            return -1;
+        }
+        for(i = 0; i < 6; i++)
+        { addr[i] = (unsigned char)m[i]; }
+
+        /* same calls sr_handle_hwinfo makes for a VNS session */
+        sr_add_interface(sr, name);
+        sr_set_ether_ip(sr, in.s_addr);
+        sr_set_ether_addr(sr, addr);
+        n++;
+    }
+    fclose(fp);
+
+    if(n == 0)
+    {
+        fprintf(stderr, "Replay: no interfaces in %s\n", path);
+        return -1;
+    }
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+    return 0;
+} /* -- sr_replay_load_ifconf -- */
+
+/* timestamp of the record at 'off' in ms */
+static sr_msec_t sr_replay_ts(const struct sr_replay* rp, size_t off)
+{
+    uint32_t sec = sr_replay_u32(rp, rp->data + off);
+    uint32_t frac = sr_replay_u32(rp, rp->data + off + 4);
+
+    return (sr_msec_t)sec * 1000 + (rp->nsec ? frac / 1000000 : frac / 1000);
+}
+
+int sr_replay_open(struct sr_instance* sr, const char* pcap,
+                   const char* ifmap, const char* ifconf, const char* out)
+{
+    struct sr_replay* rp;
+    size_t first = sizeof(struct pcap_file_header);
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(pcap);
+
+    if(!ifmap || !ifconf)
+    {
+        fprintf(stderr, "Replay needs an interface map (-M) and config (-H)\n");
+        return -1;
+    }
+
+    rp = (struct sr_replay*)calloc(1, sizeof(struct sr_replay));
+    assert(rp);
+    sr->replay = rp;
+
+    if(sr_replay_load(rp, pcap) != 0 ||
+       sr_replay_load_ifmap(rp, ifmap) != 0 ||
+       sr_replay_load_ifconf(sr, ifconf) != 0)
+    {
+        sr_replay_close(sr);
+        return -1;
+    }
+
+    if(out)
+    {
+        rp->out = sr_dump_open(out, 0, SR_REPLAY_MAX_CAPLEN);
+        if(!rp->out)
+        {
+            sr_replay_close(sr);
+            return -1;
+        }
+    }
+
+    /* run the clock and timing wheel on capture time from the first frame;
+       nothing is armed yet since sr_init has not run */
+    if(first + sizeof(struct pcap_sf_pkthdr) <= rp->size)
+    {
+        sr_clock_set(sr_replay_ts(rp, first));
+        sr_timer_wheel_init(&(sr->evloop.timers), sr_clock_now());
+    }
+    return 0;
+} /* -- sr_replay_open -- */
+
+int sr_replay_run(struct sr_instance* sr)
+{
+    struct sr_replay* rp = sr->replay;
+    struct timespec start, end;
+    uint8_t* frame;
+    char iface[sr_IFACE_NAMELEN];
+    size_t off = sizeof(struct pcap_file_header);
+    uint32_t caplen;
+    double secs;
+
+    /* -- REQUIRES -- */
+    assert(rp);
+
+    frame = (uint8_t*)malloc(SR_REPLAY_MAX_CAPLEN);
+    assert(frame);
+
+    /* the admin socket may reload routes under us */
+    sr_rcu_register(&(sr->evloop.rcu));
+    sr_rcu_online(&(sr->evloop.rcu));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while(off + sizeof(struct pcap_sf_pkthdr) <= rp->size)
+    {
+        caplen = sr_replay_u32(rp, rp->data + off + 8);
+        if(caplen > SR_REPLAY_MAX_CAPLEN ||
+           off + sizeof(struct pcap_sf_pkthdr) + caplen > rp->size)
+        {
+            fprintf(stderr, "Replay: truncated capture after %lu frames\n",
+                    rp->frames_in);
+            break;
+        }
+
+        sr_clock_set(sr_replay_ts(rp, off));
+        sr_timer_wheel_advance(&(sr->evloop.timers), sr_clock_now());
+
+        /* the router rewrites frames in place; keep the capture intact */
+        memcpy(frame, rp->data + off + sizeof(struct pcap_sf_pkthdr), caplen);
+        strcpy(iface, rp->ifmap[rp->frames_in < rp->nifmap ?
+                                rp->frames_in : rp->nifmap - 1]);
+        rp->frames_in++;
+        sr_handlepacket(sr, frame, caplen, iface);
+        sr_rcu_quiescent(&(sr->evloop.rcu));
+
+        off += sizeof(struct pcap_sf_pkthdr) + caplen;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    sr_rcu_unregister(&(sr->evloop.rcu));
+    free(frame);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "Replay: %lu frames in, %lu frames out, %.3f s, %.0f packets/sec\n",
+            rp->frames_in, rp->frames_out, secs,
+            secs > 0 ? rp->frames_in / secs : 0.0);
+    return 0;
+} /* -- sr_replay_run -- */
+
+void sr_replay_close(struct sr_instance* sr)
+{
+    struct sr_replay* rp = sr->replay;
+
+    if(!rp)
+    { return; }
+    if(rp->out)
+    { sr_dump_close(rp->out); }
+    free(rp->data);
+    free(rp->ifmap);
+    free(rp);
+    sr->replay = 0;
+} /* -- sr_replay_close -- */
+
+void sr_replay_output(struct sr_instance* sr, const uint8_t* buf,
+                      unsigned int len)
+{
+    struct sr_replay* rp = sr->replay;
+    struct pcap_pkthdr h;
+    sr_msec_t now = sr_clock_now();
+
+    rp->frames_out++;
+    if(!rp->out)
+    { return; }
+
+    /* stamp with capture time so identical runs give identical files */
+    h.ts.tv_sec = now / 1000;
+    h.ts.tv_usec = (now % 1000) * 1000;
+    h.caplen = len;
+    h.len = len;
+    sr_dump(rp->out, &h, buf);
+} /* -- sr_replay_output -- */
@@ -0,0 +1,60 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_replay.h
+ *
+ * Description:
+ *
+ * Offline input backend.  Instead of a VNS session, the router reads a pcap
+ * capture (the format sr_dump writes), hands each frame to sr_handlepacket
+ * as fast as it can, and sr_send_packet writes output frames to another
+ * pcap instead of the socket.  Time is driven from the capture timestamps,
+ * so a replay is deterministic and the output can be diffed between runs.
+ *
+ * Input files:
+ *
+ *   interface config  one interface per line, in place of VNS HWINFO:
+ *                       <name> <ip> <mac>      e.g. eth1 10.0.1.1 0:1:2:3:4:5
+ *   interface map     the receiving interface of each frame, one name per
+ *                     line in capture order; the last name applies to any
+ *                     remaining frames
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_REPLAY_H
+#define SR_REPLAY_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "sr_if.h"
+
+struct sr_instance;
+
+struct sr_replay
+{
+    uint8_t* data;                        /* the whole input capture */
+    size_t size;
+    int swapped;                          /* capture has other byte order */
+    int nsec;                             /* nanosecond timestamps */
+    char (*ifmap)[sr_IFACE_NAMELEN];
+    unsigned int nifmap;
+    FILE* out;                            /* NULL discards output */
+    unsigned long frames_in;
+    unsigned long frames_out;
+};
+
+/* Load the capture, interface map and interface config, add the interfaces
+   to 'sr' and open 'out' (may be NULL). Returns 0 on success. */
+int  sr_replay_open(struct sr_instance* sr, const char* pcap,
+                    const char* ifmap, const char* ifconf, const char* out);
+
+/* Feed every frame through sr_handlepacket and print throughput.
+   Returns 0 on success. */
+int  sr_replay_run(struct sr_instance* sr);
+
+void sr_replay_close(struct sr_instance* sr);
+
+/* Called by sr_send_packet in replay mode. */
+void sr_replay_output(struct sr_instance* sr, const uint8_t* buf,
+                      unsigned int len);
+
+#endif /* -- SR_REPLAY_H -- */
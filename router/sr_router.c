@@ -24,6 +24,8 @@
 #include "sr_arpcache.h"
 #include "sr_utils.h"
 #include "sr_nat.h"
+#include "sr_prof.h"
+#include "sr_stats.h"
 
 /*---------------------------------------------------------------------
  * Method: sr_init(void)
@@ -38,28 +40,60 @@ void sr_init(struct sr_instance* sr)
     /* REQUIRES */
     assert(sr);
 
-    /* Initialize cache and cache cleanup thread */
+    /* Initialize cache; its timeouts run on the event loop's timing wheel */
     sr_arpcache_init(&(sr->cache));
+    sr->cache.sr = sr;
+    sr->cache.timers = &(sr->evloop.timers);
+    sr_nh_init(&(sr->nh));
+    sr_icmp_limit_init(&(sr->icmp_limit));
 
-    pthread_attr_init(&(sr->attr));
-    pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
-    pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
-    pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
-    pthread_t thread;
-
-    pthread_create(&thread, &(sr->attr), sr_arpcache_timeout, sr);
-    
     /* Add initialization code here! */
     if(sr->nat_enabled) {
         sr_nat_init(&(sr->nat));
     }
 } /* -- sr_init -- */
 
+/* Account for a discarded packet: drop counter and flight recorder verdict */
+static void drop_packet(struct sr_instance* sr, enum sr_drop_reason reason) {
+    SR_STATS_DROP(reason);
+    sr_flight_verdict(&sr->flight, sr_flight_dropped, sr_drop_reason_name(reason));
+}
+
+/* Stable hash of a packet's flow: addresses, protocol and the ports (or
+ * ICMP query id).  Fragments all hash without ports, so a datagram's
+ * pieces stay together.  Taken once per forwarded packet to choose among
+ * equal-cost paths. */
+static uint32_t flow_hash(sr_ip_hdr_t* ip_hdr, unsigned int ip_len) {
+    unsigned int hl = ip_hdr->ip_hl * 4;
+    uint8_t* l4 = (uint8_t*)ip_hdr + hl;
+    uint32_t ports = 0;
+    uint32_t h;
+
+    if((ntohs(ip_hdr->ip_off) & (IP_MF | IP_OFFMASK)) == 0 && ip_len >= hl + 8) {
+        if(ip_hdr->ip_p == ip_protocol_tcp || ip_hdr->ip_p == ip_protocol_udp) {
+            memcpy(&ports, l4, sizeof(ports));   /* source and destination port */
+        } else if(ip_hdr->ip_p == ip_protocol_icmp) {
+            ports = ((sr_icmp_hdr_t*)l4)->icmp_id;
+        }
+    }
+
+    h = ip_hdr->ip_src;
+    h = ((h ^ (h >> 16)) * 0x85ebca6bU) ^ ip_hdr->ip_dst;
+    h = ((h ^ (h >> 13)) * 0xc2b2ae35U) ^ ports;
+    h = ((h ^ (h >> 16)) * 0x85ebca6bU) ^ ip_hdr->ip_p;
+    h = (h ^ (h >> 13)) * 0xc2b2ae35U;
+    return h ^ (h >> 16);
+}
+
 /* Custom method: send packet to next_hop_ip, according to "sr_arpcache.h"
- * Check the ARP cache, send packet or send ARP request */
-void send_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct sr_if* interface, uint32_t dest_ip) {
+ * Check the ARP cache, send packet or send ARP request.
+ * Returns 1 if the packet went out now, 0 if it waits on ARP. */
+int send_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct sr_if* interface, uint32_t dest_ip) {
     
     struct sr_arpentry* arp_cached = sr_arpcache_lookup(&sr->cache, dest_ip);
+    SR_PROF_STAGE(sr_prof_stage_arp);
+
+    SR_STATS_INC(arp_cached ? sr_stat_arp_hit : sr_stat_arp_miss);
 
     if(arp_cached) {
         /* if cached, send packet through outgoing interface */
@@ -69,14 +103,27 @@ void send_packet(struct sr_instance* sr, uint8_t* packet, unsigned int len, stru
         memcpy(ehdr->ether_dhost, arp_cached->mac, ETHER_ADDR_LEN);
         /* set the source MAC to the outgoing interface's MAC */
         memcpy(ehdr->ether_shost, interface->addr, ETHER_ADDR_LEN);
-        sr_send_packet(sr, packet, len, interface->name);
+        sr_send_packet_if(sr, packet, len, interface);
+        SR_PROF_STAGE(sr_prof_stage_tx);
         free(arp_cached);
+        return 1;
     } else {
         /* if not cached, send ARP request */
         printf("Queue ARP request.\n");
-        struct sr_arpreq* arpreq = sr_arpcache_queuereq(&sr->cache, dest_ip, packet, len, interface->name);
+        struct sr_arpreq* arpreq = sr_arpcache_queuereq(&sr->cache, dest_ip, packet, len, interface->index);
         handle_arpreq(sr, arpreq);
+        SR_PROF_STAGE(sr_prof_stage_arp);
     }
+    return 0;
+}
+
+/* Send a packet along a next hop resolved before: no route, interface or
+ * ARP lookup, just the Ethernet addresses */
+static void send_nexthop(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct sr_nh_entry* nh) {
+    SR_STATS_INC(sr_stat_nh_hit);
+    memcpy(packet, nh->eth, sizeof(nh->eth));
+    sr_send_packet_if(sr, packet, len, sr_if_at(sr, nh->ifindex));
+    SR_PROF_STAGE(sr_prof_stage_tx);
 }
 
 /* Custom method: send an ICMP message */
@@ -86,107 +133,66 @@ void send_icmp_msg(struct sr_instance* sr, uint8_t* packet, unsigned int len, ui
                 ^
              *packet
     */
-    /* construct ethernet header from packet */
-    sr_ethernet_hdr_t* eth_hdr = (sr_ethernet_hdr_t*)packet;
     /* construct IP header from packet */
     sr_ip_hdr_t* ip_hdr = (sr_ip_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
 
+    /* errors go back to the source; rate limit them before any work is done */
+    if(!sr_icmp_limit_allow(&sr->icmp_limit, type, ip_hdr->ip_src)) {
+        if(type == icmp_type_time_exceeded) {
+            SR_STATS_INC(sr_stat_icmp_exceeded_limited);
+        } else {
+            SR_STATS_INC(sr_stat_icmp_unreach_limited);
+        }
+        return;
+    }
+
     /* get longest matching prefix of source IP */
-    struct sr_rt* rt_entry = longest_matching_prefix(sr, ip_hdr->ip_src);
+    struct sr_rt* rt_entry = longest_matching_prefix(sr, ip_hdr->ip_src, 0);
+    SR_PROF_STAGE(sr_prof_stage_lpm);
 
     if(!rt_entry) {
         printf("Error: send_icmp_msg: routing table entry not found.\n");
+        SR_STATS_DROP(sr_drop_icmp_no_route);
         return;
     }
 
     /* get outgoing interface */
-    struct sr_if* interface = sr_get_interface(sr, rt_entry->interface);
+    struct sr_if* interface = sr_if_at(sr, rt_entry->ifindex);
+    if(!interface) {
+        printf("Error: send_icmp_msg: interface \'%s\' not found.\n", rt_entry->interface);
+        SR_STATS_DROP(sr_drop_icmp_no_route);
+        return;
+    }
 
     switch(type) {
-        case icmp_type_echo_reply: {
-            /* set ethernet header source MAC & destination MAC: 00-00-00-00-00-00 */
-            memset(eth_hdr->ether_shost, 0, ETHER_ADDR_LEN);
-            memset(eth_hdr->ether_dhost, 0, ETHER_ADDR_LEN);
-
-            /* this ICMP message is a sending-back */
-            uint32_t temp = ip_hdr->ip_dst;
-            ip_hdr->ip_dst = ip_hdr->ip_src;
-            ip_hdr->ip_src = temp;
-            /* not necessary to recalculate checksum here */
-
-            /* construct ICMP header */
-            sr_icmp_hdr_t* icmp_hdr = (sr_icmp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
-            icmp_hdr->icmp_type = type;
-            icmp_hdr->icmp_code = code;
-
-            /* compute ICMP checksum */
-            icmp_hdr->icmp_sum = 0;
-            icmp_hdr->icmp_sum = cksum(icmp_hdr, ntohs(ip_hdr->ip_len) - (ip_hdr->ip_hl * 4));
-            
-            send_packet(sr, packet, len, interface, rt_entry->gw.s_addr);
-            break;
-        }
         case icmp_type_time_exceeded:
         case icmp_type_dest_unreachable: {
-            /* calculate length of the new ICMP packet (illustrated above) */
-            unsigned int new_len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t);
-            /* construct new ICMP packet */
-            uint8_t* new_packet = malloc(new_len);
-
-            /* sanity check */
-            assert(new_packet);
-
-            /* construct ethernet hdr */
-            sr_ethernet_hdr_t* new_eth_hdr = (sr_ethernet_hdr_t*)new_packet;
-            /* construct IP hdr */
-            sr_ip_hdr_t* new_ip_hdr = (sr_ip_hdr_t*)(new_packet + sizeof(sr_ethernet_hdr_t));
-            /* construct type 3 ICMP hdr */
-            sr_icmp_t3_hdr_t* icmp_hdr = (sr_icmp_t3_hdr_t*)(new_packet + sizeof(sr_ethernet_hdr_t) + (ip_hdr->ip_hl * 4));
-
-             /* set new ethernet header source MAC & destination MAC: 00-00-00-00-00-00 */
-            memset(new_eth_hdr->ether_shost, 0x00, ETHER_ADDR_LEN);
-            memset(new_eth_hdr->ether_dhost, 0x00, ETHER_ADDR_LEN);
-            /* set protocol type to IP */
-            new_eth_hdr->ether_type = htons(ethertype_ip);
-
-            /* set new IP hdr */
-            new_ip_hdr->ip_v    = 4;
-            new_ip_hdr->ip_hl   = sizeof(sr_ip_hdr_t) / 4;
-            new_ip_hdr->ip_tos  = 0;
-            new_ip_hdr->ip_len  = htons(sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t));
-            new_ip_hdr->ip_id   = htons(0);
-            new_ip_hdr->ip_off  = htons(IP_DF);
-            new_ip_hdr->ip_ttl  = 255;
-            new_ip_hdr->ip_p    = ip_protocol_icmp;
+            /* construct new ICMP packet (illustrated above) from the
+               outgoing interface's template, in a pooled buffer */
+            uint8_t* new_packet = sr_ctl_get(&sr->ctl);
             /* if code == 3 (i.e. UDP arrives destination), set source IP to received packet's destination IP */
             /* if others, set source IP to outgoing interface's IP */
-            new_ip_hdr->ip_src = code == icmp_dest_unreachable_port ? ip_hdr->ip_dst : interface->ip;
-            /* set destination IP to received packet's source IP */
-            new_ip_hdr->ip_dst = ip_hdr->ip_src;
-
-            /* recalculate checksum */
-            new_ip_hdr->ip_sum = 0;
-            new_ip_hdr->ip_sum = cksum(new_ip_hdr, sizeof(sr_ip_hdr_t));
-
-            /* set type 3 ICMP hdr */
-            icmp_hdr->icmp_type = type;
-            icmp_hdr->icmp_code = code;
-            icmp_hdr->unused = 0;
-            icmp_hdr->next_mtu = 0;
-            memcpy(icmp_hdr->data, ip_hdr, ICMP_DATA_SIZE);
-            icmp_hdr->icmp_sum = 0;
-            icmp_hdr->icmp_sum = cksum(icmp_hdr, sizeof(sr_icmp_t3_hdr_t));
+            uint32_t src = code == icmp_dest_unreachable_port ? ip_hdr->ip_dst : interface->ip;
+            /* the whole IP header, options included, and 8 bytes after it
+               (RFC 792), where the packet is long enough to have them */
+            unsigned int quote = ip_hdr->ip_hl * 4 + 8;
+            if(quote < ICMP_DATA_SIZE || len < sizeof(sr_ethernet_hdr_t) + quote) {
+                quote = ICMP_DATA_SIZE;
+            }
+            unsigned int new_len = sr_ctl_icmp_error(sr, interface, new_packet, ip_hdr, quote, src, type, code);
+            SR_PROF_STAGE(sr_prof_stage_cksum);
 
             send_packet(sr, new_packet, new_len, interface, rt_entry->gw.s_addr);
-            free(new_packet);
+            sr_ctl_put(&sr->ctl, new_packet);
             break;
         }
     }
 }
 
 /* Custom method: handle ARP packet */
-void handle_arp(struct sr_instance* sr, uint8_t* packet, unsigned int len, char* interface) {
+void handle_arp(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct sr_if* interface) {
     printf("Received ARP packet.\n");
+    SR_PROF_CLASS(sr_prof_class_arp);
 
     /* store the content of the ARP hdr (bypass the Ethernet hdr) */
     sr_arp_hdr_t* arp_hdr = (sr_arp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
@@ -194,12 +200,14 @@ void handle_arp(struct sr_instance* sr, uint8_t* packet, unsigned int len, char*
     /* verify hardware format code */
     if(ntohs(arp_hdr->ar_hrd) != arp_hrd_ethernet) {
         printf("Error: handle_arp: packet is not an Ethernet frame.\n");
+        drop_packet(sr, sr_drop_arp_not_ethernet);
         return;
     }
 
     /* verify Ethernet protocol type */
     if(ntohs(arp_hdr->ar_pro) != ethertype_ip) {
         printf("Error: handle_arp: packet is not an IP packet.\n");
+        drop_packet(sr, sr_drop_arp_not_ipv4);
         return;
     }
 
@@ -207,41 +215,24 @@ void handle_arp(struct sr_instance* sr, uint8_t* packet, unsigned int len, char*
     struct sr_if* out_interface = sr_get_interface_by_ip(sr, arp_hdr->ar_tip);
     if(!out_interface) {
         printf("Error: handle_arp: destination IP not on this router.\n");
+        drop_packet(sr, sr_drop_arp_not_local);
         return;
     }
 
+    sr_flight_verdict(&sr->flight, sr_flight_local, 0);
+    SR_PROF_STAGE(sr_prof_stage_parse);
+
     switch(ntohs(arp_hdr->ar_op)) {
         case arp_op_request: {
             printf("Received ARP packet - ARP request.\n");
 
-            /* store the inbound interface */
-            struct sr_if* in_interface = sr_get_interface(sr, interface);
-
-            /* copy the ARP request */
-            uint8_t* arp_req = malloc(len);
-            memcpy(arp_req, packet, len);
-
-            /* construct Ethernet hdr */
-            sr_ethernet_hdr_t* arp_req_eth_hdr = (sr_ethernet_hdr_t*)arp_req;
-            /* set destination MAC to be source MAC */
-            memcpy(arp_req_eth_hdr->ether_dhost, arp_req_eth_hdr->ether_shost, ETHER_ADDR_LEN);
-            /* set source MAC to be inbound interface's MAC */
-            memcpy(arp_req_eth_hdr->ether_shost, in_interface, ETHER_ADDR_LEN);
-
-            /* construct ARP hdr */
-            sr_arp_hdr_t* arp_req_arp_hdr = (sr_arp_hdr_t*)(arp_req + sizeof(sr_ethernet_hdr_t));
-            arp_req_arp_hdr->ar_op = htons(arp_op_reply);
-            /* set sender MAC to be inbound interface's MAC */
-            memcpy(arp_req_arp_hdr->ar_sha, in_interface->addr, ETHER_ADDR_LEN);
-            /* set sender IP to be inbound interface's IP */
-            arp_req_arp_hdr->ar_sip = in_interface->ip;
-            /* set target MAC to be received packet's sender MAC */
-            memcpy(arp_req_arp_hdr->ar_tha, arp_hdr->ar_sha, ETHER_ADDR_LEN);
-            /* set target IP to be received packet's sender IP */
-            arp_req_arp_hdr->ar_tip = arp_hdr->ar_sip;
-
-            send_packet(sr, arp_req, len, in_interface, arp_hdr->ar_sip);
-            free(arp_req);
+            /* answered straight back to the sender's MAC out of the
+               inbound interface, from that interface's template */
+            uint8_t* arp_rep = sr_ctl_get(&sr->ctl);
+            unsigned int rep_len = sr_ctl_arp_reply(sr, interface, arp_rep, arp_hdr);
+            sr_send_packet_if(sr, arp_rep, rep_len, interface);
+            SR_PROF_STAGE(sr_prof_stage_tx);
+            sr_ctl_put(&sr->ctl, arp_rep);
 
             break;
         }
@@ -249,6 +240,7 @@ void handle_arp(struct sr_instance* sr, uint8_t* packet, unsigned int len, char*
             printf("Received ARP packet - ARP reply.\n");
 
             struct sr_arpreq* cached = sr_arpcache_insert(&sr->cache, arp_hdr->ar_sha, arp_hdr->ar_sip);
+            SR_PROF_STAGE(sr_prof_stage_arp);
 
             if(cached) {
                 struct sr_packet* packet = cached->packets;
@@ -257,7 +249,7 @@ void handle_arp(struct sr_instance* sr, uint8_t* packet, unsigned int len, char*
                 sr_ethernet_hdr_t* eth_hdr;
 
                 while(packet) {
-                    in_interface = sr_get_interface(sr, packet->iface);
+                    in_interface = sr_if_at(sr, packet->ifindex);
                     if(in_interface) {
                         /* construct Ethernet hdr */
                         eth_hdr = (sr_ethernet_hdr_t*)(packet->buf);
@@ -266,7 +258,8 @@ void handle_arp(struct sr_instance* sr, uint8_t* packet, unsigned int len, char*
                         /* set source MAC to be inbound interface's MAC */
                         memcpy(eth_hdr->ether_shost, in_interface->addr, ETHER_ADDR_LEN);
 
-                        sr_send_packet(sr, packet->buf, packet->len, packet->iface);
+                        sr_send_packet_if(sr, packet->buf, packet->len, in_interface);
+                        SR_PROF_STAGE(sr_prof_stage_tx);
                     }
                     packet = packet->next;
                 }
@@ -278,7 +271,7 @@ void handle_arp(struct sr_instance* sr, uint8_t* packet, unsigned int len, char*
 }
 
 /* Custom method: handle IP packet */
-void handle_ip(struct sr_instance* sr, uint8_t* packet, unsigned int len, char* interface) {
+void handle_ip(struct sr_instance* sr, uint8_t* packet, unsigned int len, struct sr_if* interface) {
     printf("Received IP packet.\n");
 
     /* store the content of the packet (bypass the Ethernet hdr) */
@@ -287,11 +280,14 @@ void handle_ip(struct sr_instance* sr, uint8_t* packet, unsigned int len, char*
 
     /* verify the IP hdr */
     if(verify_ip(ip_hdr) == -1) {
+        drop_packet(sr, sr_drop_bad_ip);
         return;
     }
 
     /* check if packet's destination is this router */
     struct sr_if* out_interface = sr_get_interface_by_ip(sr, ip_hdr->ip_dst);
+    SR_PROF_CLASS(out_interface ? sr_prof_class_local : sr_prof_class_forward);
+    SR_PROF_STAGE(sr_prof_stage_parse);
     if(out_interface) {
         printf("Packet destined to this router.\n");
 
@@ -300,14 +296,24 @@ void handle_ip(struct sr_instance* sr, uint8_t* packet, unsigned int len, char*
                 printf("Packet is an ICMP message.\n");
 
                 if(verify_icmp(packet, len) == -1) {
+                    drop_packet(sr, sr_drop_bad_icmp);
                     return;
                 }
+                SR_PROF_STAGE(sr_prof_stage_parse);
 
                 sr_icmp_hdr_t* icmp_hdr = (sr_icmp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
 
                 /* handle 'ping' echo request */
                 if(icmp_hdr->icmp_type == icmp_type_echo_request) {
-                    send_icmp_msg(sr, packet, len, icmp_type_echo_reply, (uint8_t)0);
+                    sr_flight_verdict(&sr->flight, sr_flight_local, "echo request");
+                    /* turned around in place and sent straight back to the
+                       neighbour it came from: no route or ARP lookup */
+                    sr_ctl_echo_reply(interface, packet);
+                    SR_PROF_STAGE(sr_prof_stage_cksum);
+                    sr_send_packet_if(sr, packet, len, interface);
+                    SR_PROF_STAGE(sr_prof_stage_tx);
+                } else {
+                    drop_packet(sr, sr_drop_unhandled);
                 }
 
                 break;
@@ -315,10 +321,15 @@ void handle_ip(struct sr_instance* sr, uint8_t* packet, unsigned int len, char*
             case ip_protocol_tcp:
             case ip_protocol_udp: {
                 printf("Packet is a TCP/UDP message.\n");
+                sr_flight_verdict(&sr->flight, sr_flight_local, "port unreachable");
                 /* send ICMP msg - type 3 code 3 */
                 send_icmp_msg(sr, packet, len, icmp_type_dest_unreachable, icmp_dest_unreachable_port);
                 break;
             }
+            default: {
+                drop_packet(sr, sr_drop_unhandled);
+                break;
+            }
         }
     } else {
         printf("Packet destined elsewhere.\n");
@@ -330,6 +341,7 @@ void handle_ip(struct sr_instance* sr, uint8_t* packet, unsigned int len, char*
         ip_hdr->ip_ttl--;
         if(ip_hdr->ip_ttl == 0) {
             printf("TTL decreased to zero.\n");
+            drop_packet(sr, sr_drop_ttl);
             send_icmp_msg(sr, packet, len, icmp_type_time_exceeded, (uint8_t)0);
             return;
         }
@@ -337,28 +349,83 @@ void handle_ip(struct sr_instance* sr, uint8_t* packet, unsigned int len, char*
         /* recalculate checksum */
         ip_hdr->ip_sum = 0;
         ip_hdr->ip_sum = cksum(ip_hdr, ip_hdr->ip_hl * 4);
+        SR_PROF_STAGE(sr_prof_stage_cksum);
+
+        /* a destination we have sent to before needs no lookups */
+        uint32_t flow = flow_hash(ip_hdr, len - sizeof(sr_ethernet_hdr_t));
+        struct sr_nh_entry* nh = sr_nh_lookup(sr, ip_hdr->ip_dst, flow);
+        if(nh) {
+            SR_PROF_STAGE(sr_prof_stage_lpm);
+            sr_flight_verdict(&sr->flight, sr_flight_forwarded, 0);
+            send_nexthop(sr, packet, len, nh);
+            return;
+        }
+        SR_STATS_INC(sr_stat_nh_miss);
 
         /* lookup destination IP in routing table */
-        struct sr_rt* table_entry = longest_matching_prefix(sr, ip_hdr->ip_dst);
+        struct sr_rt* table_entry = longest_matching_prefix(sr, ip_hdr->ip_dst, flow);
+        SR_PROF_STAGE(sr_prof_stage_lpm);
         if(!table_entry) {
             printf("Error: handle_ip: destination IP not existed in routing table.\n");
+            drop_packet(sr, sr_drop_no_route);
             send_icmp_msg(sr, packet, len, icmp_type_dest_unreachable, icmp_dest_unreachable_net);
             return;
         }
 
         /* find routing table indicated interface */
-        struct sr_if* rt_out_interface = sr_get_interface(sr, table_entry->interface);
+        struct sr_if* rt_out_interface = sr_if_at(sr, table_entry->ifindex);
         if(!rt_out_interface) {
             printf("Error: handle_ip: interface \'%s\' not found.\n", table_entry->interface);
+            drop_packet(sr, sr_drop_no_interface);
             return;
         }
 
-        send_packet(sr, packet, len, rt_out_interface, table_entry->gw.s_addr);
+        sr_flight_verdict(&sr->flight, sr_flight_forwarded, 0);
+        if(send_packet(sr, packet, len, rt_out_interface, table_entry->gw.s_addr)) {
+            sr_nh_store(sr, ip_hdr->ip_dst, flow, table_entry->npaths, rt_out_interface, packet);
+        }
     }
 }
 
 /* Custom method: handle IP packet with NAT enabled */
-void handle_ip_nat(struct sr_instance *sr, uint8_t *packet, unsigned int len, char *interface) {
+/* Route a packet the NAT has rewritten (TTL already decremented) and send it */
+static void forward_nat(struct sr_instance* sr, uint8_t* packet, unsigned int len, sr_ip_hdr_t* ip_hdr) {
+    /* a destination we have sent to before needs no lookups */
+    uint32_t flow = flow_hash(ip_hdr, len - sizeof(sr_ethernet_hdr_t));
+    struct sr_nh_entry* nh = sr_nh_lookup(sr, ip_hdr->ip_dst, flow);
+    if(nh) {
+        SR_PROF_STAGE(sr_prof_stage_lpm);
+        sr_flight_verdict(&sr->flight, sr_flight_nated, 0);
+        send_nexthop(sr, packet, len, nh);
+        return;
+    }
+    SR_STATS_INC(sr_stat_nh_miss);
+
+    /* lookup destination IP in routing table */
+    struct sr_rt* table_entry = longest_matching_prefix(sr, ip_hdr->ip_dst, flow);
+    SR_PROF_STAGE(sr_prof_stage_lpm);
+    if(!table_entry) {
+        printf("Error: handle_ip: destination IP not existed in routing table.\n");
+        drop_packet(sr, sr_drop_no_route);
+        send_icmp_msg(sr, packet, len, icmp_type_dest_unreachable, icmp_dest_unreachable_net);
+        return;
+    }
+
+    /* find outgoing interface indicated by routing table entry */
+    struct sr_if* rt_out_interface = sr_if_at(sr, table_entry->ifindex);
+    if(!rt_out_interface) {
+        printf("Error: handle_ip: interface \'%s\' not found.\n", table_entry->interface);
+        drop_packet(sr, sr_drop_no_interface);
+        return;
+    }
+
+    sr_flight_verdict(&sr->flight, sr_flight_nated, 0);
+    if(send_packet(sr, packet, len, rt_out_interface, table_entry->gw.s_addr)) {
+        sr_nh_store(sr, ip_hdr->ip_dst, flow, table_entry->npaths, rt_out_interface, packet);
+    }
+}
+
+void handle_ip_nat(struct sr_instance *sr, uint8_t *packet, unsigned int len, struct sr_if *interface) {
     printf("Received IP packet, NAT enabled.\n");
 
     /* store the content of the packet (bypass the Ethernet hdr) */
@@ -367,53 +434,81 @@ void handle_ip_nat(struct sr_instance *sr, uint8_t *packet, unsigned int len, ch
 
     /* verify the IP hdr */
     if(verify_ip(ip_hdr) == -1) {
+        drop_packet(sr, sr_drop_bad_ip);
         return;
     }
 
+    /* established TCP flows are rewritten from the flow cache, without the
+       mapping lookup or the connection state machine */
+    if(ip_hdr->ip_p == ip_protocol_tcp && (interface == sr->nat_int_if || interface == sr->nat_ext_if)) {
+        sr_nat_flow_dir dir = interface == sr->nat_int_if ? nat_flow_out : nat_flow_in;
+        if(sr_nat_flow_apply(&(sr->nat), dir, packet, len)) {
+            SR_STATS_INC(sr_stat_nat_flow_hit);
+            SR_PROF_CLASS(dir == nat_flow_out ? sr_prof_class_nat_out : sr_prof_class_nat_in);
+            SR_PROF_STAGE(sr_prof_stage_nat);
+            forward_nat(sr, packet, len, ip_hdr);
+            return;
+        }
+        SR_STATS_INC(sr_stat_nat_flow_miss);
+    }
+
     /* check if packet's destination is this router */
     struct sr_if* out_interface = sr_get_interface_by_ip(sr, ip_hdr->ip_dst);
 
     struct sr_nat_mapping* mapping = NULL;
 
-    if(strncmp(interface, NAT_INT_INTF, sr_IFACE_NAMELEN) == 0) {
+    if(interface == sr->nat_int_if) {
         printf("Packet coming from NAT internal interface.\n");
+        SR_PROF_CLASS(out_interface ? sr_prof_class_local : sr_prof_class_nat_out);
+        SR_PROF_STAGE(sr_prof_stage_parse);
 
         if(out_interface) {
             /* client -[packet]-> router */
             printf("Packet destined to this router.\n");
-            
+            sr_flight_verdict(&sr->flight, sr_flight_local, "port unreachable");
+
             send_icmp_msg(sr, packet, len, icmp_type_dest_unreachable, icmp_dest_unreachable_port);
         } else {
             /* client -[packet]-> server */
             printf("Packet destined elsewhere.\n");
 
             /* to determine the NAT external IP addr later, NAT's external interface is necessary */
-            struct sr_if* ext_interface = sr_get_interface(sr, NAT_EXT_INTF);
+            struct sr_if* ext_interface = sr->nat_ext_if;
 
             switch(ip_hdr->ip_p) {
                 case ip_protocol_icmp: {
                     printf("Packet is an ICMP message.\n");
 
                     if(verify_icmp(packet, len) == -1) {
+                        drop_packet(sr, sr_drop_bad_icmp);
                         return;
                     }
+                    SR_PROF_STAGE(sr_prof_stage_parse);
 
                     sr_icmp_hdr_t* icmp_hdr = (sr_icmp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
 
                     /* lookup the mapping associated with client's IP and ICMP ID*/
                     mapping = sr_nat_lookup_internal(&(sr->nat), ip_hdr->ip_src, icmp_hdr->icmp_id, nat_mapping_icmp);
+                    SR_STATS_INC(mapping ? sr_stat_nat_hit : sr_stat_nat_miss);
 
                     /* if not mapped before, insert new map entry */
                     if(!mapping) {
                         mapping = sr_nat_insert_mapping(&(sr->nat), ip_hdr->ip_src, icmp_hdr->icmp_id, nat_mapping_icmp);
+                        if(!mapping) {
+                            printf("Error: handle_ip_nat: no free external ICMP id.\n");
+                            drop_packet(sr, sr_drop_nat_no_port);
+                            return;
+                        }
                         mapping->ip_ext = ext_interface->ip;
-                        mapping->last_updated = time(NULL);
+                        mapping->last_updated = sr_clock_now();
                     }
+                    SR_PROF_STAGE(sr_prof_stage_nat);
 
                     /* modify ICMP header: change ICMP ID and checksum */
                     icmp_hdr->icmp_id = mapping->aux_ext;
                     icmp_hdr->icmp_sum = 0;
                     icmp_hdr->icmp_sum = cksum(icmp_hdr, len - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t));
+                    SR_PROF_STAGE(sr_prof_stage_cksum);
 
                     break;
                 }
@@ -423,86 +518,83 @@ void handle_ip_nat(struct sr_instance *sr, uint8_t *packet, unsigned int len, ch
                     sr_tcp_hdr_t* tcp_hdr = (sr_tcp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
 
                     if(verify_tcp(packet, len) == -1) {
+                        drop_packet(sr, sr_drop_bad_tcp);
                         return;
                     }
+                    SR_PROF_STAGE(sr_prof_stage_parse);
 
                     /* lookup the mapping associated with client's IP and TCP source port */
                     mapping = sr_nat_lookup_internal(&(sr->nat), ip_hdr->ip_src, ntohs(tcp_hdr->src_port), nat_mapping_tcp);
+                    SR_STATS_INC(mapping ? sr_stat_nat_hit : sr_stat_nat_miss);
 
                     /* if not mapped before, insert new map entry */
                     if(!mapping) {
                         mapping = sr_nat_insert_mapping(&(sr->nat), ip_hdr->ip_src, ntohs(tcp_hdr->src_port), nat_mapping_tcp);
+                        if(!mapping) {
+                            printf("Error: handle_ip_nat: no free external port.\n");
+                            drop_packet(sr, sr_drop_nat_no_port);
+                            return;
+                        }
                         mapping->ip_ext = ext_interface->ip;
-                        mapping->last_updated = time(NULL);
+                        mapping->last_updated = sr_clock_now();
                     }
 
                     pthread_mutex_lock(&(sr->nat.lock));
 
+                    /* 'mapping' is a copy; connection state lives in the table's entry */
+                    struct sr_nat_mapping* entry = sr_nat_get_mapping(&(sr->nat), mapping->aux_ext, nat_mapping_tcp);
+                    if(!entry) {
+                        pthread_mutex_unlock(&(sr->nat.lock));
+                        drop_packet(sr, sr_drop_nat_expired);
+                        free(mapping);
+                        return;
+                    }
+
                     /* lookup the connection associated with client's IP */
-                    struct sr_nat_connection* conn = sr_nat_get_conn(mapping, ip_hdr->ip_dst);
+                    struct sr_nat_connection* conn = sr_nat_get_conn(entry, ip_hdr->ip_dst);
 
                     /* if not exist before, add new connection */
                     if(!conn) {
-                        conn = sr_nat_add_conn(mapping, ip_hdr->ip_dst);
+                        conn = sr_nat_add_conn(entry, ip_hdr->ip_dst);
                     }
+                    conn->last_updated = sr_clock_now();
 
-                    switch(conn->tcp_state) {
-                        case tcp_established: {
-                            /* if FIN and it is ACKed, change the connection state to CLOSED */
-                            /* server -[FIN]-> client */
-                            /* client -[FIN ACK]-> server */
-                            if(tcp_hdr->fin && tcp_hdr->ack) {
-                                conn->client_seq = ntohl(tcp_hdr->seq);
-                                conn->tcp_state = tcp_closed;
-                            }
-                            break;
-                        }
-                        case tcp_closed: {
-                            /* if SYN and !ACK, change the connection state to SYN_SENT */
-                            /* step 1 of three-way TCP handshake */
-                            /* client -[SYN]-> server */
-                            if(tcp_hdr->syn && !tcp_hdr->ack && ntohl(tcp_hdr->acknowledgment) == 0) {
-                                conn->client_seq = ntohl(tcp_hdr->seq);
-                                conn->tcp_state = tcp_syn_sent;
-                            }
-                            break;
-                        }
-                        case tcp_syn_received: {
-                            /* if ACK and !SYN, change the connection state to ESTABLISHED */
-                            /* step 3 of three-way TCP handshake */
-                            /* client -[SYN]-> server */
-                            /* server -[SYN ACK]-> client */
-                            /* client -[ACK]-> server */
-                            if(tcp_hdr->ack && !tcp_hdr->syn && ntohl(tcp_hdr->seq) == conn->client_seq + 1 && ntohl(tcp_hdr->acknowledgment) == conn->server_seq + 1) {
-                                conn->client_seq = ntohl(tcp_hdr->seq);
-                                conn->tcp_state = tcp_established;
-                            }
-                            add_inbound_syn(&(sr->nat), ip_hdr->ip_src, tcp_hdr->src_port, packet, len);
-                            break;
-                        }
-                        default: {
-                            break;
-                        }
+                    sr_nat_tcp_track(&(sr->nat), entry, conn, nat_flow_out, packet, len);
+
+                    /* the rest of the flow can skip all of the above */
+                    if(conn->tcp_state == tcp_established && !tcp_hdr->syn && !tcp_hdr->fin && !tcp_hdr->rst) {
+                        sr_nat_flow_store(&(sr->nat), nat_flow_out, packet, ext_interface->ip, htons(mapping->aux_ext), entry, conn);
                     }
 
                     pthread_mutex_unlock(&(sr->nat.lock));
+                    SR_PROF_STAGE(sr_prof_stage_nat);
 
-                    /* modify TCP header: change source port and checksum */
+                    /* modify TCP header: change source port and checksum; the
+                       checksum covers the addresses, so take the new one first */
+                    ip_hdr->ip_src = ext_interface->ip;
                     tcp_hdr->src_port = htons(mapping->aux_ext);
                     tcp_hdr->checksum = 0;
                     tcp_hdr->checksum = tcp_hdr_cksum(packet, len);
+                    SR_PROF_STAGE(sr_prof_stage_cksum);
 
                     break;
                 }
+                default: {
+                    drop_packet(sr, sr_drop_unhandled);
+                    return;
+                }
             }
 
             /* modify IP header: change source IP and checksum */
             ip_hdr->ip_src = ext_interface->ip;
             ip_hdr->ip_sum = 0;
             ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+            SR_PROF_STAGE(sr_prof_stage_cksum);
         }
-    } else if(strncmp(interface, NAT_EXT_INTF, sr_IFACE_NAMELEN) == 0) {
+    } else if(interface == sr->nat_ext_if) {
         printf("Packet coming from NAT external interface.\n");
+        SR_PROF_CLASS(sr_prof_class_nat_in);
+        SR_PROF_STAGE(sr_prof_stage_parse);
 
         if(out_interface) {
             /* server -[packet]-> router */
@@ -513,24 +605,30 @@ void handle_ip_nat(struct sr_instance *sr, uint8_t *packet, unsigned int len, ch
                     printf("Packet is an ICMP message.\n");
 
                     if(verify_icmp(packet, len) == -1) {
+                        drop_packet(sr, sr_drop_bad_icmp);
                         return;
                     }
+                    SR_PROF_STAGE(sr_prof_stage_parse);
 
                     sr_icmp_hdr_t* icmp_hdr = (sr_icmp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
 
                     /* lookup the mapping associated with this ICMP ID */
                     mapping = sr_nat_lookup_external(&(sr->nat), icmp_hdr->icmp_id, nat_mapping_icmp);
+                    SR_STATS_INC(mapping ? sr_stat_nat_hit : sr_stat_nat_miss);
 
                     /* if not mapped, error */
                     if(!mapping) {
                         printf("Error: handle_ip_nat: cannot find ICMP mapping.\n");
+                        drop_packet(sr, sr_drop_no_nat_mapping);
                         return;
                     }
+                    SR_PROF_STAGE(sr_prof_stage_nat);
 
                     /* modify ICMP header: change ICMP ID and checksum */
                     icmp_hdr->icmp_id = mapping->aux_int;
                     icmp_hdr->icmp_sum = 0;
                     icmp_hdr->icmp_sum = cksum(icmp_hdr, len - sizeof(sr_ethernet_hdr_t) - sizeof(sr_ip_hdr_t));
+                    SR_PROF_STAGE(sr_prof_stage_cksum);
 
                     break;
                 }
@@ -540,84 +638,85 @@ void handle_ip_nat(struct sr_instance *sr, uint8_t *packet, unsigned int len, ch
                     sr_tcp_hdr_t* tcp_hdr = (sr_tcp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t));
 
                     if(verify_tcp(packet, len) == -1) {
+                        drop_packet(sr, sr_drop_bad_tcp);
                         return;
                     }
+                    SR_PROF_STAGE(sr_prof_stage_parse);
 
                     if(ntohs(tcp_hdr->dst_port) < MIN_NAT_PORT) {
                         printf("Error: handle_ip_nat: restricted TCP port.\n");
+                        drop_packet(sr, sr_drop_restricted_port);
                         send_icmp_msg(sr, packet, len, icmp_type_dest_unreachable, icmp_dest_unreachable_port);
                         return;
                     }
 
                     /* lookup the mapping associated with this TCP port */
                     mapping = sr_nat_lookup_external(&(sr->nat), ntohs(tcp_hdr->dst_port), nat_mapping_tcp);
+                    SR_STATS_INC(mapping ? sr_stat_nat_hit : sr_stat_nat_miss);
 
                     /* if not mapped, error */
                     if(!mapping) {
                         if(tcp_hdr->syn) {
-                            struct sr_rt* table_entry = (struct sr_rt*)longest_matching_prefix(sr, ip_hdr->ip_dst);
+                            struct sr_rt* table_entry = (struct sr_rt*)longest_matching_prefix(sr, ip_hdr->ip_dst, 0);
                             if(table_entry) {
-                                add_inbound_syn(&(sr->nat), ip_hdr->ip_src, tcp_hdr->dst_port, packet, len);
+                                add_inbound_syn(&(sr->nat), ip_hdr->ip_src, ntohs(tcp_hdr->dst_port), packet, len);
                             }
                         }
 
                         printf("Error: handle_ip_nat: cannot find TCP mapping.\n");
+                        drop_packet(sr, sr_drop_no_nat_mapping);
                         return;
                     }
 
                     pthread_mutex_lock(&(sr->nat.lock));
 
+                    /* 'mapping' is a copy; connection state lives in the table's entry */
+                    struct sr_nat_mapping* entry = sr_nat_get_mapping(&(sr->nat), mapping->aux_ext, nat_mapping_tcp);
+                    if(!entry) {
+                        pthread_mutex_unlock(&(sr->nat.lock));
+                        drop_packet(sr, sr_drop_nat_expired);
+                        free(mapping);
+                        return;
+                    }
+
                     /* lookup connection associated with server's IP */
-                    struct sr_nat_connection* conn = sr_nat_get_conn(mapping, ip_hdr->ip_src);
+                    struct sr_nat_connection* conn = sr_nat_get_conn(entry, ip_hdr->ip_src);
 
                     /* if not exist before, add new connection */
                     if(!conn) {
-                        conn = sr_nat_add_conn(mapping, ip_hdr->ip_src);
+                        conn = sr_nat_add_conn(entry, ip_hdr->ip_src);
                     }
+                    conn->last_updated = sr_clock_now();
 
-                    switch(conn->tcp_state) {
-                        case tcp_syn_sent: {
-                            if(tcp_hdr->syn) {
-                                /* if SYN and ACK, change the connection state to SYN_RECEIVED */
-                                /* step 2 of three-way TCP handshake */
-                                /* client -[SYN]-> server */
-                                /* server -[SYN ACK]-> client */
-                                if(tcp_hdr->ack && ntohl(tcp_hdr->acknowledgment) == conn->client_seq + 1) {
-                                    conn->server_seq = ntohl(tcp_hdr->seq);
-                                    conn->tcp_state = tcp_syn_received;
-                                } 
-                                /* if SYN and !ACK, change the connection state to SYN_RECEIVED */
-                                /* normal SYN */
-                                else if(!tcp_hdr->ack && ntohl(tcp_hdr->acknowledgment) == 0) {
-                                    conn->server_seq = ntohl(tcp_hdr->seq);
-                                    conn->tcp_state = tcp_syn_received;
-                                }
-                                add_inbound_syn(&(sr->nat), ip_hdr->ip_src, tcp_hdr->src_port, packet, len);
-                            }
-                            break;
-                        }
-                        case tcp_syn_received: {
-                            add_inbound_syn(&(sr->nat), ip_hdr->ip_src, tcp_hdr->src_port, packet, len);
-                            break;
-                        }
-                        default: {
-                            break;
-                        }
+                    sr_nat_tcp_track(&(sr->nat), entry, conn, nat_flow_in, packet, len);
+
+                    /* the rest of the flow can skip all of the above */
+                    if(conn->tcp_state == tcp_established && !tcp_hdr->syn && !tcp_hdr->fin && !tcp_hdr->rst) {
+                        sr_nat_flow_store(&(sr->nat), nat_flow_in, packet, mapping->ip_int, htons(mapping->aux_int), entry, conn);
                     }
 
                     pthread_mutex_unlock(&(sr->nat.lock));
+                    SR_PROF_STAGE(sr_prof_stage_nat);
 
-                    /* modify TCP header: change destination port and checksum */
+                    /* modify TCP header: change destination port and checksum; the
+                       checksum covers the addresses, so take the new one first */
+                    ip_hdr->ip_dst = mapping->ip_int;
                     tcp_hdr->dst_port = htons(mapping->aux_int);
                     tcp_hdr->checksum = 0;
                     tcp_hdr->checksum = tcp_hdr_cksum(packet, len);
+                    SR_PROF_STAGE(sr_prof_stage_cksum);
 
                     break;
                 }
+                default: {
+                    drop_packet(sr, sr_drop_unhandled);
+                    return;
+                }
             }
         } else {
             
             printf("Packet destined to elsewhere.\n");
+            drop_packet(sr, sr_drop_not_for_nat);
 
             return;
         }
@@ -626,6 +725,11 @@ void handle_ip_nat(struct sr_instance *sr, uint8_t *packet, unsigned int len, ch
         ip_hdr->ip_dst = mapping->ip_int;
         ip_hdr->ip_sum = 0;
         ip_hdr->ip_sum = cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+        SR_PROF_STAGE(sr_prof_stage_cksum);
+    } else {
+        /* neither side of the NAT */
+        drop_packet(sr, sr_drop_unhandled);
+        return;
     }
 
     /* if map entry exists in the mapping table */
@@ -638,31 +742,18 @@ void handle_ip_nat(struct sr_instance *sr, uint8_t *packet, unsigned int len, ch
         ip_hdr->ip_ttl--;
         if(ip_hdr->ip_ttl == 0) {
             printf("TTL decreased to zero.\n");
+            drop_packet(sr, sr_drop_ttl);
             send_icmp_msg(sr, packet, len, icmp_type_time_exceeded, (uint8_t)0);
+            free(mapping);
             return;
         }
 
         /* recalculate checksum */
         ip_hdr->ip_sum = 0;
         ip_hdr->ip_sum = cksum(ip_hdr, ip_hdr->ip_hl * 4);
+        SR_PROF_STAGE(sr_prof_stage_cksum);
 
-        /* lookup destination IP in routing table */
-        struct sr_rt* table_entry = longest_matching_prefix(sr, ip_hdr->ip_dst);
-        if(!table_entry) {
-            printf("Error: handle_ip: destination IP not existed in routing table.\n");
-            send_icmp_msg(sr, packet, len, icmp_type_dest_unreachable, icmp_dest_unreachable_net);
-            return;
-        }
-
-        /* find outgoing interface indicated by routing table entry */
-        struct sr_if* rt_out_interface = sr_get_interface(sr, table_entry->interface);
-        if(!rt_out_interface) {
-            printf("Error: handle_ip: interface \'%s\' not found.\n", table_entry->interface);
-            return;
-        }
-
-        send_packet(sr, packet, len, rt_out_interface, table_entry->gw.s_addr);
-
+        forward_nat(sr, packet, len, ip_hdr);
         free(mapping);
         return;
     }
@@ -694,13 +785,43 @@ void sr_handlepacket(struct sr_instance* sr,
     assert(packet);
     assert(interface);
 
+    /* the name is only for the wire: resolve it once, then work with
+       the interface itself */
+    struct sr_if* in_interface = sr_get_interface(sr, interface);
+    if(!in_interface) {
+        printf("Error: sr_handlepacket: unknown interface \'%s\'.\n", interface);
+        sr_flight_record(&sr->flight, sr_flight_rx, interface, packet, len);
+        drop_packet(sr, sr_drop_no_interface);
+        return;
+    }
+
+    sr_handlepacket_if(sr, packet, len, in_interface);
+}
+
+/* sr_handlepacket, for a receiving interface already looked up */
+void sr_handlepacket_if(struct sr_instance* sr,
+        uint8_t * packet/* lent */,
+        unsigned int len,
+        struct sr_if* interface/* lent */)
+{
+    /* REQUIRES */
+    assert(sr);
+    assert(packet);
+    assert(interface);
+
+    SR_PROF_BEGIN();
     printf("*** -> Received packet of length %d\n", len);
 
+    sr_flight_record(&sr->flight, sr_flight_rx, interface->name, packet, len);
+    sr_stats_rx(interface->index, len);
+
     /* fill in code here */
 
     /* sanity check the inbound Ethernet packet */
     if (len < sizeof(sr_ethernet_hdr_t)) {
         printf("Error: sr_handlepacket: Ethernet packet too short.\n");
+        drop_packet(sr, sr_drop_runt);
+        SR_PROF_END();
         return;
     }
 
@@ -719,6 +840,14 @@ void sr_handlepacket(struct sr_instance* sr,
             }
             break;
         }
+        default: {
+            drop_packet(sr, sr_drop_ethertype);
+            break;
+        }
     }
+
+    /* anything the handlers did not account for was silently ignored */
+    sr_flight_verdict(&sr->flight, sr_flight_dropped, "ignored");
+    SR_PROF_END();
 }/* end sr_ForwardPacket */
 
@@ -14,8 +14,13 @@
 #include <stdio.h>
 
 #include "sr_protocol.h"
+#include "sr_event.h"
 #include "sr_arpcache.h"
 #include "sr_nat.h"
+#include "sr_flight.h"
+#include "sr_nexthop.h"
+#include "sr_icmplimit.h"
+#include "sr_ctlpkt.h"
 
 /* we dont like this debug , but what to do for varargs ? */
 #ifdef _DEBUG_
@@ -34,6 +39,11 @@
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_dump_writer;
+struct sr_replay;
+struct sr_admin;
+struct sr_metrics;
+struct sr_shmstats;
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -51,13 +61,30 @@ struct sr_instance
     unsigned short topo_id;
     struct sockaddr_in sr_addr; /* address to server */
     struct sr_if* if_list; /* list of interfaces */
-    struct sr_rt* routing_table; /* routing table */
+    struct sr_if* ifaces[SR_IF_MAX]; /* the same, by index */
+    unsigned int nifaces;
+    struct sr_if_ip_slot if_by_ip[SR_IF_HASH_SZ];   /* see sr_if.h */
+    struct sr_if_mac_slot if_by_mac[SR_IF_HASH_SZ];
+    struct sr_rtable* volatile rtable; /* routing table, swapped on reload */
+    char rt_file[256];           /* where it came from */
+    char rt_snap[256];           /* binary snapshot of it, "" if none */
+    volatile uint32_t rt_gen;    /* bumped when routes or interfaces change */
+    struct sr_nh_cache nh;       /* resolved next hops, see sr_nexthop.h */
+    struct sr_icmp_limit icmp_limit; /* on generated ICMP errors, see sr_icmplimit.h */
+    struct sr_ctl ctl;           /* control packet templates and buffers, see sr_ctlpkt.h */
     struct sr_arpcache cache;   /* ARP cache */
-    pthread_attr_t attr;
-    FILE* logfile;
+    struct sr_event_loop evloop; /* drives socket I/O and all timers */
+    struct sr_dump_writer* logger; /* async pcap capture, NULL if off */
+    struct sr_flight flight;      /* last frames seen, dumped on demand */
+    struct sr_replay* replay;     /* offline pcap backend, NULL with VNS */
+    struct sr_admin* admin;       /* control socket thread, NULL if off */
+    struct sr_metrics* metrics;   /* Prometheus exporter thread, NULL if off */
+    struct sr_shmstats* shmstats; /* shared memory publisher, NULL if off */
 
     /* NAT */
     int nat_enabled;
+    struct sr_if* nat_int_if;     /* NAT_INT_INTF and NAT_EXT_INTF, once added */
+    struct sr_if* nat_ext_if;
     struct sr_nat nat;
 };
 
@@ -66,12 +93,14 @@ int sr_verify_routing_table(struct sr_instance* sr);
 
 /* -- sr_vns_comm.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+int sr_send_packet_if(struct sr_instance* , uint8_t* , unsigned int , struct sr_if*);
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
 void sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
+void sr_handlepacket_if(struct sr_instance* , uint8_t * , unsigned int , struct sr_if* );
 
 /* -- sr_if.c -- */
 void sr_add_interface(struct sr_instance* , const char* );
@@ -80,11 +109,11 @@ void sr_set_ether_addr(struct sr_instance* , const unsigned char* );
 void sr_print_if_list(struct sr_instance* );
 
 /* Custom methods */
-void send_packet(struct sr_instance*, uint8_t*, unsigned int, struct sr_if*, uint32_t);
+int send_packet(struct sr_instance*, uint8_t*, unsigned int, struct sr_if*, uint32_t);
 void send_icmp_msg(struct sr_instance*, uint8_t*, unsigned int, uint8_t, uint8_t);
-void handle_arp(struct sr_instance*, uint8_t*, unsigned int, char*);
-void handle_ip(struct sr_instance*, uint8_t*, unsigned int, char*);
-void handle_ip_nat(struct sr_instance*, uint8_t*, unsigned int, char*);
+void handle_arp(struct sr_instance*, uint8_t*, unsigned int, struct sr_if*);
+void handle_ip(struct sr_instance*, uint8_t*, unsigned int, struct sr_if*);
+void handle_ip_nat(struct sr_instance*, uint8_t*, unsigned int, struct sr_if*);
 
 
 #endif /* SR_ROUTER_H */
@@ -10,8 +10,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 #include <sys/socket.h>
@@ -21,36 +27,258 @@
 
 #include "sr_rt.h"
 #include "sr_router.h"
+#include "sr_rcu.h"
+#include "sr_rtsnap.h"
 
 #include "sr_utils.h"
 
-/* Custom method: find the routing table entry which has the longest matching prefix with the destination IP addr */
-struct sr_rt* longest_matching_prefix(struct sr_instance* sr, uint32_t ip) {
-    struct sr_rt* longest_prefix_entry = NULL;
+#define SR_RT_MIN_BITS 3
+
+static unsigned int sr_rt_hash(uint32_t key, unsigned int bits)
+{
+    return (unsigned int)((key * 0x9e3779b1U) >> (32 - bits));
+}
+
+/* Prefix length of a contiguous mask, or -1 */
+static int sr_rt_mask_len(uint32_t mask_nbo)
+{
+    uint32_t host = ~ntohl(mask_nbo);
+    int len = 32;
+
+    if(host & (host + 1))
+    { return -1; }
+    while(host)
+    {
+        host >>= 1;
+        len--;
+    }
+    return len;
+}
+
+static void sr_rt_level_insert(struct sr_rt_level* l, uint32_t key, uint32_t rt)
+{
+    unsigned int i = sr_rt_hash(key, l->bits);
+
+    while(l->slots[i].rt)
+    { i = (i + 1) & ((1U << l->bits) - 1); }
+    l->slots[i].key = key;
+    l->slots[i].rt = rt;
+}
+
+/* Double the slots once they are half full */
+static void sr_rt_level_grow(struct sr_rtable* t, struct sr_rt_level* l)
+{
+    struct sr_rt_slot* old = l->slots;
+    unsigned int n = old ? 1U << l->bits : 0;
+    unsigned int i;
+
+    l->bits = old ? l->bits + 1 : SR_RT_MIN_BITS;
+    l->slots = (struct sr_rt_slot*)calloc(1U << l->bits, sizeof(struct sr_rt_slot));
+    assert(l->slots);
+    for(i = 0; i < n; i++)
+    {
+        if(old[i].rt)
+        { sr_rt_level_insert(l, old[i].key, old[i].rt); }
+    }
+    /* slots mapped from a snapshot go with the mapping */
+    if((char*)old < (char*)t->map || (char*)old >= (char*)t->map + t->map_len)
+    { free(old); }
+}
+
+static uint32_t sr_rt_level_find(const struct sr_rt_level* l, uint32_t key)
+{
+    unsigned int i = sr_rt_hash(key, l->bits);
+
+    while(l->slots[i].rt)
+    {
+        if(l->slots[i].key == key)
+        { return l->slots[i].rt; }
+        i = (i + 1) & ((1U << l->bits) - 1);
+    }
+    return 0;
+}
+
+struct sr_rtable* sr_rtable_create(void)
+{
+    struct sr_rtable* t = (struct sr_rtable*)calloc(1, sizeof(struct sr_rtable));
+    assert(t);
+    return t;
+} /* -- sr_rtable_create -- */
+
+void sr_rtable_destroy(struct sr_rtable* t)
+{
+    unsigned int i;
+
+    if(!t)
+    { return; }
+    for(i = 0; i < t->nchunks; i++)
+    { free(t->chunks[i]); }
+    free(t->chunks);
+    for(i = 0; i <= 32; i++)
+    {
+        if((char*)t->level[i].slots < (char*)t->map ||
+           (char*)t->level[i].slots >= (char*)t->map + t->map_len)
+        { free(t->level[i].slots); }
+    }
+    if(t->map)
+    { munmap(t->map, t->map_len); }
+    free(t);
+} /* -- sr_rtable_destroy -- */
+
+/* Room for one more route at the end of 't', linked in after the last.
+   Routes never move once placed. */
+struct sr_rt* sr_rtable_new_route(struct sr_rtable* t)
+{
+    struct sr_rt* rt;
+
+    if((t->nroutes & (SR_RT_CHUNK - 1)) == 0)
+    {
+        /* chunk pointers double, and the array moves; safe because routes
+           are only added to a table before sr_rt_publish makes it visible
+           to other threads, and a published table never grows */
+        if((t->nchunks & (t->nchunks - 1)) == 0)
+        {
+            t->chunks = (struct sr_rt**)realloc(t->chunks,
+                            (t->nchunks ? 2 * t->nchunks : 1) * sizeof(struct sr_rt*));
+            assert(t->chunks);
+        }
+        t->chunks[t->nchunks] = (struct sr_rt*)malloc(SR_RT_CHUNK * sizeof(struct sr_rt));
+        assert(t->chunks[t->nchunks]);
+        t->nchunks++;
+    }
+    rt = sr_rtable_route(t, t->nroutes);
+    rt->next = 0;
+    if(t->last)
+    { t->last->next = rt; }
+    else
+    { t->routes = rt; }
+    t->last = rt;
+    t->nroutes++;
+    return rt;
+} /* -- sr_rtable_new_route -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rtable_add(..)
+ *
+ * Append a route to a table no reader can see yet, or to the live one
+ * from the forwarding thread.  A route to a prefix already in the table
+ * becomes one more equal-cost path to it.  Returns -1 if the mask is not
+ * contiguous.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rtable_add(struct sr_instance* sr, struct sr_rtable* t, struct in_addr dest,
+                  struct in_addr gw, struct in_addr mask, const char* if_name)
+{
+    struct sr_rt* rt;
+    struct sr_rt* path;
+    struct sr_rt_level* l;
+    struct sr_if* iface;
+    uint32_t key = dest.s_addr & mask.s_addr;
+    uint32_t first;
+    int len = sr_rt_mask_len(mask.s_addr);
+    unsigned int i;
+
+    /* -- REQUIRES -- */
+    assert(t);
+    assert(if_name);
+
+    if(len < 0)
+    { return -1; }
+
+    rt = sr_rtable_new_route(t);
+    rt->dest = dest;
+    rt->gw   = gw;
+    rt->mask = mask;
+    strncpy(rt->interface,if_name,sr_IFACE_NAMELEN);
+    iface = sr ? sr_get_interface(sr, if_name) : 0;
+    rt->ifindex = iface ? iface->index : SR_IF_NONE;
+    rt->alt = 0;
+    rt->npaths = 1;
+
+    l = &(t->level[len]);
+    if(l->nkeys == 0)
+    {
+        /* a new length: keep 'order' longest first */
+        l->mask = mask.s_addr;
+        for(i = t->nlevels; i > 0 && t->order[i - 1] < len; i--)
+        { t->order[i] = t->order[i - 1]; }
+        t->order[i] = (unsigned char)len;
+        t->nlevels++;
+    }
+    else if((first = sr_rt_level_find(l, key)) != 0)
+    {
+        /* another path to a known prefix: chain it on, every path
+           counting them all */
+        path = sr_rtable_route(t, first - 1);
+        for(;;)
+        {
+            path->npaths++;
+            if(!path->alt)
+            { break; }
+            path = sr_rtable_route(t, path->alt - 1);
+        }
+        rt->npaths = path->npaths;
+        path->alt = t->nroutes;
+        return 0;
+    }
+    if(2 * (l->nkeys + 1) > (l->slots ? 1U << l->bits : 0))
+    { sr_rt_level_grow(t, l); }
+    sr_rt_level_insert(l, key, t->nroutes);
+    l->nkeys++;
+    return 0;
+} /* -- sr_rtable_add -- */
+
+struct sr_rt* sr_rtable_lookup(const struct sr_rtable* t, uint32_t ip)
+{
+    const struct sr_rt_level* l;
+    uint32_t rt;
+    unsigned int i;
+
+    if(!t)
+    { return 0; }
+    for(i = 0; i < t->nlevels; i++)
+    {
+        l = &(t->level[t->order[i]]);
+        rt = sr_rt_level_find(l, ip & l->mask);
+        if(rt)
+        { return sr_rtable_route(t, rt - 1); }
+    }
+    return 0;
+} /* -- sr_rtable_lookup -- */
+
+/* The path a flow takes among those to the prefix 'rt' was found for */
+struct sr_rt* sr_rtable_path(const struct sr_rtable* t, struct sr_rt* rt, uint32_t flow)
+{
+    uint32_t k;
+
+    if(rt->npaths <= 1)
+    { return rt; }
+    for(k = sr_rt_pick(flow, rt->npaths); k > 0 && rt->alt; k--)
+    { rt = sr_rtable_route(t, rt->alt - 1); }
+    return rt;
+} /* -- sr_rtable_path -- */
 
-    char ip_string[15];
+/* Custom method: find the routing table entry which has the longest matching prefix with the destination IP addr */
+struct sr_rt* longest_matching_prefix(struct sr_instance* sr, uint32_t ip, uint32_t flow) {
+    char ip_string[INET_ADDRSTRLEN];
     addr_ip_int(ip_string, ntohl(ip));
     fprintf(stderr, "Finding longest prefix for %s ...\n", ip_string);
 
-    struct sr_rt* table_entry = sr->routing_table;
-    while(table_entry) {
-        /* check if the prefix matches our IP */
-        if((table_entry->dest.s_addr & table_entry->mask.s_addr) == (ip & table_entry->mask.s_addr)) {
-            /* check whether to update the longest_prefix_entry */
-            if(!longest_prefix_entry || table_entry->mask.s_addr > longest_prefix_entry->mask.s_addr) {
-                longest_prefix_entry = table_entry;
-            }
-        }
-        table_entry = table_entry->next;
+    /* one read of the pointer: a reload may swap it */
+    struct sr_rtable* table = sr->rtable;
+    struct sr_rt* longest_prefix_entry = sr_rtable_lookup(table, ip);
+    if(longest_prefix_entry) {
+        longest_prefix_entry = sr_rtable_path(table, longest_prefix_entry, flow);
     }
 
     /* print the result */
     if(longest_prefix_entry) {
-        char dest_string[15];
+        char dest_string[INET_ADDRSTRLEN];
         addr_ip_int(dest_string, ntohl(longest_prefix_entry->dest.s_addr));
-        char gw_string[15];
+        char gw_string[INET_ADDRSTRLEN];
         addr_ip_int(gw_string, ntohl(longest_prefix_entry->gw.s_addr));
-        char mask_string[15];
+        char mask_string[INET_ADDRSTRLEN];
         addr_ip_int(mask_string, ntohl(longest_prefix_entry->mask.s_addr));
         printf(
             "Found longest matching prefix: {dest:\"%s\",gw:\"%s\",mask:\"%s\",interface:\"%s\"}.\n",
@@ -66,15 +294,73 @@ struct sr_rt* longest_matching_prefix(struct sr_instance* sr, uint32_t ip) {
     return longest_prefix_entry;
 }
 
+/* Next whitespace-separated field of the line [*p, end) into 'out'
+   (truncated to 'size'); 0 at the end of the line */
+static int sr_rt_field(const char** p, const char* end, char* out, size_t size)
+{
+    const char* s = *p;
+    size_t n = 0;
+
+    while(s < end && (*s == ' ' || *s == '\t' || *s == '\r'))
+    { s++; }
+    if(s == end)
+    { return 0; }
+    while(s < end && *s != ' ' && *s != '\t' && *s != '\r')
+    {
+        if(n + 1 < size)
+        { out[n++] = *s; }
+        s++;
+    }
+    out[n] = '\0';
+    *p = s;
+    return 1;
+}
+
+/* Dotted quad to network byte order; anything else goes to inet_aton */
+static int sr_rt_ip(const char* s, struct in_addr* addr)
+{
+    const char* token = s;
+    uint32_t ip = 0, octet;
+    int parts;
+
+    for(parts = 0; parts < 4; parts++)
+    {
+        if(*s < '0' || *s > '9')
+        { return inet_aton(token, addr); }
+        for(octet = 0; *s >= '0' && *s <= '9' && octet <= 255; s++)
+        { octet = octet * 10 + (*s - '0'); }
+        if(octet > 255 || *s != (parts < 3 ? '.' : '\0'))
+        { return inet_aton(token, addr); }
+        ip = (ip << 8) | octet;
+        if(parts < 3)
+        { s++; }
+    }
+    addr->s_addr = htonl(ip);
+    return 1;
+}
+
 /*---------------------------------------------------------------------
- * Method:
+ * Method: sr_rt_parse(..)
+ *
+ * Read a routing table file into a new table.  NULL on error, with the
+ * reason printed.  The file is read whole and scanned once, by hand:
+ * sscanf and inet_aton per line were most of the cost of a large table.
+ * It is read rather than mapped, since it may be truncated under a
+ * reload by whoever is editing it; '*st' is filled in from the open file,
+ * and a file whose length changed while it was read is refused.
  *
  *---------------------------------------------------------------------*/
 
-int sr_load_rt(struct sr_instance* sr,const char* filename)
+static struct sr_rtable* sr_rt_parse(struct sr_instance* sr, const char* filename,
+                                     struct stat* st)
 {
-    FILE* fp;
-    char  line[BUFSIZ];
+    char* text;
+    size_t len = 0, cap;
+    ssize_t n;
+    const char* line;
+    const char* eol;
+    const char* end;
+    const char* p;
     char  dest[32];
     char  gw[32];
     char  mask[32];
@@ -82,53 +368,241 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
     struct in_addr dest_addr;
     struct in_addr gw_addr;
     struct in_addr mask_addr;
-    int clear_routing_table = 0;
+    struct sr_rtable* t;
+    int fd, lineno = 0, ok = 1;
 
     /* -- REQUIRES -- */
     assert(filename);
     if( access(filename,R_OK) != 0)
     {
         perror("access");
-        return -1;
+        return 0;
     }
 
-    fp = fopen(filename,"r");
+    fd = open(filename, O_RDONLY);
+    if(fd < 0)
+    {
+        perror("open(..):sr_rt.c::sr_rt_parse(..)");
+        return 0;
+    }
+    if(fstat(fd, st) != 0)
+    {
+        perror("fstat(..):sr_rt.c::sr_rt_parse(..)");
+        close(fd);
+        return 0;
+    }
+    /* one byte over, so a file that has not grown reads in one go */
+    cap = (size_t)st->st_size + 1;
+    text = (char*)malloc(cap);
+    assert(text);
+    for(;;)
+    {
+        if(len == cap)
+        {
+            cap *= 2;
+            text = (char*)realloc(text, cap);
+            assert(text);
+        }
+        n = read(fd, text + len, cap - len);
+        if(n < 0 && errno == EINTR)
+        { continue; }
+        if(n < 0)
+        {
+            perror("read(..):sr_rt.c::sr_rt_parse(..)");
+            free(text);
+            close(fd);
+            return 0;
+        }
+        if(n == 0)
+        { break; }
+        len += n;
+    }
+    close(fd);
+    if(len != (size_t)st->st_size)
+    {
+        fprintf(stderr, "Error loading routing table, %s changed while being read\n",
+                filename);
+        free(text);
+        return 0;
+    }
+    end = text + len;
+    t = sr_rtable_create();
 
-    while( fgets(line,BUFSIZ,fp) != 0)
+    for(line = text; line < end && ok; line = eol + 1)
     {
-        sscanf(line,"%s %s %s %s",dest,gw,mask,iface);
-        if(inet_aton(dest,&dest_addr) == 0)
+        eol = (const char*)memchr(line, '\n', end - line);
+        if(!eol)
+        { eol = end; }
+        lineno++;
+
+        p = line;
+        if(!sr_rt_field(&p, eol, dest, sizeof(dest)) ||
+           !sr_rt_field(&p, eol, gw, sizeof(gw)) ||
+           !sr_rt_field(&p, eol, mask, sizeof(mask)) ||
+           !sr_rt_field(&p, eol, iface, sizeof(iface)))
+        { continue; }  /* blank line */
+
+        ok = 0;
+        if(sr_rt_ip(dest,&dest_addr) == 0)
         { 
             fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    dest);
-            return -1; 
+                    "Error loading routing table, cannot convert %s to valid IP (line %d)\n",
+                    dest, lineno);
         }
-        if(inet_aton(gw,&gw_addr) == 0)
+        else if(sr_rt_ip(gw,&gw_addr) == 0)
         { 
             fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    gw);
-            return -1; 
+                    "Error loading routing table, cannot convert %s to valid IP (line %d)\n",
+                    gw, lineno);
         }
-        if(inet_aton(mask,&mask_addr) == 0)
+        else if(sr_rt_ip(mask,&mask_addr) == 0)
         { 
             fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    mask);
-            return -1; 
+                    "Error loading routing table, cannot convert %s to valid IP (line %d)\n",
+                    mask, lineno);
         }
-        if( clear_routing_table == 0 ){
-            printf("Loading routing table from server, clear local routing table.\n");
-            sr->routing_table = 0;
-            clear_routing_table = 1;
+        else if(sr_rtable_add(sr, t, dest_addr, gw_addr, mask_addr, iface) != 0)
+        {
+            fprintf(stderr,
+                    "Error loading routing table, %s is not a contiguous mask (line %d)\n",
+                    mask, lineno);
         }
-        sr_add_rt_entry(sr,dest_addr,gw_addr,mask_addr,iface);
-    } /* -- while -- */
+        else
+        { ok = 1; }
+    } /* -- for -- */
 
-    return 0; /* -- success -- */
+    free(text);
+    if(!ok)
+    {
+        sr_rtable_destroy(t);
+        t = 0;
+    }
+    return t;
+} /* -- sr_rt_parse -- */
+
+/* Swap 't' in, then free the old table once no reader can hold it */
+static void sr_rt_publish(struct sr_instance* sr, struct sr_rtable* t)
+{
+    struct sr_rtable* old = sr->rtable;
+
+    __sync_synchronize();
+    sr->rtable = t;
+    sr_nh_invalidate(sr);
+    sr_rcu_synchronize();
+    sr_rtable_destroy(old);
+}
+
+/*---------------------------------------------------------------------
+ * Method: sr_load_rt(..)
+ *
+ * Replace the routing table with the contents of 'filename', which is
+ * remembered for sr_rt_reload.  Returns the number of routes loaded, or
+ * -1 on error, when the table in use is kept.
+ * With a snapshot configured (sr_instance.rt_snap), a snapshot compiled
+ * from the file as it is now is mapped instead of parsing, and a parse
+ * writes a fresh one.
+ *
+ *---------------------------------------------------------------------*/
+
+static pthread_mutex_t sr_rt_reload_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int sr_load_rt(struct sr_instance* sr,const char* filename)
+{
+    struct sr_rtable* t = 0;
+    struct stat st;
+    int n;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(filename);
+
+    pthread_mutex_lock(&sr_rt_reload_lock);
+    memset(&st, 0, sizeof(st));
+    if(stat(filename, &st) == 0 && sr->rt_snap[0])
+    { t = sr_rtsnap_load(sr, sr->rt_snap, &st); }
+    if(!t)
+    {
+        /* the parse restamps 'st' from the file it actually read, which is
+           what the snapshot must describe */
+        t = sr_rt_parse(sr, filename, &st);
+        if(t && sr->rt_snap[0] && sr_rtsnap_save(t, sr->rt_snap, &st) != 0)
+        { fprintf(stderr, "Could not write routing table snapshot %s\n", sr->rt_snap); }
+    }
+    if(!t)
+    {
+        pthread_mutex_unlock(&sr_rt_reload_lock);
+        return -1;
+    }
+    if(sr->rtable)
+    { printf("Loading routing table from server, clear local routing table.\n"); }
+    /* counted now: once the lock is dropped, another reload may free 't' */
+    n = (int)t->nroutes;
+    sr_rt_publish(sr, t);
+    if(filename != sr->rt_file)
+    {
+        strncpy(sr->rt_file, filename, sizeof(sr->rt_file) - 1);
+        sr->rt_file[sizeof(sr->rt_file) - 1] = '\0';
+    }
+    pthread_mutex_unlock(&sr_rt_reload_lock);
+
+    return n; /* -- success -- */
 } /* -- sr_load_rt -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_rt_reload(..)
+ *
+ * Re-read the routing table file while forwarding goes on.  Returns the
+ * number of routes now in use, or -1 (the old table stays).
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_reload(struct sr_instance* sr)
+{
+    struct timespec start, end;
+    int n;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if(sr->rt_file[0] == '\0')
+    {
+        fprintf(stderr, "Routing table reload: not loaded from a file\n");
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    n = sr_load_rt(sr, sr->rt_file);
+    if(n < 0)
+    {
+        fprintf(stderr, "Routing table reload from %s failed, keeping the old one\n",
+                sr->rt_file);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stderr, "Routing table reloaded: %d routes from %s in %.1f ms\n", n,
+            sr->rt_file, (end.tv_sec - start.tv_sec) * 1e3 +
+            (end.tv_nsec - start.tv_nsec) / 1e6);
+    return n;
+} /* -- sr_rt_reload -- */
+
+static void* sr_rt_reload_main(void* arg)
+{
+    sr_rt_reload((struct sr_instance*)arg);
+    return 0;
+}
+
+/* Reload on a thread of its own, for callers on the forwarding loop */
+void sr_rt_reload_async(struct sr_instance* sr)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if(pthread_create(&thread, &attr, sr_rt_reload_main, sr) != 0)
+    { fprintf(stderr, "Error starting routing table reload thread\n"); }
+    pthread_attr_destroy(&attr);
+} /* -- sr_rt_reload_async -- */
+
 /*---------------------------------------------------------------------
  * Method:
  *
@@ -137,43 +611,45 @@ int sr_load_rt(struct sr_instance* sr,const char* filename)
 void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
 struct in_addr gw, struct in_addr mask,char* if_name)
 {
-    struct sr_rt* rt_walker = 0;
-
     /* -- REQUIRES -- */
     assert(if_name);
     assert(sr);
 
-    /* -- empty list special case -- */
-    if(sr->routing_table == 0)
+    if(sr->rtable == 0)
+    { sr->rtable = sr_rtable_create(); }
+    if(sr_rtable_add(sr, sr->rtable, dest, gw, mask, if_name) != 0)
     {
-        sr->routing_table = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-        assert(sr->routing_table);
-        sr->routing_table->next = 0;
-        sr->routing_table->dest = dest;
-        sr->routing_table->gw   = gw;
-        sr->routing_table->mask = mask;
-        strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
-
+        fprintf(stderr, "Not a contiguous mask: %s\n", inet_ntoa(mask));
         return;
     }
+    sr_nh_invalidate(sr);
 
-    /* -- find the end of the list -- */
-    rt_walker = sr->routing_table;
-    while(rt_walker->next){
-      rt_walker = rt_walker->next; 
-    }
+} /* -- sr_add_entry -- */
 
-    rt_walker->next = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-    assert(rt_walker->next);
-    rt_walker = rt_walker->next;
+/*---------------------------------------------------------------------
+ * Method: sr_rt_bind_interface(..)
+ *
+ * Point the routes through a newly added interface at its index.
+ *
+ *---------------------------------------------------------------------*/
 
-    rt_walker->next = 0;
-    rt_walker->dest = dest;
-    rt_walker->gw   = gw;
-    rt_walker->mask = mask;
-    strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
+void sr_rt_bind_interface(struct sr_instance* sr, struct sr_if* iface)
+{
+    struct sr_rt* rt_walker = 0;
 
-} /* -- sr_add_entry -- */
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(iface);
+
+    if(!sr->rtable)
+    { return; }
+    for(rt_walker = sr->rtable->routes; rt_walker; rt_walker = rt_walker->next)
+    {
+        if(strncmp(rt_walker->interface, iface->name, sr_IFACE_NAMELEN) == 0)
+        { rt_walker->ifindex = iface->index; }
+    }
+    sr_nh_invalidate(sr);
+} /* -- sr_rt_bind_interface -- */
 
 /*---------------------------------------------------------------------
  * Method:
@@ -184,7 +660,7 @@ void sr_print_routing_table(struct sr_instance* sr)
 {
     struct sr_rt* rt_walker = 0;
 
-    if(sr->routing_table == 0)
+    if(sr->rtable == 0 || sr->rtable->routes == 0)
     {
         printf(" *warning* Routing table empty \n");
         return;
@@ -192,7 +668,7 @@ void sr_print_routing_table(struct sr_instance* sr)
 
     printf("Destination\tGateway\t\tMask\tIface\n");
 
-    rt_walker = sr->routing_table;
+    rt_walker = sr->rtable->routes;
     
     sr_print_routing_entry(rt_walker);
     while(rt_walker->next)
@@ -7,6 +7,24 @@
  *
  * Methods and datastructures for handeling the routing table
  *
+ * The table in use (sr_instance.rtable) is read by the forwarding loop
+ * without a lock.  A reload (sr_rt_reload, on SIGHUP or the admin socket's
+ * "reload") parses the file into a new table on its own thread, swaps the
+ * pointer and frees the old table once the loop has passed a quiescent
+ * point (sr_rcu.h), so forwarding never waits on it.
+ *
+ * Lookups go through one hash table per prefix length, longest first, so
+ * they cost a probe per distinct length in use however many routes there
+ * are.  Masks must be contiguous.
+ *
+ * Several lines for the same destination and mask are equal-cost paths
+ * to it (ECMP).  A packet takes the path picked by its flow hash, so a
+ * flow stays on one path and different flows spread over all of them.
+ *
+ * Routes are stored in fixed chunks and the hash slots refer to them by
+ * index, so a table holds no pointers a file could not: the compiled
+ * table can be saved and mapped back in as it is (sr_rtsnap.h).
+ *
  *---------------------------------------------------------------------------*/
 
 #ifndef sr_RT_H
@@ -33,18 +51,78 @@ struct sr_rt
     struct in_addr gw;
     struct in_addr mask;
     char   interface[sr_IFACE_NAMELEN];
+    unsigned int ifindex;        /* SR_IF_NONE until the interface is added */
+    uint32_t alt;                /* next path to this prefix: index + 1, 0 if none */
+    uint32_t npaths;             /* paths to this prefix, 1 without ECMP */
     struct sr_rt* next;
 };
 
+/* ----------------------------------------------------------------------------
+ * struct sr_rtable
+ *
+ * A routing table: its routes in file order, and the same routes hashed on
+ * the masked destination by prefix length.
+ *
+ * -------------------------------------------------------------------------- */
+
+#define SR_RT_CHUNK_BITS 12
+#define SR_RT_CHUNK      (1 << SR_RT_CHUNK_BITS)   /* routes per chunk */
+
+struct sr_rt_slot
+{
+    uint32_t key;                /* dest & mask, network byte order */
+    uint32_t rt;                 /* route index + 1, 0 if the slot is free */
+};
+
+struct sr_rt_level
+{
+    uint32_t mask;               /* network byte order */
+    uint32_t bits;               /* log2 of the slot count */
+    uint32_t nkeys;
+    struct sr_rt_slot* slots;
+};
+
+struct sr_rtable
+{
+    struct sr_rt* routes;
+    struct sr_rt* last;
+    unsigned int nroutes;
+    struct sr_rt** chunks;       /* route i is chunks[i / SR_RT_CHUNK][i % SR_RT_CHUNK] */
+    unsigned int nchunks;
+    unsigned int nlevels;        /* prefix lengths in use, longest first */
+    unsigned char order[33];
+    struct sr_rt_level level[33]; /* by prefix length */
+    void* map;                   /* snapshot the slots may live in */
+    size_t map_len;
+};
+
+#define sr_rtable_route(t, i) \
+    (&((t)->chunks[(i) >> SR_RT_CHUNK_BITS][(i) & (SR_RT_CHUNK - 1)]))
+
+/* Which of 'n' equal-cost paths a flow hash takes */
+#define sr_rt_pick(flow, n) ((uint32_t)(((uint64_t)(uint32_t)(flow) * (n)) >> 32))
+
+
+struct sr_rtable* sr_rtable_create(void);
+void sr_rtable_destroy(struct sr_rtable*);
+struct sr_rt* sr_rtable_new_route(struct sr_rtable*);
+int sr_rtable_add(struct sr_instance*, struct sr_rtable*, struct in_addr,
+                  struct in_addr, struct in_addr, const char*);
+struct sr_rt* sr_rtable_lookup(const struct sr_rtable*, uint32_t);
+struct sr_rt* sr_rtable_path(const struct sr_rtable*, struct sr_rt*, uint32_t);
 
 int sr_load_rt(struct sr_instance*,const char*);
+int sr_rt_reload(struct sr_instance*);
+void sr_rt_reload_async(struct sr_instance*);
 void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
                   struct in_addr, char*);
+void sr_rt_bind_interface(struct sr_instance*, struct sr_if*);
 void sr_print_routing_table(struct sr_instance* sr);
 void sr_print_routing_entry(struct sr_rt* entry);
 
-/* Custom method */
-struct sr_rt* longest_matching_prefix(struct sr_instance*, uint32_t);
+/* Custom method; the last argument is the packet's flow hash, which picks
+   among equal-cost paths */
+struct sr_rt* longest_matching_prefix(struct sr_instance*, uint32_t, uint32_t);
 
 
 #endif  /* --  sr_RT_H -- */
@@ -0,0 +1,322 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rtsnap.c
+ *
+ * Description:
+ *
+ * Binary routing table snapshots.  See sr_rtsnap.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "sr_rtsnap.h"
+#include "sr_rt.h"
+#include "sr_router.h"
+
+#define SR_RTSNAP_BATCH 1024   /* routes converted per write */
+
+/* the checksum starts after its own field */
+#define SR_RTSNAP_SUM_FROM offsetof(struct sr_rtsnap_header, size)
+
+struct sr_rtsnap_sum
+{
+    uint64_t a;
+    uint64_t b;
+};
+
+/* Fletcher-64 over 32-bit words; 'len' is a multiple of 4 */
+static void sr_rtsnap_sum_add(struct sr_rtsnap_sum* sum, const void* data, size_t len)
+{
+    const uint32_t* w = (const uint32_t*)data;
+    uint64_t a = sum->a, b = sum->b;
+
+    for(len /= 4; len > 0; len--)
+    {
+        a += *w++;
+        b += a;
+    }
+    sum->a = a;
+    sum->b = b;
+}
+
+static uint64_t sr_rtsnap_sum_value(const struct sr_rtsnap_sum* sum)
+{
+    return (sum->b << 32) ^ sum->a;
+}
+
+/* nanoseconds where the platform keeps them, whole seconds elsewhere */
+static int64_t sr_rtsnap_mtime(const struct stat* st)
+{
+#if defined(_LINUX_)
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#elif defined(_DARWIN_)
+    return (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#else
+    return (int64_t)st->st_mtime * 1000000000;
+#endif
+}
+
+static size_t sr_rtsnap_routes_end(uint32_t nroutes)
+{
+    size_t end = sizeof(struct sr_rtsnap_header) +
+                 (size_t)nroutes * sizeof(struct sr_rtsnap_route);
+    return (end + 7) & ~(size_t)7;
+}
+
+/* Check everything the loader trusts before it touches a slot */
+static int sr_rtsnap_valid(const struct sr_rtsnap_header* h, size_t size,
+                           const struct stat* src)
+{
+    const struct sr_rtsnap_route* r;
+    const struct sr_rt_slot* slot;
+    struct sr_rtsnap_sum sum;
+    unsigned int i, nused = 0;
+    uint64_t j, nkeys;
+
+    if(size < sizeof(*h) || h->magic != SR_RTSNAP_MAGIC ||
+       h->version != SR_RTSNAP_VERSION || h->size != size)
+    { return 0; }
+    if(h->src_size != (int64_t)src->st_size || h->src_mtime_ns != sr_rtsnap_mtime(src))
+    { return 0; }   /* stale: the text file has changed since */
+    if(h->nlevels > 33 || sr_rtsnap_routes_end(h->nroutes) > size)
+    { return 0; }
+    for(i = 0; i < 33; i++)
+    {
+        if(h->level[i].nkeys == 0)
+        { continue; }
+        nused++;
+        if(h->level[i].bits > 31 || (h->level[i].offset & 7) ||
+           h->level[i].offset + ((uint64_t)sizeof(struct sr_rt_slot) << h->level[i].bits) > size)
+        { return 0; }
+    }
+    /* the lookup walks order[], longest prefix first, straight into the
+       levels: exactly the ones in use, each once */
+    if(nused != h->nlevels)
+    { return 0; }
+    for(i = 0; i < h->nlevels; i++)
+    {
+        if(h->order[i] > 32 || h->level[h->order[i]].nkeys == 0 ||
+           (i > 0 && h->order[i] >= h->order[i - 1]))
+        { return 0; }
+    }
+
+    memset(&sum, 0, sizeof(sum));
+    sr_rtsnap_sum_add(&sum, (const char*)h + SR_RTSNAP_SUM_FROM, size - SR_RTSNAP_SUM_FROM);
+    if(sr_rtsnap_sum_value(&sum) != h->checksum)
+    { return 0; }
+
+    /* a slot names its route by index, which the lookup follows blindly,
+       and a probe for a missing key only stops at a free slot: the keys
+       counted must be the ones there, with room left over */
+    for(i = 0; i < 33; i++)
+    {
+        if(h->level[i].nkeys == 0)
+        { continue; }
+        slot = (const struct sr_rt_slot*)((const char*)h + h->level[i].offset);
+        nkeys = 0;
+        for(j = 0; j < ((uint64_t)1 << h->level[i].bits); j++)
+        {
+            if(slot[j].rt > h->nroutes)
+            { return 0; }
+            if(slot[j].rt)
+            { nkeys++; }
+        }
+        if(nkeys != h->level[i].nkeys || nkeys >= ((uint64_t)1 << h->level[i].bits))
+        { return 0; }
+    }
+
+    /* a path chain is walked at most npaths - 1 links, each in range */
+    r = (const struct sr_rtsnap_route*)(h + 1);
+    for(j = 0; j < h->nroutes; j++, r++)
+    {
+        if(r->npaths == 0 || r->npaths > h->nroutes || r->alt > h->nroutes)
+        { return 0; }
+    }
+    return 1;
+}
+
+struct sr_rtable* sr_rtsnap_load(struct sr_instance* sr, const char* path,
+                                 const struct stat* src)
+{
+    const struct sr_rtsnap_header* h;
+    const struct sr_rtsnap_route* r;
+    struct sr_rtable* t;
+    struct sr_rt* rt;
+    struct sr_if* iface = 0;
+    struct stat st;
+    void* map;
+    uint32_t i;
+    int fd;
+
+    /* -- REQUIRES -- */
+    assert(path);
+    assert(src);
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+    { return 0; }
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*h))
+    {
+        close(fd);
+        return 0;
+    }
+    /* private and writable: routes added later copy the pages they touch */
+    map = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        perror("mmap(..):sr_rtsnap.c::sr_rtsnap_load(..)");
+        return 0;
+    }
+    h = (const struct sr_rtsnap_header*)map;
+    if(!sr_rtsnap_valid(h, st.st_size, src))
+    {
+        munmap(map, st.st_size);
+        return 0;
+    }
+
+    t = sr_rtable_create();
+    t->map = map;
+    t->map_len = st.st_size;
+
+    r = (const struct sr_rtsnap_route*)(h + 1);
+    for(i = 0; i < h->nroutes; i++, r++)
+    {
+        rt = sr_rtable_new_route(t);
+        rt->dest.s_addr = r->dest;
+        rt->gw.s_addr = r->gw;
+        rt->mask.s_addr = r->mask;
+        rt->alt = r->alt;         /* both checked by sr_rtsnap_valid */
+        rt->npaths = r->npaths;
+        memcpy(rt->interface, r->interface, sr_IFACE_NAMELEN);
+        rt->interface[sr_IFACE_NAMELEN - 1] = '\0';
+        /* routes come in runs through the same interface */
+        if(!iface || strncmp(iface->name, rt->interface, sr_IFACE_NAMELEN) != 0)
+        { iface = sr ? sr_get_interface(sr, rt->interface) : 0; }
+        rt->ifindex = iface ? iface->index : SR_IF_NONE;
+    }
+
+    t->nlevels = h->nlevels;
+    memcpy(t->order, h->order, sizeof(t->order));
+    for(i = 0; i < 33; i++)
+    {
+        if(h->level[i].nkeys == 0)
+        { continue; }
+        t->level[i].mask = h->level[i].mask;
+        t->level[i].bits = h->level[i].bits;
+        t->level[i].nkeys = h->level[i].nkeys;
+        t->level[i].slots = (struct sr_rt_slot*)((char*)map + h->level[i].offset);
+    }
+    return t;
+} /* -- sr_rtsnap_load -- */
+
+static int sr_rtsnap_write(FILE* fp, const void* data, size_t len,
+                           struct sr_rtsnap_sum* sum)
+{
+    sr_rtsnap_sum_add(sum, data, len);
+    return fwrite(data, 1, len, fp) == len ? 0 : -1;
+}
+
+int sr_rtsnap_save(const struct sr_rtable* t, const char* path,
+                   const struct stat* src)
+{
+    struct sr_rtsnap_header h;
+    struct sr_rtsnap_route batch[SR_RTSNAP_BATCH];
+    struct sr_rtsnap_sum sum;
+    const struct sr_rt* rt;
+    static const char zero[8];
+    char tmp[512];
+    uint64_t off;
+    size_t n = 0;
+    unsigned int i;
+    FILE* fp;
+    int err = 0;
+
+    /* -- REQUIRES -- */
+    assert(t);
+    assert(path);
+    assert(src);
+
+    memset(&h, 0, sizeof(h));
+    h.magic = SR_RTSNAP_MAGIC;
+    h.version = SR_RTSNAP_VERSION;
+    h.src_size = src->st_size;
+    h.src_mtime_ns = sr_rtsnap_mtime(src);
+    h.nroutes = t->nroutes;
+    h.nlevels = t->nlevels;
+    memcpy(h.order, t->order, sizeof(t->order));
+    off = sr_rtsnap_routes_end(t->nroutes);
+    for(i = 0; i < 33; i++)
+    {
+        if(t->level[i].nkeys == 0)
+        { continue; }
+        h.level[i].mask = t->level[i].mask;
+        h.level[i].bits = t->level[i].bits;
+        h.level[i].nkeys = t->level[i].nkeys;
+        h.level[i].offset = off;
+        off += (uint64_t)sizeof(struct sr_rt_slot) << t->level[i].bits;
+    }
+    h.size = off;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    fp = fopen(tmp, "w");
+    if(!fp)
+    {
+        perror("fopen(..):sr_rtsnap.c::sr_rtsnap_save(..)");
+        return -1;
+    }
+
+    /* room for the header, which is summed but written last */
+    if(fseek(fp, sizeof(h), SEEK_SET) != 0)
+    { err = -1; }
+    memset(&sum, 0, sizeof(sum));
+    sr_rtsnap_sum_add(&sum, (const char*)&h + SR_RTSNAP_SUM_FROM, sizeof(h) - SR_RTSNAP_SUM_FROM);
+
+    memset(batch, 0, sizeof(batch));
+    for(rt = t->routes; rt && !err; rt = rt->next)
+    {
+        batch[n].dest = rt->dest.s_addr;
+        batch[n].gw = rt->gw.s_addr;
+        batch[n].mask = rt->mask.s_addr;
+        batch[n].alt = rt->alt;
+        batch[n].npaths = rt->npaths;
+        strncpy(batch[n].interface, rt->interface, sr_IFACE_NAMELEN);
+        if(++n == SR_RTSNAP_BATCH || !rt->next)
+        {
+            err |= sr_rtsnap_write(fp, batch, n * sizeof(batch[0]), &sum);
+            n = 0;
+        }
+    }
+    off = sizeof(h) + (uint64_t)t->nroutes * sizeof(struct sr_rtsnap_route);
+    err |= sr_rtsnap_write(fp, zero, sr_rtsnap_routes_end(t->nroutes) - off, &sum);
+    for(i = 0; i < 33 && !err; i++)
+    {
+        if(t->level[i].nkeys)
+        {
+            err |= sr_rtsnap_write(fp, t->level[i].slots,
+                                   sizeof(struct sr_rt_slot) << t->level[i].bits, &sum);
+        }
+    }
+
+    /* the header goes in last, with the checksum of the rest */
+    h.checksum = sr_rtsnap_sum_value(&sum);
+    if(!err && (fseek(fp, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, fp) != 1))
+    { err = -1; }
+    if(fclose(fp) != 0)
+    { err = -1; }
+    if(!err && rename(tmp, path) != 0)
+    {
+        perror("rename(..):sr_rtsnap.c::sr_rtsnap_save(..)");
+        err = -1;
+    }
+    if(err)
+    { unlink(tmp); }
+    return err ? -1 : 0;
+} /* -- sr_rtsnap_save -- */
@@ -0,0 +1,83 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rtsnap.h
+ *
+ * Description:
+ *
+ * Binary snapshot of a compiled routing table (sr_rt.h), so a restart with
+ * a large table maps one file instead of parsing text.  The snapshot
+ * records the size and modification time of the text file it was built
+ * from, and is only used while they still match; the text file stays the
+ * source of truth.
+ *
+ * Layout, all in host byte order except addresses (network order):
+ *
+ *   header          struct sr_rtsnap_header
+ *   routes          nroutes x struct sr_rtsnap_route, in file order
+ *   (pad to 8)
+ *   slots           for each prefix length in use, the level's hash slots
+ *                   (struct sr_rt_slot) at level[len].offset
+ *
+ * A 64-bit Fletcher checksum covers everything after the checksum field.
+ * On load the slot arrays are used in place from a private mapping; only
+ * the routes are copied out, to resolve their interfaces.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RTSNAP_H
+#define SR_RTSNAP_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "sr_if.h"
+
+struct sr_instance;
+struct sr_rtable;
+
+#define SR_RTSNAP_MAGIC   0x53525254   /* "SRRT" */
+#define SR_RTSNAP_VERSION 2
+
+struct sr_rtsnap_route
+{
+    uint32_t dest;
+    uint32_t gw;
+    uint32_t mask;
+    uint32_t alt;                 /* as sr_rt */
+    uint32_t npaths;
+    char interface[sr_IFACE_NAMELEN];
+};
+
+struct sr_rtsnap_level
+{
+    uint32_t mask;
+    uint32_t bits;
+    uint32_t nkeys;               /* 0 if the length is not in use */
+    uint32_t pad;
+    uint64_t offset;              /* of the slots, from the file start */
+};
+
+struct sr_rtsnap_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t checksum;            /* of the rest of the file */
+    uint64_t size;                /* of the whole file */
+    int64_t src_size;             /* the text file compiled */
+    int64_t src_mtime_ns;
+    uint32_t nroutes;
+    uint32_t nlevels;
+    uint8_t order[40];            /* as sr_rtable.order */
+    struct sr_rtsnap_level level[33];
+};
+
+/* The table compiled from the text file described by 'src', or NULL if
+   the snapshot is missing, stale or damaged. */
+struct sr_rtable* sr_rtsnap_load(struct sr_instance* sr, const char* path,
+                                 const struct stat* src);
+
+/* Write 't' to 'path' (through a temporary file and rename, so a running
+   router's mapping of the old one stays good).  0 on success. */
+int sr_rtsnap_save(const struct sr_rtable* t, const char* path,
+                   const struct stat* src);
+
+#endif /* -- SR_RTSNAP_H -- */
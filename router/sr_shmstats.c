@@ -0,0 +1,218 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shmstats.c
+ *
+ * Description:
+ *
+ * Statistics in shared memory.  See sr_shmstats.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sr_shmstats.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_clock.h"
+
+#define SR_SHMSTATS_RETRIES 1000   /* a writer holds the lock for a memcpy */
+
+/* Copy one snapshot in.  Runs on the publisher thread only, so there is
+   exactly one writer. */
+static void sr_shmstats_publish(struct sr_shmstats* shm, struct sr_stats* prev,
+                                sr_msec_t* prev_ms)
+{
+    struct sr_shmstats_segment* seg = shm->seg;
+    struct sr_if* iface;
+    struct sr_stats st;
+    uint64_t rx = 0, tx = 0;
+    sr_msec_t now = sr_clock_refresh();
+    int i;
+
+    sr_stats_read(&st);
+    for(i = 0; i < SR_STATS_MAX_IFACES; i++)
+    {
+        rx += st.iface[i].rx_packets - prev->iface[i].rx_packets;
+        tx += st.iface[i].tx_packets - prev->iface[i].tx_packets;
+    }
+
+    seg->seq++;
+    __sync_synchronize();
+    seg->published_ms = now;
+    /* interfaces arrive from the server after we start, and never change
+       once they have */
+    for(iface = shm->sr->if_list; iface; iface = iface->next)
+    {
+        if(iface->index >= SR_STATS_MAX_IFACES)
+        { continue; }
+        strncpy(seg->iface_name[iface->index], iface->name, sr_IFACE_NAMELEN - 1);
+        if(iface->index >= seg->niface)
+        { seg->niface = iface->index + 1; }
+    }
+    if(now > *prev_ms)
+    {
+        seg->rx_pps = rx * 1000 / (now - *prev_ms);
+        seg->tx_pps = tx * 1000 / (now - *prev_ms);
+    }
+    memcpy(&(seg->stats), &st, sizeof(st));
+    __sync_synchronize();
+    seg->seq++;
+
+    *prev = st;
+    *prev_ms = now;
+} /* -- sr_shmstats_publish -- */
+
+static void* sr_shmstats_main(void* arg)
+{
+    struct sr_shmstats* shm = (struct sr_shmstats*)arg;
+    struct sr_stats prev;
+    sr_msec_t prev_ms = 0;
+    struct pollfd pfd;
+
+    memset(&prev, 0, sizeof(prev));
+    for(;;)
+    {
+        sr_shmstats_publish(shm, &prev, &prev_ms);
+
+        pfd.fd = shm->stop_fd[0];
+        pfd.events = POLLIN;
+        if(poll(&pfd, 1, shm->period_ms) < 0 && errno != EINTR)
+        {
+            perror("poll(..):sr_shmstats.c::sr_shmstats_main(..)");
+            break;
+        }
+        if(pfd.revents)
+        { break; }
+    }
+    return 0;
+} /* -- sr_shmstats_main -- */
+
+struct sr_shmstats* sr_shmstats_open(struct sr_instance* sr, const char* name,
+                                     unsigned int period_ms)
+{
+    struct sr_shmstats* shm;
+    struct sr_shmstats_segment* seg;
+    int fd;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(name);
+
+    if(name[0] != '/' || strlen(name) >= sizeof(shm->name))
+    {
+        fprintf(stderr, "Bad shared memory name (want /name): %s\n", name);
+        return 0;
+    }
+
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0)
+    {
+        perror("shm_open(..):sr_shmstats.c::sr_shmstats_open(..)");
+        return 0;
+    }
+    if(ftruncate(fd, sizeof(*seg)) != 0)
+    {
+        perror("ftruncate(..):sr_shmstats.c::sr_shmstats_open(..)");
+        close(fd);
+        shm_unlink(name);
+        return 0;
+    }
+    seg = (struct sr_shmstats_segment*)mmap(0, sizeof(*seg),
+                                            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(seg == MAP_FAILED)
+    {
+        perror("mmap(..):sr_shmstats.c::sr_shmstats_open(..)");
+        shm_unlink(name);
+        return 0;
+    }
+
+    /* the header is written once, magic last so readers never see a
+       half-made one */
+    seg->version = SR_SHMSTATS_VERSION;
+    seg->size = sizeof(*seg);
+    seg->period_ms = period_ms;
+    seg->pid = getpid();
+    __sync_synchronize();
+    seg->magic = SR_SHMSTATS_MAGIC;
+
+    shm = (struct sr_shmstats*)calloc(1, sizeof(struct sr_shmstats));
+    assert(shm);
+    shm->sr = sr;
+    shm->seg = seg;
+    strcpy(shm->name, name);
+    shm->period_ms = period_ms;
+
+    if(pipe(shm->stop_fd) != 0)
+    {
+        perror("pipe(..):sr_shmstats.c::sr_shmstats_open(..)");
+        munmap(seg, sizeof(*seg));
+        shm_unlink(name);
+        free(shm);
+        return 0;
+    }
+    if(pthread_create(&(shm->thread), 0, sr_shmstats_main, shm) != 0)
+    {
+        fprintf(stderr, "Error starting shared memory statistics thread\n");
+        close(shm->stop_fd[0]);
+        close(shm->stop_fd[1]);
+        munmap(seg, sizeof(*seg));
+        shm_unlink(name);
+        free(shm);
+        return 0;
+    }
+    return shm;
+} /* -- sr_shmstats_open -- */
+
+void sr_shmstats_close(struct sr_shmstats* shm)
+{
+    if(!shm)
+    { return; }
+
+    if(write(shm->stop_fd[1], "x", 1) != 1)
+    { perror("write(..):sr_shmstats.c::sr_shmstats_close(..)"); }
+    pthread_join(shm->thread, 0);
+
+    close(shm->stop_fd[0]);
+    close(shm->stop_fd[1]);
+    munmap(shm->seg, sizeof(*(shm->seg)));
+    shm_unlink(shm->name);
+    free(shm);
+} /* -- sr_shmstats_close -- */
+
+int sr_shmstats_snapshot(const struct sr_shmstats_segment* seg,
+                         struct sr_shmstats_segment* out)
+{
+    uint32_t seq;
+    int tries;
+
+    /* -- REQUIRES -- */
+    assert(seg);
+    assert(out);
+
+    if(seg->magic != SR_SHMSTATS_MAGIC || seg->version != SR_SHMSTATS_VERSION ||
+       seg->size != sizeof(*seg))
+    { return -1; }
+
+    for(tries = 0; tries < SR_SHMSTATS_RETRIES; tries++)
+    {
+        seq = seg->seq;
+        __sync_synchronize();
+        memcpy(out, (const void*)seg, sizeof(*out));
+        __sync_synchronize();
+        if((seq & 1) == 0 && seg->seq == seq)
+        { return 0; }
+        usleep(100);
+    }
+    /* a writer stuck or dead mid-copy: what we have may be torn */
+    return -1;
+} /* -- sr_shmstats_snapshot -- */
@@ -0,0 +1,79 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_shmstats.h
+ *
+ * Description:
+ *
+ * Statistics published in a POSIX shared-memory segment, for readers such
+ * as srstat that want the counters often without asking the router.
+ *
+ * A publisher thread sums the per-thread counters (sr_stats.h) once every
+ * period and copies them into the segment under a sequence lock: the
+ * sequence number is odd while a copy is in progress, so a reader copies
+ * the segment out, checks the number was even and unchanged across its
+ * copy, and retries otherwise.  Readers only ever map the segment read-only
+ * and nothing in the router runs per read.
+ *
+ * The layout is versioned; a reader must check magic, version and size
+ * before trusting anything else.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SHMSTATS_H
+#define SR_SHMSTATS_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "sr_protocol.h"
+#include "sr_stats.h"
+
+struct sr_instance;
+
+#define SR_SHMSTATS_MAGIC     0x53525354   /* "SRST" */
+#define SR_SHMSTATS_VERSION   1
+#define SR_SHMSTATS_NAME      "/sr_stats"
+#define SR_SHMSTATS_PERIOD_MS 100
+
+struct sr_shmstats_segment
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;                 /* sizeof(struct sr_shmstats_segment) */
+    uint32_t period_ms;            /* how often the router publishes */
+    int32_t pid;                   /* of the router */
+
+    volatile uint32_t seq;         /* odd while the fields below change */
+
+    uint64_t published_ms;         /* router's monotonic clock */
+    uint64_t rx_pps;               /* all interfaces, over the last period */
+    uint64_t tx_pps;
+    uint32_t niface;
+    char iface_name[SR_STATS_MAX_IFACES][sr_IFACE_NAMELEN]; /* by index */
+    struct sr_stats stats;
+};
+
+struct sr_shmstats
+{
+    struct sr_instance* sr;
+    struct sr_shmstats_segment* seg;
+    char name[64];
+    unsigned int period_ms;
+    int stop_fd[2];                /* pipe; written to stop the thread */
+    pthread_t thread;
+};
+
+/* Create segment 'name' (replacing a stale one), publish every 'period_ms'
+   and start the thread. Returns NULL on error. */
+struct sr_shmstats* sr_shmstats_open(struct sr_instance* sr, const char* name,
+                                     unsigned int period_ms);
+
+/* Stop the thread and remove the segment. */
+void sr_shmstats_close(struct sr_shmstats* shm);
+
+/* Reader side: copy a consistent snapshot of 'seg' into 'out'.  Returns 0,
+   or -1 if the layout is not one this build understands or no consistent
+   copy could be had while the writer was updating it. */
+int sr_shmstats_snapshot(const struct sr_shmstats_segment* seg,
+                         struct sr_shmstats_segment* out);
+
+#endif /* -- SR_SHMSTATS_H -- */
@@ -0,0 +1,196 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.c
+ *
+ * Description:
+ *
+ * Per-thread counters and drop reasons.  See sr_stats.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "sr_stats.h"
+#include "sr_router.h"
+#include "sr_if.h"
+
+__thread struct sr_stats_thread* sr_stats_self = 0;
+
+/* every thread's block; threads only ever prepend */
+static struct sr_stats_thread* sr_stats_threads = 0;
+static pthread_mutex_t sr_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* sr_stat_counter_names[sr_stat_ncounters] = {
+    "nat hit", "nat miss", "nat insert", "nat expire",
+    "arp hit", "arp miss", "arp queue drop",
+    "nexthop hit", "nexthop miss", "nat flow hit", "nat flow miss",
+    "nat syn drop", "icmp unreach limited", "icmp exceeded limited"
+};
+
+static const char* sr_stat_gauge_names[sr_stat_ngauges] = {
+    "nat icmp mappings", "nat tcp mappings", "nat held syns",
+    "arp entries", "arp requests", "arp queued"
+};
+
+/* also the flight recorder's drop comments, so they match the old strings */
+static const char* sr_drop_reason_names[sr_drop_nreasons] = {
+    "runt frame",
+    "unknown ethertype",
+    "bad ip header",
+    "bad icmp",
+    "bad tcp",
+    "ttl expired",
+    "no route",
+    "no interface",
+    "no nat mapping",
+    "restricted port",
+    "nat mapping expired",
+    "not for nat",
+    "nat: no free port",
+    "arp: not ethernet",
+    "arp: not ipv4",
+    "arp: target not local",
+    "arp: unresolved",
+    "arp: no interface",
+    "icmp: no route",
+    "unhandled"
+};
+
+struct sr_stats_thread* sr_stats_attach(void)
+{
+    struct sr_stats_thread* t;
+
+    if(sr_stats_self)
+    { return sr_stats_self; }
+
+    if(posix_memalign((void**)&t, SR_STATS_CACHELINE, sizeof(*t)) != 0)
+    {
+        perror("posix_memalign(..):sr_stats.c::sr_stats_attach(..)");
+        abort();
+    }
+    memset(t, 0, sizeof(*t));
+
+    pthread_mutex_lock(&sr_stats_lock);
+    t->next = sr_stats_threads;
+    sr_stats_threads = t;
+    pthread_mutex_unlock(&sr_stats_lock);
+
+    sr_stats_self = t;
+    return t;
+} /* -- sr_stats_attach -- */
+
+void sr_stats_rx(unsigned int idx, unsigned int len)
+{
+    struct sr_stats_iface* i;
+
+    if(idx >= SR_STATS_MAX_IFACES)
+    { return; }
+    i = &(SR_STATS_LOCAL()->s.iface[idx]);
+    i->rx_packets++;
+    i->rx_bytes += len;
+}
+
+void sr_stats_tx(unsigned int idx, unsigned int len)
+{
+    struct sr_stats_iface* i;
+
+    if(idx >= SR_STATS_MAX_IFACES)
+    { return; }
+    i = &(SR_STATS_LOCAL()->s.iface[idx]);
+    i->tx_packets++;
+    i->tx_bytes += len;
+}
+
+const char* sr_drop_reason_name(enum sr_drop_reason reason)
+{
+    return reason < sr_drop_nreasons ? sr_drop_reason_names[reason] : "?";
+}
+
+const char* sr_stat_counter_name(enum sr_stat_counter counter)
+{
+    return counter < sr_stat_ncounters ? sr_stat_counter_names[counter] : "?";
+}
+
+const char* sr_stat_gauge_name(enum sr_stat_gauge gauge)
+{
+    return gauge < sr_stat_ngauges ? sr_stat_gauge_names[gauge] : "?";
+}
+
+void sr_stats_read(struct sr_stats* out)
+{
+    struct sr_stats_thread* t;
+    int i;
+
+    /* -- REQUIRES -- */
+    assert(out);
+
+    memset(out, 0, sizeof(*out));
+
+    /* owners keep counting while we add; every counter is a single aligned
+       word, so each one read is a value it actually had */
+    pthread_mutex_lock(&sr_stats_lock);
+    for(t = sr_stats_threads; t; t = t->next)
+    {
+        for(i = 0; i < sr_stat_ncounters; i++)
+        { out->counter[i] += t->s.counter[i]; }
+        for(i = 0; i < sr_stat_ngauges; i++)
+        { out->gauge[i] += t->s.gauge[i]; }
+        for(i = 0; i < sr_drop_nreasons; i++)
+        { out->drops[i] += t->s.drops[i]; }
+        for(i = 0; i < SR_STATS_MAX_IFACES; i++)
+        {
+            out->iface[i].rx_packets += t->s.iface[i].rx_packets;
+            out->iface[i].rx_bytes   += t->s.iface[i].rx_bytes;
+            out->iface[i].tx_packets += t->s.iface[i].tx_packets;
+            out->iface[i].tx_bytes   += t->s.iface[i].tx_bytes;
+        }
+    }
+    pthread_mutex_unlock(&sr_stats_lock);
+} /* -- sr_stats_read -- */
+
+void sr_stats_print(FILE* fp, struct sr_instance* sr)
+{
+    struct sr_stats st;
+    struct sr_if* iface;
+    int i;
+
+    /* -- REQUIRES -- */
+    assert(fp);
+    assert(sr);
+
+    sr_stats_read(&st);
+
+    fprintf(fp, "%-8s %12s %14s %12s %14s\n",
+            "iface", "rx packets", "rx bytes", "tx packets", "tx bytes");
+    for(iface = sr->if_list; iface; iface = iface->next)
+    {
+        if(iface->index >= SR_STATS_MAX_IFACES)
+        { continue; }
+        fprintf(fp, "%-8s %12llu %14llu %12llu %14llu\n", iface->name,
+                (unsigned long long)st.iface[iface->index].rx_packets,
+                (unsigned long long)st.iface[iface->index].rx_bytes,
+                (unsigned long long)st.iface[iface->index].tx_packets,
+                (unsigned long long)st.iface[iface->index].tx_bytes);
+    }
+    for(i = 0; i < sr_stat_ncounters; i++)
+    {
+        fprintf(fp, "%-24s %12llu\n", sr_stat_counter_names[i],
+                (unsigned long long)st.counter[i]);
+    }
+    for(i = 0; i < sr_stat_ngauges; i++)
+    {
+        fprintf(fp, "%-24s %12lld\n", sr_stat_gauge_names[i],
+                (long long)st.gauge[i]);
+    }
+    for(i = 0; i < sr_drop_nreasons; i++)
+    {
+        if(st.drops[i] == 0)
+        { continue; }
+        fprintf(fp, "drop: %-18s %12llu\n", sr_drop_reason_names[i],
+                (unsigned long long)st.drops[i]);
+    }
+    fflush(fp);
+} /* -- sr_stats_print -- */
@@ -0,0 +1,129 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_stats.h
+ *
+ * Description:
+ *
+ * Packet, NAT and ARP counters, per-interface traffic and a count for every
+ * reason the router discards a packet.  Gauges (table sizes, queue depths)
+ * are kept the same way, as per-thread sums of +1/-1 changes.
+ *
+ * Each thread that touches a counter gets its own block, aligned to and
+ * padded out to whole cache lines, and increments it with plain adds: no
+ * atomics or shared lines on the packet path.  sr_stats_read() sums the
+ * blocks of every thread when somebody wants the numbers.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_STATS_H
+#define SR_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct sr_instance;
+
+#define SR_STATS_CACHELINE  64
+#define SR_STATS_MAX_IFACES 16   /* interfaces past this are not counted */
+
+enum sr_stat_counter {
+    sr_stat_nat_hit = 0,         /* packet matched a NAT mapping */
+    sr_stat_nat_miss,
+    sr_stat_nat_insert,
+    sr_stat_nat_expire,          /* mapping removed by its idle timer */
+    sr_stat_arp_hit,
+    sr_stat_arp_miss,            /* packet queued behind an ARP request */
+    sr_stat_arp_queue_drop,      /* queued packet given up on */
+    sr_stat_nh_hit,              /* forwarded on a cached next hop */
+    sr_stat_nh_miss,
+    sr_stat_nat_flow_hit,        /* TCP rewritten from the NAT flow cache */
+    sr_stat_nat_flow_miss,       /* TCP through the connection state machine */
+    sr_stat_nat_syn_drop,        /* unsolicited SYN not held, or pushed out */
+    sr_stat_icmp_unreach_limited, /* generated ICMP error rate limited */
+    sr_stat_icmp_exceeded_limited,
+    sr_stat_ncounters
+};
+
+enum sr_stat_gauge {
+    sr_gauge_nat_icmp = 0,       /* ICMP mappings in the NAT table */
+    sr_gauge_nat_tcp,
+    sr_gauge_nat_syns,           /* unsolicited inbound SYNs held */
+    sr_gauge_arp_entries,        /* valid ARP cache entries */
+    sr_gauge_arp_requests,       /* next hops being resolved */
+    sr_gauge_arp_queued,         /* packets waiting on them */
+    sr_stat_ngauges
+};
+
+enum sr_drop_reason {
+    sr_drop_runt = 0,
+    sr_drop_ethertype,
+    sr_drop_bad_ip,
+    sr_drop_bad_icmp,
+    sr_drop_bad_tcp,
+    sr_drop_ttl,
+    sr_drop_no_route,
+    sr_drop_no_interface,
+    sr_drop_no_nat_mapping,
+    sr_drop_restricted_port,
+    sr_drop_nat_expired,
+    sr_drop_not_for_nat,
+    sr_drop_nat_no_port,         /* every external port or id is mapped */
+    sr_drop_arp_not_ethernet,
+    sr_drop_arp_not_ipv4,
+    sr_drop_arp_not_local,
+    sr_drop_arp_unresolved,      /* next hop never answered */
+    sr_drop_arp_no_interface,
+    sr_drop_icmp_no_route,       /* generated ICMP error had no route back */
+    sr_drop_unhandled,           /* addressed to us, nothing handles it */
+    sr_drop_nreasons
+};
+
+struct sr_stats_iface
+{
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+};
+
+struct sr_stats
+{
+    uint64_t counter[sr_stat_ncounters];
+    int64_t gauge[sr_stat_ngauges];        /* only the sum means anything */
+    uint64_t drops[sr_drop_nreasons];
+    struct sr_stats_iface iface[SR_STATS_MAX_IFACES];
+};
+
+struct sr_stats_thread
+{
+    struct sr_stats s;
+    struct sr_stats_thread* next;
+} __attribute__((aligned(SR_STATS_CACHELINE)));
+
+extern __thread struct sr_stats_thread* sr_stats_self;
+
+/* Allocate and register the calling thread's block. */
+struct sr_stats_thread* sr_stats_attach(void);
+
+#define SR_STATS_LOCAL() \
+    (sr_stats_self ? sr_stats_self : sr_stats_attach())
+
+#define SR_STATS_INC(c)    (SR_STATS_LOCAL()->s.counter[c]++)
+#define SR_STATS_DROP(r)   (SR_STATS_LOCAL()->s.drops[r]++)
+#define SR_STATS_GAUGE(g, delta) (SR_STATS_LOCAL()->s.gauge[g] += (delta))
+
+/* Count a frame received or sent on the interface with index 'idx'. */
+void sr_stats_rx(unsigned int idx, unsigned int len);
+void sr_stats_tx(unsigned int idx, unsigned int len);
+
+/* Short static description of a drop reason. */
+const char* sr_drop_reason_name(enum sr_drop_reason reason);
+const char* sr_stat_counter_name(enum sr_stat_counter counter);
+const char* sr_stat_gauge_name(enum sr_stat_gauge gauge);
+
+/* Sum every thread's counters into 'out'. */
+void sr_stats_read(struct sr_stats* out);
+
+/* Print the summed counters, with interface names from 'sr'. */
+void sr_stats_print(FILE* fp, struct sr_instance* sr);
+
+#endif /* -- SR_STATS_H -- */
@@ -0,0 +1,216 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.c
+ *
+ * Description:
+ *
+ * Hierarchical timing wheel.  See sr_timer.h.
+ *
+ * Level 0 has one slot per tick for the next 64 ticks; level N slots each
+ * cover 64^N ticks.  When level 0 wraps, the current slot of level 1 is
+ * re-added (and so on up the levels), which moves its timers to a finer
+ * level.  Each tick therefore touches one level-0 slot, plus an occasional
+ * cascade, no matter how many timers are pending.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <assert.h>
+
+#include "sr_timer.h"
+
+#define SR_TIMER_MAX_TICKS \
+    (((uint64_t)1 << (SR_TIMER_LVL_BITS * SR_TIMER_LEVELS)) - 1)
+
+static void sr_timer_list_init(struct sr_timer* head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static void sr_timer_link(struct sr_timer* head, struct sr_timer* timer)
+{
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void sr_timer_unlink(struct sr_timer* timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = 0;
+    timer->prev = 0;
+}
+
+/* move every timer on 'from' to the (empty) list 'to' */
+static void sr_timer_splice(struct sr_timer* from, struct sr_timer* to)
+{
+    sr_timer_list_init(to);
+    if(from->next == from)
+    { return; }
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    sr_timer_list_init(from);
+}
+
+/* place a timer in the slot matching its expiry, relative to wheel->tick */
+static void sr_timer_place(struct sr_timer_wheel* wheel, struct sr_timer* timer)
+{
+    uint64_t expires = timer->expires;
+    uint64_t delta = expires - wheel->tick;
+    struct sr_timer* head;
+
+    if((int64_t)delta < 0)
+    {
+        /* already due: run on the next tick */
+        head = &wheel->slots[0][wheel->tick & SR_TIMER_LVL_MASK];
+    }
+    else if(delta < ((uint64_t)1 << SR_TIMER_LVL_BITS))
+    {
+        head = &wheel->slots[0][expires & SR_TIMER_LVL_MASK];
+    }
+    else if(delta < ((uint64_t)1 << (2 * SR_TIMER_LVL_BITS)))
+    {
+        head = &wheel->slots[1][(expires >> SR_TIMER_LVL_BITS) & SR_TIMER_LVL_MASK];
+    }
+    else if(delta < ((uint64_t)1 << (3 * SR_TIMER_LVL_BITS)))
+    {
+        head = &wheel->slots[2][(expires >> (2 * SR_TIMER_LVL_BITS)) & SR_TIMER_LVL_MASK];
+    }
+    else
+    {
+        if(delta > SR_TIMER_MAX_TICKS)
+        {
+            expires = wheel->tick + SR_TIMER_MAX_TICKS;
+            timer->expires = expires;
+        }
+        head = &wheel->slots[3][(expires >> (3 * SR_TIMER_LVL_BITS)) & SR_TIMER_LVL_MASK];
+    }
+
+    sr_timer_link(head, timer);
+}
+
+/* re-place every timer of one slot; returns the slot index */
+static int sr_timer_cascade(struct sr_timer_wheel* wheel, int level, int index)
+{
+    struct sr_timer list;
+    struct sr_timer* timer;
+
+    sr_timer_splice(&wheel->slots[level][index], &list);
+    while(list.next != &list)
+    {
+        timer = list.next;
+        sr_timer_unlink(timer);
+        sr_timer_place(wheel, timer);
+    }
+    return index;
+}
+
+void sr_timer_wheel_init(struct sr_timer_wheel* wheel, uint64_t now_ms)
+{
+    int level, i;
+
+    /* -- REQUIRES -- */
+    assert(wheel);
+
+    wheel->tick = now_ms / SR_TIMER_TICK_MS;
+    wheel->count = 0;
+    for(level = 0; level < SR_TIMER_LEVELS; level++)
+    {
+        for(i = 0; i < SR_TIMER_LVL_SIZE; i++)
+        { sr_timer_list_init(&wheel->slots[level][i]); }
+    }
+} /* -- sr_timer_wheel_init -- */
+
+void sr_timer_wheel_advance(struct sr_timer_wheel* wheel, uint64_t now_ms)
+{
+    uint64_t target = now_ms / SR_TIMER_TICK_MS;
+    struct sr_timer list;
+    struct sr_timer* timer;
+    int index;
+
+    /* -- REQUIRES -- */
+    assert(wheel);
+
+    while(wheel->tick <= target)
+    {
+        if(wheel->count == 0)
+        {
+            /* nothing pending, skip straight to the present */
+            wheel->tick = target + 1;
+            break;
+        }
+
+        index = wheel->tick & SR_TIMER_LVL_MASK;
+        if(index == 0 &&
+           sr_timer_cascade(wheel, 1, (wheel->tick >> SR_TIMER_LVL_BITS) & SR_TIMER_LVL_MASK) == 0 &&
+           sr_timer_cascade(wheel, 2, (wheel->tick >> (2 * SR_TIMER_LVL_BITS)) & SR_TIMER_LVL_MASK) == 0)
+        {
+            sr_timer_cascade(wheel, 3, (wheel->tick >> (3 * SR_TIMER_LVL_BITS)) & SR_TIMER_LVL_MASK);
+        }
+
+        /* detach the slot first: callbacks may add or cancel timers */
+        sr_timer_splice(&wheel->slots[0][index], &list);
+        wheel->tick++;
+
+        while(list.next != &list)
+        {
+            timer = list.next;
+            sr_timer_unlink(timer);
+            wheel->count--;
+            timer->cb(timer, timer->arg);
+        }
+    }
+} /* -- sr_timer_wheel_advance -- */
+
+void sr_timer_init(struct sr_timer* timer, sr_timer_cb cb, void* arg)
+{
+    /* -- REQUIRES -- */
+    assert(timer);
+    assert(cb);
+
+    timer->next = 0;
+    timer->prev = 0;
+    timer->expires = 0;
+    timer->cb = cb;
+    timer->arg = arg;
+} /* -- sr_timer_init -- */
+
+void sr_timer_add(struct sr_timer_wheel* wheel, struct sr_timer* timer,
+                  unsigned int delay_ms)
+{
+    /* -- REQUIRES -- */
+    assert(wheel);
+    assert(timer);
+    assert(!sr_timer_pending(timer));
+
+    timer->expires = wheel->tick + (delay_ms + SR_TIMER_TICK_MS - 1) / SR_TIMER_TICK_MS;
+    sr_timer_place(wheel, timer);
+    wheel->count++;
+} /* -- sr_timer_add -- */
+
+void sr_timer_cancel(struct sr_timer_wheel* wheel, struct sr_timer* timer)
+{
+    /* -- REQUIRES -- */
+    assert(wheel);
+    assert(timer);
+
+    if(!sr_timer_pending(timer))
+    { return; }
+    sr_timer_unlink(timer);
+    wheel->count--;
+} /* -- sr_timer_cancel -- */
+
+void sr_timer_reschedule(struct sr_timer_wheel* wheel, struct sr_timer* timer,
+                         unsigned int delay_ms)
+{
+    sr_timer_cancel(wheel, timer);
+    sr_timer_add(wheel, timer, delay_ms);
+} /* -- sr_timer_reschedule -- */
+
+int sr_timer_pending(const struct sr_timer* timer)
+{
+    return timer->next != 0;
+} /* -- sr_timer_pending -- */
@@ -0,0 +1,75 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.h
+ *
+ * Description:
+ *
+ * Hierarchical timing wheel shared by every timeout in the router (ARP
+ * retries and cache expiry, NAT idle timeouts, unsolicited SYN holds).
+ *
+ * Timers are intrusive: embed a struct sr_timer in the object it times out
+ * and recover the object in the callback with sr_timer_entry().  Adding,
+ * cancelling and rescheduling are O(1).  The wheel advances one slot per
+ * tick, so pending timers that are not yet due cost nothing; far-off timers
+ * are cascaded down one level at a time as their expiry approaches.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_TIMER_H
+#define SR_TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SR_TIMER_TICK_MS   10   /* resolution of the wheel */
+#define SR_TIMER_LVL_BITS  6
+#define SR_TIMER_LVL_SIZE  (1 << SR_TIMER_LVL_BITS)
+#define SR_TIMER_LVL_MASK  (SR_TIMER_LVL_SIZE - 1)
+#define SR_TIMER_LEVELS    4    /* 64^4 ticks: a little over 46 hours */
+
+struct sr_timer;
+
+typedef void (*sr_timer_cb)(struct sr_timer* timer, void* arg);
+
+/* recover the structure a timer is embedded in */
+#define sr_timer_entry(ptr, type, member) \
+    ((type*)((char*)(ptr) - offsetof(type, member)))
+
+struct sr_timer
+{
+    struct sr_timer* next;     /* slot list links, NULL when not pending */
+    struct sr_timer* prev;
+    uint64_t expires;          /* in ticks */
+    sr_timer_cb cb;
+    void* arg;
+};
+
+struct sr_timer_wheel
+{
+    uint64_t tick;             /* next tick to be run */
+    unsigned int count;        /* number of pending timers */
+    struct sr_timer slots[SR_TIMER_LEVELS][SR_TIMER_LVL_SIZE]; /* list heads */
+};
+
+void sr_timer_wheel_init(struct sr_timer_wheel* wheel, uint64_t now_ms);
+
+/* Run every timer due at or before 'now_ms'. */
+void sr_timer_wheel_advance(struct sr_timer_wheel* wheel, uint64_t now_ms);
+
+/* Prepare a timer; must be called before the first add. */
+void sr_timer_init(struct sr_timer* timer, sr_timer_cb cb, void* arg);
+
+/* Arm 'timer' to fire 'delay_ms' from now. The timer must not be pending. */
+void sr_timer_add(struct sr_timer_wheel* wheel, struct sr_timer* timer,
+                  unsigned int delay_ms);
+
+/* Disarm 'timer' if it is pending. */
+void sr_timer_cancel(struct sr_timer_wheel* wheel, struct sr_timer* timer);
+
+/* Cancel (if pending) and re-arm 'timer' to fire 'delay_ms' from now. */
+void sr_timer_reschedule(struct sr_timer_wheel* wheel, struct sr_timer* timer,
+                         unsigned int delay_ms);
+
+/* Non-zero while 'timer' is armed. */
+int  sr_timer_pending(const struct sr_timer* timer);
+
+#endif /* -- SR_TIMER_H -- */
@@ -40,6 +40,8 @@
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_replay.h"
+#include "sr_stats.h"
 
 #include "sha1.h"
 #include "vnscommand.h"
@@ -48,7 +50,7 @@ static void sr_log_packet(struct sr_instance* , uint8_t* , int );
 static int  sr_arp_req_not_for_us(struct sr_instance* sr,
                                   uint8_t * packet /* lent */,
                                   unsigned int len,
-                                  char* interface  /* lent */);
+                                  struct sr_if* iface  /* lent */);
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd);
 
 /*-----------------------------------------------------------------------------
@@ -336,6 +338,7 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
     int command, len;
     unsigned char *buf = 0;
     c_packet_ethernet_header* sr_pkt = 0;
+    struct sr_if* iface = 0;
     int ret = 0, bytes_read = 0;
 
     /* REQUIRES */
@@ -426,12 +429,20 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         case VNSPACKET:
             sr_pkt = (c_packet_ethernet_header *)buf;
 
+            /* -- the interface is named on the wire; look it up once -- */
+            iface = sr_get_interface(sr, (char*)(buf + sizeof(c_base)));
+            if ( iface == 0 ){
+                fprintf(stderr, "** Error, packet on unknown interface %.16s\n",
+                        (char*)(buf + sizeof(c_base)));
+                break;
+            }
+
             /* -- check if it is an ARP to another router if so drop   -- */
             if ( sr_arp_req_not_for_us(sr,
                     (buf+sizeof(c_packet_header)),
                     len - sizeof(c_packet_ethernet_header) +
                     sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
+                    iface) )
             { break; }
 
             /* -- log packet -- */
@@ -439,11 +450,11 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
                     ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
 
             /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,
+            sr_handlepacket_if(sr,
                     (buf+sizeof(c_packet_header)),
                     len - sizeof(c_packet_ethernet_header) +
                     sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base)));
+                    iface);
 
             break;
 
@@ -517,23 +528,16 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 static int
 sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
                                 uint8_t* buf, /* borrowed */
-                                const char* name /* borrowed */ )
+                                struct sr_if* iface /* borrowed */ )
 {
     struct sr_ethernet_hdr* ether_hdr = 0;
-    struct sr_if* iface = 0;
 
     /* -- REQUIRES -- */
     assert(sr);
     assert(buf);
-    assert(name);
+    assert(iface);
 
     ether_hdr = (struct sr_ethernet_hdr*)buf;
-    iface = sr_get_interface(sr, name);
-
-    if ( iface == 0 ){
-        fprintf( stderr, "** Error, interface %s, does not exist\n", name);
-        return 0;
-    }
 
     if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
         fprintf( stderr, "** Error, source address does not match interface\n");
@@ -563,6 +567,35 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
                          uint8_t* buf /* borrowed */ ,
                          unsigned int len,
                          const char* iface /* borrowed */)
+{
+    struct sr_if* out_iface = 0;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(buf);
+    assert(iface);
+
+    out_iface = sr_get_interface(sr, iface);
+    if ( out_iface == 0 ){
+        fprintf( stderr, "** Error, interface %s, does not exist\n", iface);
+        return -1;
+    }
+    return sr_send_packet_if(sr, buf, len, out_iface);
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet_if(..)
+ * Scope: Global
+ *
+ * sr_send_packet for an interface already looked up; the router's own
+ * output goes through here and uses the name only for the wire header.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet_if(struct sr_instance* sr /* borrowed */,
+                      uint8_t* buf /* borrowed */ ,
+                      unsigned int len,
+                      struct sr_if* out_iface /* borrowed */)
 {
     c_packet_header *sr_pkt;
     unsigned int total_len =  len + (sizeof(c_packet_header));
@@ -570,7 +603,7 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
     /* REQUIRES */
     assert(sr);
     assert(buf);
-    assert(iface);
+    assert(out_iface);
 
     /* don't waste my time ... */
     if ( len < sizeof(struct sr_ethernet_hdr) ){
@@ -584,19 +617,30 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
     assert(sr_pkt);
     sr_pkt->mLen  = htonl(total_len);
     sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
+    strncpy(sr_pkt->mInterfaceName,out_iface->name,16);
     memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
             buf,len);
 
     /* -- log packet -- */
     sr_log_packet(sr,buf,len);
+    sr_flight_record(&sr->flight, sr_flight_tx, out_iface->name, buf, len);
 
-    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
+    if ( ! sr_ether_addrs_match_interface( sr, buf, out_iface) ){
         fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
         free ( sr_pkt );
         return -1;
     }
 
+    sr_stats_tx(out_iface->index, len);
+
+    /* -- offline replay: output goes to a capture, not the server -- */
+    if(sr->replay)
+    {
+        sr_replay_output(sr, buf, len);
+        free(sr_pkt);
+        return 0;
+    }
+
     if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
         fprintf(stderr, "Error writing packet\n");
         free(sr_pkt);
@@ -606,7 +650,7 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
     free(sr_pkt);
 
     return 0;
-} /* -- sr_send_packet -- */
+} /* -- sr_send_packet_if -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_log_packet()
@@ -616,23 +660,14 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
 
 void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
 {
-    struct pcap_pkthdr h;
-    int size;
-
     /* REQUIRES */
     assert(sr);
 
-    if(!sr->logfile)
+    if(!sr->logger)
     {return; }
 
-    size = min(PACKET_DUMP_SIZE, len);
-
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
-
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
+    /* copies into the capture ring; the writer thread does the I/O */
+    sr_dump_async(sr->logger, buf, len);
 } /* -- sr_log_packet -- */
 
 /*-----------------------------------------------------------------------------
@@ -644,9 +679,8 @@ void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
 int  sr_arp_req_not_for_us(struct sr_instance* sr,
                            uint8_t * packet /* lent */,
                            unsigned int len,
-                           char* interface  /* lent */)
+                           struct sr_if* iface  /* lent */)
 {
-    struct sr_if* iface = sr_get_interface(sr, interface);
     struct sr_ethernet_hdr* e_hdr = 0;
     struct sr_arp_hdr*       a_hdr = 0;
 
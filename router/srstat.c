@@ -0,0 +1,225 @@
+/*-----------------------------------------------------------------------------
+ * file:  srstat.c
+ *
+ * Description:
+ *
+ * Reports the router's statistics from its shared-memory segment
+ * (sr_shmstats.h), in the manner of vmstat.  Reading costs the router
+ * nothing, so any interval is fine.
+ *
+ *   srstat [-n name] [interval [count]]     one line per interval
+ *   srstat [-n name] -s                     every counter, once
+ *
+ * Rates are per second over the interval; the first line covers one
+ * publishing period of the router.  Gauges are the values at the end of
+ * the interval.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include "sr_shmstats.h"
+
+#define SRSTAT_HEADER_EVERY 20
+
+static const struct sr_shmstats_segment* srstat_map(const char* name)
+{
+    void* seg;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0)
+    { return 0; }
+    seg = mmap(0, sizeof(struct sr_shmstats_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return seg == MAP_FAILED ? 0 : (const struct sr_shmstats_segment*)seg;
+}
+
+/* Snapshot, remapping the segment if the router that made it has gone
+   (a restarted router creates a new one under the same name). */
+static int srstat_read(const char* name, const struct sr_shmstats_segment** seg,
+                       struct sr_shmstats_segment* out)
+{
+    if(*seg && kill((*seg)->pid, 0) != 0 && errno == ESRCH)
+    {
+        munmap((void*)*seg, sizeof(**seg));
+        *seg = 0;
+    }
+    if(!*seg)
+    { *seg = srstat_map(name); }
+    if(!*seg)
+    {
+        fprintf(stderr, "srstat: no segment %s (is sr running with -S?)\n", name);
+        return -1;
+    }
+    if(sr_shmstats_snapshot(*seg, out) != 0)
+    {
+        fprintf(stderr, "srstat: no consistent snapshot of %s (unknown layout, or its writer stopped mid-update)\n", name);
+        return -1;
+    }
+    if(kill(out->pid, 0) != 0 && errno == ESRCH)
+    {
+        fprintf(stderr, "srstat: router %d behind %s is gone\n", (int)out->pid, name);
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t srstat_drops(const struct sr_stats* st)
+{
+    uint64_t n = 0;
+    int i;
+
+    for(i = 0; i < sr_drop_nreasons; i++)
+    { n += st->drops[i]; }
+    return n;
+}
+
+static void srstat_header(void)
+{
+    printf("-----packets/s---- -------kB/s------ --nat mappings- ------arp------ --drops--\n");
+    printf("%8s %9s %8s %8s %7s %7s %5s %4s %5s %9s\n",
+           "rx", "tx", "rx", "tx", "icmp", "tcp", "ent", "req", "queue", "/s");
+}
+
+static void srstat_line(const struct sr_shmstats_segment* a,
+                        const struct sr_shmstats_segment* b)
+{
+    uint64_t rxp = 0, txp = 0, rxb = 0, txb = 0;
+    double secs = (b->published_ms - a->published_ms) / 1000.0;
+    int i;
+
+    for(i = 0; i < SR_STATS_MAX_IFACES; i++)
+    {
+        rxp += b->stats.iface[i].rx_packets - a->stats.iface[i].rx_packets;
+        txp += b->stats.iface[i].tx_packets - a->stats.iface[i].tx_packets;
+        rxb += b->stats.iface[i].rx_bytes - a->stats.iface[i].rx_bytes;
+        txb += b->stats.iface[i].tx_bytes - a->stats.iface[i].tx_bytes;
+    }
+    if(secs <= 0)
+    { secs = 1; }
+
+    printf("%8.0f %9.0f %8.0f %8.0f %7lld %7lld %5lld %4lld %5lld %9.0f\n",
+           rxp / secs, txp / secs, rxb / secs / 1024, txb / secs / 1024,
+           (long long)b->stats.gauge[sr_gauge_nat_icmp],
+           (long long)b->stats.gauge[sr_gauge_nat_tcp],
+           (long long)b->stats.gauge[sr_gauge_arp_entries],
+           (long long)b->stats.gauge[sr_gauge_arp_requests],
+           (long long)b->stats.gauge[sr_gauge_arp_queued],
+           (srstat_drops(&b->stats) - srstat_drops(&a->stats)) / secs);
+    fflush(stdout);
+}
+
+/* vmstat -s: everything, once */
+static void srstat_summary(const struct sr_shmstats_segment* s)
+{
+    unsigned int i;
+
+    printf("%12d router pid\n", s->pid);
+    printf("%12llu rx packets/s\n%12llu tx packets/s\n",
+           (unsigned long long)s->rx_pps, (unsigned long long)s->tx_pps);
+    for(i = 0; i < s->niface; i++)
+    {
+        printf("%12llu %s rx packets\n%12llu %s rx bytes\n"
+               "%12llu %s tx packets\n%12llu %s tx bytes\n",
+               (unsigned long long)s->stats.iface[i].rx_packets, s->iface_name[i],
+               (unsigned long long)s->stats.iface[i].rx_bytes, s->iface_name[i],
+               (unsigned long long)s->stats.iface[i].tx_packets, s->iface_name[i],
+               (unsigned long long)s->stats.iface[i].tx_bytes, s->iface_name[i]);
+    }
+    for(i = 0; i < sr_stat_ncounters; i++)
+    {
+        printf("%12llu %s\n", (unsigned long long)s->stats.counter[i],
+               sr_stat_counter_name(i));
+    }
+    for(i = 0; i < sr_stat_ngauges; i++)
+    {
+        printf("%12lld %s\n", (long long)s->stats.gauge[i], sr_stat_gauge_name(i));
+    }
+    for(i = 0; i < sr_drop_nreasons; i++)
+    {
+        printf("%12llu drop: %s\n", (unsigned long long)s->stats.drops[i],
+               sr_drop_reason_name(i));
+    }
+}
+
+static void usage(char* argv0)
+{
+    printf("Format: %s [-n shm name] [-s] [interval [count]]\n", argv0);
+    printf("   default name %s\n", SR_SHMSTATS_NAME);
+}
+
+int main(int argc, char** argv)
+{
+    const struct sr_shmstats_segment* seg = 0;
+    struct sr_shmstats_segment prev, cur;
+    const char* name = SR_SHMSTATS_NAME;
+    int summary = 0, interval = 0, count = 1, lines = 0, c;
+
+    while((c = getopt(argc, argv, "hn:s")) != EOF)
+    {
+        switch(c)
+        {
+            case 'n':
+                name = optarg;
+                break;
+            case 's':
+                summary = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return c == 'h' ? 0 : 1;
+        }
+    }
+    if(optind < argc)
+    {
+        interval = atoi(argv[optind++]);
+        count = optind < argc ? atoi(argv[optind]) : -1;
+        if(interval <= 0)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(srstat_read(name, &seg, &prev) != 0)
+    { return 1; }
+    if(summary)
+    {
+        srstat_summary(&prev);
+        return 0;
+    }
+
+    /* first line: wait out one publishing period */
+    do
+    {
+        usleep(prev.period_ms * 1000 / 4 + 1);
+        if(srstat_read(name, &seg, &cur) != 0)
+        { return 1; }
+    } while(cur.published_ms == prev.published_ms);
+
+    for(;;)
+    {
+        if(lines++ % SRSTAT_HEADER_EVERY == 0)
+        { srstat_header(); }
+        if(cur.pid != prev.pid || cur.published_ms < prev.published_ms)
+        { prev = cur; }      /* router restarted */
+        srstat_line(&prev, &cur);
+        if(count > 0 && --count == 0)
+        { break; }
+
+        prev = cur;
+        sleep(interval);
+        if(srstat_read(name, &seg, &cur) != 0)
+        { return 1; }
+    }
+    return 0;
+} /* -- main -- */